@@ -2,11 +2,18 @@
 #include <alloca.h>
 #include <assert.h> /* assert() */
 #include <errno.h>  /* ERANGE, errno */
-#include <math.h>   /* HUGE_VAL */
+#include <fcntl.h>  /* open() */
+#include <float.h>  /* DBL_MIN */
+#include <math.h>   /* HUGE_VAL, isfinite() */
+#include <pthread.h> /* pthread_create(), pthread_join() */
+#include <stdatomic.h> /* atomic_fetch_add() */
 #include <stddef.h>
 #include <stdio.h>  /* sprintf */
 #include <stdlib.h> /* NULL, malloc(), realloc(), free(), strtod() */
 #include <string.h> /* memcpy() */
+#include <sys/mman.h> /* mmap(), madvise(), munmap() */
+#include <sys/stat.h> /* fstat() */
+#include <unistd.h>   /* close(), sysconf() */
 
 #ifndef LEPT_PARSE_STACK_INIT_SIZE
 #define LEPT_PARSE_STACK_INIT_SIZE 256
@@ -16,6 +23,74 @@
 #define LEPT_PARSE_STRINGFY_INIT_SIZE 256
 #endif
 
+#ifndef LEPT_PACKED_ARRAY_MIN_SIZE
+#define LEPT_PACKED_ARRAY_MIN_SIZE 16
+#endif
+
+#ifndef LEPT_PARSER_MAX_RETAINED
+#define LEPT_PARSER_MAX_RETAINED (64 * 1024)
+#endif
+
+#ifndef LEPT_NDJSON_MIN_CHUNK
+#define LEPT_NDJSON_MIN_CHUNK (64 * 1024)
+#endif
+
+#ifndef LEPT_ARRAY_MIN_CHUNK
+#define LEPT_ARRAY_MIN_CHUNK (64 * 1024)
+#endif
+
+#ifndef LEPT_TREE_SPLIT_SIZE
+#define LEPT_TREE_SPLIT_SIZE 1024
+#endif
+
+#ifndef LEPT_TREE_CHUNK
+#define LEPT_TREE_CHUNK 64
+#endif
+
+#ifndef LEPT_MAX_ALLOCATORS
+#define LEPT_MAX_ALLOCATORS 16
+#endif
+
+#ifndef LEPT_OBJECT_BUILDER_INIT_SIZE
+#define LEPT_OBJECT_BUILDER_INIT_SIZE 16
+#endif
+
+#ifndef LEPT_FROZEN_INDEX_MIN
+#define LEPT_FROZEN_INDEX_MIN 16
+#endif
+
+#define LEPT_FLAG_PACKED 0x1u /* Array stores raw doubles in u.p */
+#define IS_PACKED(v) (((v)->flags & LEPT_FLAG_PACKED) != 0)
+#define LEPT_FLAG_LAZY 0x2u /* Unparsed source text in u.s */
+#define IS_LAZY(v) (((v)->flags & LEPT_FLAG_LAZY) != 0)
+#define LEPT_FLAG_FROZEN 0x4u /* Read-only tree, large objects are indexed */
+#define IS_FROZEN(v) (((v)->flags & LEPT_FLAG_FROZEN) != 0)
+#define LEPT_FLAG_UNIQUE 0x8u /* Frozen object whose keys are all distinct */
+#define IS_UNIQUE(v) (((v)->flags & LEPT_FLAG_UNIQUE) != 0)
+#define MATERIALIZE(v)                                                         \
+  do {                                                                         \
+    if (IS_LAZY(v)) {                                                          \
+      lept_materialize((lept_value *)(v));                                     \
+    }                                                                          \
+  } while (0)
+
+/* The low byte of flags holds representation flags, the rest the id of the
+ * allocator that owns the buffers of the value (and the keys of an object). */
+#define LEPT_FLAG_MASK 0xFFu
+#define LEPT_ALLOCATOR_SHIFT 8
+#define ALLOCATOR_ID(v) ((v)->flags >> LEPT_ALLOCATOR_SHIFT)
+#define SET_ALLOCATOR_ID(v, id)                                                \
+  do {                                                                         \
+    (v)->flags = ((v)->flags & LEPT_FLAG_MASK) |                               \
+                 ((unsigned)(id) << LEPT_ALLOCATOR_SHIFT);                     \
+  } while (0)
+
+/* FNV-1a offset basis, the starting value of lept_hash_bytes() */
+#define LEPT_HASH_SEED ((size_t)0xcbf29ce484222325ULL)
+
+/* "-1.2345678901234567e-308" plus the terminating NUL written by sprintf */
+#define LEPT_NUMBER_MAX_LENGTH 25
+
 #define EXPECT(c, ch)                                                          \
   do {                                                                         \
     assert(*c->json == (ch));                                                  \
@@ -43,6 +118,7 @@
   do {                                                                         \
     memcpy(lept_context_push(c, len), s, len);                                 \
   } while (0)
+#define PATH_STATE(s, head, i) (((size_t *)((s)->states.stack + (head)))[i])
 #define STRING_ERROR(ret)                                                      \
   do {                                                                         \
     c->top = head;                                                             \
@@ -53,12 +129,97 @@
  * @brief Context structure for parsing JSON.
  */
 typedef struct {
-  const char *json; /**< JSON string to be parsed */
-  char *stack;      /**< Stack for storing intermediate values */
-  size_t size;      /**< Size of the stack */
-  size_t top;       /**< Top of the stack */
+  const char *json;   /**< JSON string to be parsed */
+  char *stack;        /**< Stack for storing intermediate values */
+  size_t size;        /**< Size of the stack */
+  size_t top;         /**< Top of the stack */
+  unsigned allocator; /**< Allocator id for the stack and parsed values */
+  unsigned flags;     /**< LEPT_CONTEXT_* parse mode flags */
 } lept_context;
 
+#define LEPT_CONTEXT_LAZY 0x1u /* Strings, numbers and containers stay lazy */
+#define LEPT_CONTEXT_BORROWED 0x2u /* The stack is caller memory, never freed */
+
+/**
+ * @brief Default allocation function backed by malloc().
+ */
+static void *lept_std_malloc(void *ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+/**
+ * @brief Default reallocation function backed by realloc().
+ */
+static void *lept_std_realloc(void *ctx, void *ptr, size_t old_size,
+                              size_t new_size) {
+  (void)ctx;
+  (void)old_size;
+  return realloc(ptr, new_size);
+}
+
+/**
+ * @brief Default deallocation function backed by free().
+ */
+static void lept_std_free(void *ctx, void *ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+static const lept_allocator lept_std_allocator = {
+    lept_std_malloc, lept_std_realloc, lept_std_free, NULL};
+
+/**
+ * @brief Registered allocators indexed by id; id 0 is the global default.
+ */
+static const lept_allocator *lept_allocators[LEPT_MAX_ALLOCATORS] = {
+    &lept_std_allocator};
+
+/**
+ * @brief Allocates memory from a registered allocator.
+ * 
+ * @param id Allocator id
+ * @param size Size in bytes
+ * @return void* Allocated memory
+ */
+static void *lept_malloc(unsigned id, size_t size) {
+  const lept_allocator *a = lept_allocators[id];
+  return a->malloc_fn(a->ctx, size);
+}
+
+/**
+ * @brief Resizes memory obtained from a registered allocator.
+ * 
+ * @param id Allocator id
+ * @param ptr Memory to be resized, or NULL
+ * @param old_size Current size in bytes
+ * @param new_size New size in bytes
+ * @return void* Resized memory
+ */
+static void *lept_realloc(unsigned id, void *ptr, size_t old_size,
+                          size_t new_size) {
+  const lept_allocator *a = lept_allocators[id];
+  if (ptr == NULL) {
+    return a->malloc_fn(a->ctx, new_size);
+  }
+  return a->realloc_fn(a->ctx, ptr, old_size, new_size);
+}
+
+/**
+ * @brief Returns memory to a registered allocator.
+ * 
+ * @param id Allocator id
+ * @param ptr Memory to be released, or NULL
+ * @param size Size in bytes
+ */
+static void lept_dealloc(unsigned id, void *ptr, size_t size) {
+  const lept_allocator *a = lept_allocators[id];
+  if (ptr != NULL) {
+    a->free_fn(a->ctx, ptr, size);
+  }
+}
+
 /**
  * @brief Parses a JSON value.
  * 
@@ -68,6 +229,48 @@ typedef struct {
  */
 static int lept_parse_value(lept_context *c, lept_value *v);
 
+/**
+ * @brief Sets a JSON value to an empty packed numeric array.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity of the array
+ */
+static void lept_set_packed_array(lept_value *v, size_t capacity);
+
+/**
+ * @brief Converts a packed array back to an array of JSON values.
+ * 
+ * @param v JSON array
+ */
+static void lept_unpack_array(lept_value *v);
+
+/**
+ * @brief Parses the source text of a lazy value in place.
+ * 
+ * @param v Lazy JSON value
+ */
+static void lept_materialize(lept_value *v);
+
+/**
+ * @brief Gets an array element as a number without unpacking the array.
+ * 
+ * @param v JSON array
+ * @param index Index of the element
+ * @param n Pointer to the number value
+ * @return int 1 if the element is a number, 0 otherwise
+ */
+static int lept_array_number_at(const lept_value *v, size_t index, double *n);
+
+/**
+ * @brief Hashes a byte string with 64-bit FNV-1a.
+ * 
+ * @param s Bytes to be hashed
+ * @param len Number of bytes
+ * @param h Hash to continue from, LEPT_HASH_SEED to start
+ * @return size_t Hash value
+ */
+static size_t lept_hash_bytes(const char *s, size_t len, size_t h);
+
 /**
  * @brief Pushes a value onto the context stack.
  * 
@@ -79,6 +282,7 @@ static void *lept_context_push(lept_context *c, size_t size) {
   void *ret;
   assert(c != NULL && size > 0);
   if (c->top + size >= c->size) {
+    size_t old_size = c->size;
     if (c->size == 0) {
       c->size = LEPT_PARSE_STACK_INIT_SIZE;
     }
@@ -86,7 +290,16 @@ static void *lept_context_push(lept_context *c, size_t size) {
       /* c->size * 1.5 */
       c->size += c->size >> 1;
     }
-    c->stack = (char *)realloc(c->stack, c->size);
+    if (c->flags & LEPT_CONTEXT_BORROWED) {
+      /* Move off the caller memory into a block of our own */
+      char *stack = (char *)lept_malloc(c->allocator, c->size);
+      memcpy(stack, c->stack, c->top);
+      c->stack = stack;
+      c->flags &= ~LEPT_CONTEXT_BORROWED;
+    } else {
+      c->stack =
+          (char *)lept_realloc(c->allocator, c->stack, old_size, c->size);
+    }
   }
   ret = c->stack + c->top;
   c->top += size;
@@ -105,6 +318,18 @@ static void *lept_context_pop(lept_context *c, size_t size) {
   return c->stack + (c->top -= size);
 }
 
+/**
+ * @brief Computes the geometrically grown capacity of a container.
+ * 
+ * @param capacity Current capacity
+ * @param required Minimum capacity required
+ * @return size_t New capacity (at least doubled, never below required)
+ */
+static size_t lept_grow_capacity(size_t capacity, size_t required) {
+  size_t grown = capacity == 0 ? 1 : capacity * 2;
+  return grown < required ? required : grown;
+}
+
 /**
  * @brief Parses whitespace characters in the JSON string.
  * 
@@ -143,15 +368,12 @@ static int lept_parse_literal(lept_context *c, lept_value *v,
 }
 
 /**
- * @brief Parses a number value in the JSON string.
+ * @brief Scans the syntax of a number in the JSON string.
  * 
- * @param c Context for parsing
- * @param v JSON value to be parsed
- * @return int Parsing result
+ * @param p Pointer to the JSON string
+ * @return const char* Pointer past the number, or NULL if it is invalid
  */
-static int lept_parse_number(lept_context *c, lept_value *v) {
-  const char *p = c->json;
-
+static const char *lept_scan_number(const char *p) {
   /* Negative sign */
   if (*p == '-') {
     p++;
@@ -161,7 +383,7 @@ static int lept_parse_number(lept_context *c, lept_value *v) {
     p++;
   } else {
     if (!ISDIGIT1TO9(*p)) {
-      return LEPT_PARSE_INVALID_VALUE;
+      return NULL;
     }
     p++;
     while (ISDIGIT(*p)) {
@@ -172,7 +394,7 @@ static int lept_parse_number(lept_context *c, lept_value *v) {
   if (*p == '.') {
     p++;
     if (!ISDIGIT(*p)) {
-      return LEPT_PARSE_INVALID_VALUE;
+      return NULL;
     }
     p++;
     while (ISDIGIT(*p)) {
@@ -186,14 +408,28 @@ static int lept_parse_number(lept_context *c, lept_value *v) {
       p++;
     }
     if (!ISDIGIT(*p)) {
-      return LEPT_PARSE_INVALID_VALUE;
+      return NULL;
     }
     p++;
     while (ISDIGIT(*p)) {
       p++;
     }
   }
+  return p;
+}
 
+/**
+ * @brief Parses a number value in the JSON string.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @return int Parsing result
+ */
+static int lept_parse_number(lept_context *c, lept_value *v) {
+  const char *p = lept_scan_number(c->json);
+  if (p == NULL) {
+    return LEPT_PARSE_INVALID_VALUE;
+  }
   errno = 0;
   v->u.n = strtod(c->json, NULL);
   if (errno == ERANGE && (v->u.n == HUGE_VAL || v->u.n == -HUGE_VAL)) {
@@ -231,27 +467,42 @@ static const char *lept_parse_hex4(const char *p, unsigned *u) {
 }
 
 /**
- * @brief Encodes a Unicode code point as UTF-8 and pushes it onto the context stack.
+ * @brief Encodes a Unicode code point as UTF-8 into a buffer.
  * 
- * @param c Context for parsing
+ * @param p Buffer of at least 4 bytes
  * @param u Unicode code point to be encoded
+ * @return size_t Number of bytes written
  */
-static void lept_encode_utf8(lept_context *c, unsigned u) {
+static size_t lept_utf8_write(char *p, unsigned u) {
   if (u <= 0x007F) {
-    PUTC(c, (u & 0x7F));
+    p[0] = (char)(u & 0x7F);
+    return 1;
   } else if (u <= 0x07FF) {
-    PUTC(c, (0xC0 | (u >> 6) & 0x1F));
-    PUTC(c, (0x80 | u & 0x3F));
+    p[0] = (char)(0xC0 | ((u >> 6) & 0x1F));
+    p[1] = (char)(0x80 | (u & 0x3F));
+    return 2;
   } else if (u <= 0xFFFF) {
-    PUTC(c, (0xE0 | (u >> 12) & 0x0F));
-    PUTC(c, (0x80 | (u >> 6) & 0x3F));
-    PUTC(c, (0x80 | u & 0x3F));
-  } else {
-    PUTC(c, (0xF0 | (u >> 18) & 0x07));
-    PUTC(c, (0x80 | (u >> 12) & 0x3F));
-    PUTC(c, (0x80 | (u >> 6) & 0x3F));
-    PUTC(c, (0x80 | u & 0x3F));
+    p[0] = (char)(0xE0 | ((u >> 12) & 0x0F));
+    p[1] = (char)(0x80 | ((u >> 6) & 0x3F));
+    p[2] = (char)(0x80 | (u & 0x3F));
+    return 3;
   }
+  p[0] = (char)(0xF0 | ((u >> 18) & 0x07));
+  p[1] = (char)(0x80 | ((u >> 12) & 0x3F));
+  p[2] = (char)(0x80 | ((u >> 6) & 0x3F));
+  p[3] = (char)(0x80 | (u & 0x3F));
+  return 4;
+}
+
+/**
+ * @brief Encodes a Unicode code point as UTF-8 and pushes it onto the
+ * context stack.
+ * 
+ * @param c Context for parsing
+ * @param u Unicode code point to be encoded
+ */
+static void lept_encode_utf8(lept_context *c, unsigned u) {
+  c->top -= 4 - lept_utf8_write((char *)lept_context_push(c, 4), u);
 }
 
 /**
@@ -363,7 +614,7 @@ static int lept_parse_string(lept_context *c, lept_value *v) {
  * @return int Parsing result
  */
 static int lept_parse_array(lept_context *c, lept_value *v) {
-  size_t size = 0;
+  size_t size = 0, numbers = 0;
   int ret;
   EXPECT(c, '[');
   lept_parse_whitespace(c);
@@ -375,20 +626,30 @@ static int lept_parse_array(lept_context *c, lept_value *v) {
   while (1) {
     lept_value e;
     lept_init(&e);
+    SET_ALLOCATOR_ID(&e, c->allocator);
     if ((ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK) {
       break;
     }
     memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
     size++;
+    numbers += e.type == LEPT_NUMBER && !IS_LAZY(&e);
     lept_parse_whitespace(c);
     if (*c->json == ',') {
       c->json++;
       lept_parse_whitespace(c);
     } else if (*c->json == ']') {
+      lept_value *head =
+          (lept_value *)lept_context_pop(c, size * sizeof(lept_value));
       c->json++;
-      lept_set_array(v, size);
-      memcpy(v->u.a.e, lept_context_pop(c, size * sizeof(lept_value)),
-             size * sizeof(lept_value));
+      if (numbers == size && size >= LEPT_PACKED_ARRAY_MIN_SIZE) {
+        lept_set_packed_array(v, size);
+        for (size_t i = 0; i < size; i++) {
+          v->u.p.n[i] = head[i].u.n;
+        }
+      } else {
+        lept_set_array(v, size);
+        memcpy(v->u.a.e, head, size * sizeof(lept_value));
+      }
       v->u.a.size = size;
       return LEPT_PARSE_OK;
     } else {
@@ -425,6 +686,7 @@ static int lept_parse_object(lept_context *c, lept_value *v) {
   size = 0;
   while (1) {
     lept_init(&m.v);
+    SET_ALLOCATOR_ID(&m.v, c->allocator);
     if (*c->json != '"') {
       ret = LEPT_PARSE_MISS_KEY;
       break;
@@ -432,7 +694,7 @@ static int lept_parse_object(lept_context *c, lept_value *v) {
     if ((ret = lept_parse_string_raw(c, &str, &m.klen)) != LEPT_PARSE_OK) {
       break;
     }
-    m.k = (char *)malloc(m.klen + 1);
+    m.k = (char *)lept_malloc(c->allocator, m.klen + 1);
     memcpy(m.k, str, m.klen);
     m.k[m.klen] = '\0';
     lept_parse_whitespace(c);
@@ -464,784 +726,7226 @@ static int lept_parse_object(lept_context *c, lept_value *v) {
       break;
     }
   }
-  free(m.k);
+  if (m.k != NULL) {
+    lept_dealloc(c->allocator, m.k, m.klen + 1);
+  }
   for (size_t i = 0; i < size; i++) {
     lept_member *m = (lept_member *)lept_context_pop(c, sizeof(lept_member));
     lept_free(&m->v);
-    free(m->k);
+    lept_dealloc(c->allocator, m->k, m->klen + 1);
   }
   v->type = LEPT_NULL;
   return ret;
 }
 
 /**
- * @brief Parses a JSON value.
+ * @brief Validates a JSON value and moves past it without building it.
+ * 
+ * Reports the same errors as lept_parse_value() but allocates nothing.
  * 
  * @param c Context for parsing
- * @param v JSON value to be parsed
  * @return int Parsing result
  */
-static int lept_parse_value(lept_context *c, lept_value *v) {
-  switch (*c->json) {
-  case 'n':
-    return lept_parse_literal(c, v, "null", LEPT_NULL);
-  case 't':
-    return lept_parse_literal(c, v, "true", LEPT_TRUE);
-  case 'f':
-    return lept_parse_literal(c, v, "false", LEPT_FALSE);
-  case '\"':
-    return lept_parse_string(c, v);
-  case '[':
-    return lept_parse_array(c, v);
-  case '\0':
-    return LEPT_PARSE_EXPECT_VALUE;
-  case '{':
-    return lept_parse_object(c, v);
-  default:
-    return lept_parse_number(c, v);
+static int lept_skip_value(lept_context *c);
+
+/**
+ * @brief Validates a string value and moves past it.
+ * 
+ * @param c Context for parsing
+ * @return int Parsing result
+ */
+static int lept_skip_string(lept_context *c) {
+  const char *p;
+  unsigned u;
+  EXPECT(c, '\"');
+  p = c->json;
+  while (1) {
+    char ch = *p++;
+    switch (ch) {
+    case '\"':
+      c->json = p;
+      return LEPT_PARSE_OK;
+    case '\0':
+      return LEPT_PARSE_MISS_QUOTATION_MARK;
+    case '\\':
+      switch (*p++) {
+      case '\"':
+      case '\\':
+      case '/':
+      case 'b':
+      case 'f':
+      case 'n':
+      case 'r':
+      case 't':
+        break;
+      case 'u':
+        if (!(p = lept_parse_hex4(p, &u))) {
+          return LEPT_PARSE_INVALID_UNICODE_HEX;
+        }
+        if (u >= 0xD800 && u <= 0xDBFF) {
+          if (p[0] != '\\' || p[1] != 'u' ||
+              !(p = lept_parse_hex4(p + 2, &u)) || u < 0xDC00 ||
+              u > 0xDFFF) {
+            return LEPT_PARSE_INVALID_UNICODE_SURROGATE;
+          }
+        }
+        break;
+      default:
+        return LEPT_PARSE_INVALID_STRING_ESCAPE;
+      }
+      break;
+    default:
+      if ((unsigned char)ch < 0x20) {
+        return LEPT_PARSE_INVALID_STRING_CHAR;
+      }
+    }
   }
 }
 
 /**
- * @brief Parses a JSON string.
+ * @brief Validates a number value and moves past it.
  * 
- * @param v JSON value to be parsed
- * @param json JSON string to be parsed
+ * Only a number with an exponent or more than 308 characters can overflow,
+ * so strtod() is skipped for all others.
+ * 
+ * @param c Context for parsing
  * @return int Parsing result
  */
-int lept_parse(lept_value *v, const char *json) {
-  lept_context c;
+static int lept_skip_number(lept_context *c) {
+  const char *p = lept_scan_number(c->json), *q;
+  double n;
+  if (p == NULL) {
+    return LEPT_PARSE_INVALID_VALUE;
+  }
+  for (q = c->json; q < p && *q != 'e' && *q != 'E'; q++) {
+  }
+  if (q < p || p - c->json > 308) {
+    errno = 0;
+    n = strtod(c->json, NULL);
+    if (errno == ERANGE && (n == HUGE_VAL || n == -HUGE_VAL)) {
+      return LEPT_PARSE_NUMBER_TOO_BIG;
+    }
+  }
+  c->json = p;
+  return LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Validates an array value and moves past it.
+ * 
+ * @param c Context for parsing
+ * @return int Parsing result
+ */
+static int lept_skip_array(lept_context *c) {
   int ret;
-  assert(v != NULL);
-  c.json = json;
-  c.stack = NULL;
-  c.top = 0;
-  c.size = 0;
-  lept_init(v);
-  lept_parse_whitespace(&c);
-  if ((ret = lept_parse_value(&c, v)) == LEPT_PARSE_OK) {
-    lept_parse_whitespace(&c);
-    if (*c.json != '\0') {
-      v->type = LEPT_NULL;
-      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+  EXPECT(c, '[');
+  lept_parse_whitespace(c);
+  if (*c->json == ']') {
+    c->json++;
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+      return ret;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == ']') {
+      c->json++;
+      return LEPT_PARSE_OK;
+    } else {
+      return LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
     }
   }
-  assert(c.top == 0);
-  free(c.stack);
-  return ret;
 }
 
 /**
- * @brief Stringifies a string value and pushes it onto the context stack.
+ * @brief Validates an object value and moves past it.
  * 
  * @param c Context for parsing
- * @param s String value to be stringified
- * @param len Length of the string value
+ * @return int Parsing result
  */
-static void lept_stringify_string(lept_context *c, const char *s, size_t len) {
-  static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7',
-                                    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
-  size_t i, size;
-  char *head, *p;
-  assert(s != NULL);
-  p = head = lept_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
-  *p++ = '"';
-  for (i = 0; i < len; i++) {
-    unsigned char ch = (unsigned char)s[i];
-    switch (ch) {
-    case '\"':
-      *p++ = '\\';
-      *p++ = '\"';
-      break;
-    case '\\':
-      *p++ = '\\';
-      *p++ = '\\';
-      break;
-    case '\b':
-      *p++ = '\\';
-      *p++ = 'b';
-      break;
-    case '\f':
-      *p++ = '\\';
-      *p++ = 'f';
-      break;
-    case '\n':
-      *p++ = '\\';
-      *p++ = 'n';
-      break;
-    case '\r':
-      *p++ = '\\';
-      *p++ = 'r';
-      break;
-    case '\t':
-      *p++ = '\\';
-      *p++ = 't';
-      break;
-    default:
-      if (ch < 0x20) {
-        *p++ = '\\';
-        *p++ = 'u';
-        *p++ = '0';
-        *p++ = '0';
-        *p++ = hex_digits[ch >> 4];
-        *p++ = hex_digits[ch & 15];
-      } else
-        *p++ = s[i];
+static int lept_skip_object(lept_context *c) {
+  int ret;
+  EXPECT(c, '{');
+  lept_parse_whitespace(c);
+  if (*c->json == '}') {
+    c->json++;
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    if (*c->json != '"') {
+      return LEPT_PARSE_MISS_KEY;
+    }
+    if ((ret = lept_skip_string(c)) != LEPT_PARSE_OK) {
+      return ret;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json != ':') {
+      return LEPT_PARSE_MISS_COLON;
+    }
+    c->json++;
+    lept_parse_whitespace(c);
+    if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+      return ret;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == '}') {
+      c->json++;
+      return LEPT_PARSE_OK;
+    } else {
+      return LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
     }
   }
-  *p++ = '"';
-  c->top -= size - (p - head);
+}
+
+static int lept_skip_value(lept_context *c) {
+  lept_value literal;
+  switch (*c->json) {
+  case 'n':
+    return lept_parse_literal(c, &literal, "null", LEPT_NULL);
+  case 't':
+    return lept_parse_literal(c, &literal, "true", LEPT_TRUE);
+  case 'f':
+    return lept_parse_literal(c, &literal, "false", LEPT_FALSE);
+  case '\"':
+    return lept_skip_string(c);
+  case '[':
+    return lept_skip_array(c);
+  case '\0':
+    return LEPT_PARSE_EXPECT_VALUE;
+  case '{':
+    return lept_skip_object(c);
+  default:
+    return lept_skip_number(c);
+  }
 }
 
 /**
- * @brief Stringifies a JSON value and pushes it onto the context stack.
+ * @brief Validates a value and records its source text as a lazy value.
  * 
  * @param c Context for parsing
- * @param v JSON value to be stringified
+ * @param v JSON value to be parsed
+ * @param type Type of the value
+ * @return int Parsing result
  */
-static void lept_stringify_value(lept_context *c, const lept_value *v) {
-  size_t i, n;
-  switch (v->type) {
-  case LEPT_NULL:
-    PUTS(c, "null", 4);
-    break;
-  case LEPT_FALSE:
-    PUTS(c, "false", 5);
-    break;
-  case LEPT_TRUE:
-    PUTS(c, "true", 4);
-    break;
-  case LEPT_NUMBER:
-    c->top -= 32 - sprintf(lept_context_push(c, 32), "%.17g", v->u.n);
-    break;
-  case LEPT_STRING:
-    lept_stringify_string(c, v->u.s.s, v->u.s.len);
-    break;
-  case LEPT_ARRAY:
-    PUTC(c, '[');
-    for (i = 0; i < v->u.a.size; i++) {
-      if (i > 0)
-        PUTC(c, ',');
-      lept_stringify_value(c, &v->u.a.e[i]);
-    }
-    PUTC(c, ']');
-    break;
-  case LEPT_OBJECT:
-    PUTC(c, '{');
-    for (i = 0; i < v->u.o.size; i++) {
-      if (i > 0)
-        PUTC(c, ',');
-      lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
-      PUTC(c, ':');
-      lept_stringify_value(c, &v->u.o.m[i].v);
-    }
-    PUTC(c, '}');
-    break;
-  default:
-    assert(0 && "invalid type");
-    break;
+static int lept_parse_lazy_value(lept_context *c, lept_value *v,
+                                 lept_type type) {
+  const char *json = c->json;
+  int ret;
+  if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+    return ret;
   }
+  v->u.s.s = (char *)json;
+  v->u.s.len = (size_t)(c->json - json);
+  v->type = type;
+  v->flags |= LEPT_FLAG_LAZY;
+  return LEPT_PARSE_OK;
 }
 
 /**
- * @brief Stringifies a JSON value.
+ * @brief Parses a JSON value.
  * 
- * @param v JSON value to be stringified
- * @param length Pointer to the length of the stringified value
- * @return char* Stringified JSON value
+ * In lazy mode strings, numbers and containers are only validated.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @return int Parsing result
  */
-char *lept_stringify(const lept_value *v, size_t *length) {
-  lept_context c;
-  assert(v != NULL);
-  c.stack = (char *)malloc(c.size = LEPT_PARSE_STRINGFY_INIT_SIZE);
-  c.top = 0;
-  lept_stringify_value(&c, v);
-  if (length) {
-    *length = c.top;
+static int lept_parse_value(lept_context *c, lept_value *v) {
+  int lazy = (c->flags & LEPT_CONTEXT_LAZY) != 0;
+  switch (*c->json) {
+  case 'n':
+    return lept_parse_literal(c, v, "null", LEPT_NULL);
+  case 't':
+    return lept_parse_literal(c, v, "true", LEPT_TRUE);
+  case 'f':
+    return lept_parse_literal(c, v, "false", LEPT_FALSE);
+  case '\"':
+    return lazy ? lept_parse_lazy_value(c, v, LEPT_STRING)
+                : lept_parse_string(c, v);
+  case '[':
+    return lazy ? lept_parse_lazy_value(c, v, LEPT_ARRAY)
+                : lept_parse_array(c, v);
+  case '\0':
+    return LEPT_PARSE_EXPECT_VALUE;
+  case '{':
+    return lazy ? lept_parse_lazy_value(c, v, LEPT_OBJECT)
+                : lept_parse_object(c, v);
+  default:
+    return lazy ? lept_parse_lazy_value(c, v, LEPT_NUMBER)
+                : lept_parse_number(c, v);
   }
-  PUTC(&c, '\0');
-  return c.stack;
 }
 
 /**
- * @brief Copies a JSON value.
+ * @brief Parses a single root value with a prepared context.
  * 
- * @param dst Destination JSON value
- * @param src Source JSON value
+ * The context stack is left empty but not released.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @return int Parsing result
  */
-void lept_copy(lept_value *dst, const lept_value *src) {
-  assert(src != NULL && dst != NULL && src != dst);
-  switch (src->type) {
-  case LEPT_STRING:
-    lept_set_string(dst, src->u.s.s, src->u.s.len);
-    break;
-  case LEPT_ARRAY:
-    lept_set_array(dst, src->u.a.capacity);
-    for (size_t i = 0; i < src->u.a.size; i++) {
-      lept_copy(lept_pushback_array_element(dst), src->u.a.e + i);
-    }
-    break;
-  case LEPT_OBJECT:
-    lept_set_object(dst, src->u.a.capacity);
-    for (size_t i = 0; i < src->u.a.size; i++) {
-      lept_copy(lept_set_object_value(dst, src->u.o.m[i].k, src->u.o.m[i].klen),
-                &src->u.o.m[i].v);
+static int lept_parse_root(lept_context *c, lept_value *v) {
+  int ret;
+  lept_init_with_allocator(v, (int)c->allocator);
+  lept_parse_whitespace(c);
+  if ((ret = lept_parse_value(c, v)) == LEPT_PARSE_OK) {
+    lept_parse_whitespace(c);
+    if (*c->json != '\0') {
+      lept_free(v);
+      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
     }
-    break;
-  default:
-    memcpy(dst, src, sizeof(lept_value));
-    break;
   }
+  assert(c->top == 0);
+  return ret;
 }
 
 /**
- * @brief Moves a JSON value.
+ * @brief Parses a JSON string.
  * 
- * @param dst Destination JSON value
- * @param src Source JSON value
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @return int Parsing result
  */
-void lept_move(lept_value *dst, lept_value *src) {
-  assert(src != NULL && dst != NULL && src != dst);
-  lept_free(dst);
-  memcpy(dst, src, sizeof(lept_value));
-  lept_init(src);
+int lept_parse(lept_value *v, const char *json) {
+  return lept_parse_with_allocator(v, json, LEPT_DEFAULT_ALLOCATOR);
 }
 
 /**
- * @brief Swaps two JSON values.
+ * @brief Parses a JSON string with a registered allocator.
  * 
- * @param lhs Left-hand side JSON value
- * @param rhs Right-hand side JSON value
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @param allocator Allocator id
+ * @return int Parsing result
  */
-void lept_swap(lept_value *lhs, lept_value *rhs) {
-  assert(lhs != NULL && rhs != NULL);
-  if (lhs != rhs) {
-    lept_value temp;
-    memcpy(&temp, lhs, sizeof(lept_value));
-    memcpy(lhs, rhs, sizeof(lept_value));
-    memcpy(rhs, &temp, sizeof(lept_value));
-  }
+int lept_parse_with_allocator(lept_value *v, const char *json, int allocator) {
+  lept_context c;
+  int ret;
+  assert(v != NULL);
+  assert(allocator >= 0 && allocator < LEPT_MAX_ALLOCATORS &&
+         lept_allocators[allocator] != NULL);
+  c.json = json;
+  c.stack = NULL;
+  c.top = 0;
+  c.size = 0;
+  c.allocator = (unsigned)allocator;
+  c.flags = 0;
+  ret = lept_parse_root(&c, v);
+  lept_dealloc(c.allocator, c.stack, c.size);
+  return ret;
 }
 
 /**
- * @brief Frees a JSON value.
+ * @brief Validates a JSON string and parses it on demand.
  * 
- * @param v JSON value to be freed
+ * The value keeps pointing into json until it is freed.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @return int Parsing result
  */
-void lept_free(lept_value *v) {
-  size_t i;
+int lept_parse_lazy(lept_value *v, const char *json) {
+  lept_context c;
   assert(v != NULL);
-  switch (v->type) {
+  c.json = json;
+  c.stack = NULL;
+  c.top = 0;
+  c.size = 0;
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = LEPT_CONTEXT_LAZY;
+  /* Only lazy values are created, so the stack is never used */
+  return lept_parse_root(&c, v);
+}
+
+static void lept_materialize(lept_value *v) {
+  lept_context c;
+  lept_type type = v->type;
+  int ret;
+  c.json = v->u.s.s;
+  c.stack = NULL;
+  c.top = 0;
+  c.size = 0;
+  c.allocator = ALLOCATOR_ID(v);
+  c.flags = LEPT_CONTEXT_LAZY;
+  v->type = LEPT_NULL;
+  v->flags &= ~LEPT_FLAG_LAZY;
+  /* The source text was validated, so parsing one level cannot fail */
+  switch (type) {
+  case LEPT_NUMBER:
+    ret = lept_parse_number(&c, v);
+    break;
   case LEPT_STRING:
-    free(v->u.s.s);
+    ret = lept_parse_string(&c, v);
     break;
   case LEPT_ARRAY:
-    for (i = 0; i < v->u.a.size; i++) {
-      lept_free(&v->u.a.e[i]);
-    }
-    free(v->u.a.e);
-    break;
-  case LEPT_OBJECT:
-    for (i = 0; i < v->u.o.size; i++) {
-      lept_free(&v->u.o.m[i].v);
-      free(v->u.o.m[i].k);
-    }
-    free(v->u.o.m);
+    ret = lept_parse_array(&c, v);
     break;
   default:
+    ret = lept_parse_object(&c, v);
     break;
   }
-  v->type = LEPT_NULL;
+  assert(ret == LEPT_PARSE_OK);
+  (void)ret;
+  lept_dealloc(c.allocator, c.stack, c.size);
+}
+
+/**
+ * @brief Finds the projection child selecting a key or array index.
+ * 
+ * @param p Projection node
+ * @param key Object key, or NULL when matching an array index
+ * @param klen Length of the key, or the array index
+ * @return const lept_projection* Matching child, or NULL if none
+ */
+static const lept_projection *lept_projection_find(const lept_projection *p,
+                                                   const char *key,
+                                                   size_t klen) {
+  const lept_projection *wildcard = NULL;
+  for (size_t i = 0; i < p->size; i++) {
+    const lept_projection *child = &p->children[i];
+    if (key != NULL ? child->klen == klen && memcmp(child->key, key, klen) == 0
+                    : child->index == klen) {
+      return child;
+    }
+    if (child->klen == 1 && child->key[0] == '*') {
+      wildcard = child;
+    }
+  }
+  return wildcard;
+}
+
+/**
+ * @brief Parses the parts of a JSON value selected by a projection.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @param p Projection node of the value
+ * @return int Parsing result
+ */
+static int lept_parse_projected_value(lept_context *c, lept_value *v,
+                                      const lept_projection *p);
+
+/**
+ * @brief Parses the elements of an array selected by a projection.
+ * 
+ * Unselected elements before the last selected one become null so that
+ * indices are preserved; the others are skipped.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @param p Projection node of the array
+ * @return int Parsing result
+ */
+static int lept_parse_projected_array(lept_context *c, lept_value *v,
+                                      const lept_projection *p) {
+  size_t size = 0, index = 0;
+  int ret;
+  EXPECT(c, '[');
+  lept_parse_whitespace(c);
+  if (*c->json == ']') {
+    c->json++;
+    lept_set_array(v, 0);
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    const lept_projection *child = lept_projection_find(p, NULL, index);
+    if (child != NULL && !child->keep && *c->json != '[' && *c->json != '{') {
+      child = NULL; /* a path cannot continue through a scalar */
+    }
+    if (child == NULL) {
+      if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+        break;
+      }
+    } else {
+      lept_value e;
+      lept_init(&e);
+      SET_ALLOCATOR_ID(&e, c->allocator);
+      if ((ret = lept_parse_projected_value(c, &e, child)) != LEPT_PARSE_OK) {
+        break;
+      }
+      for (; size < index; size++) {
+        lept_value *null =
+            (lept_value *)lept_context_push(c, sizeof(lept_value));
+        lept_init(null);
+        SET_ALLOCATOR_ID(null, c->allocator);
+      }
+      memcpy(lept_context_push(c, sizeof(lept_value)), &e,
+             sizeof(lept_value));
+      size++;
+    }
+    index++;
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == ']') {
+      c->json++;
+      lept_set_array(v, size);
+      if (size > 0) {
+        memcpy(v->u.a.e, lept_context_pop(c, size * sizeof(lept_value)),
+               size * sizeof(lept_value));
+      }
+      v->u.a.size = size;
+      return LEPT_PARSE_OK;
+    } else {
+      ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+      break;
+    }
+  }
+  for (size_t i = 0; i < size; ++i) {
+    lept_free((lept_value *)lept_context_pop(c, sizeof(lept_value)));
+  }
+  return ret;
+}
+
+/**
+ * @brief Parses the members of an object selected by a projection.
+ * 
+ * Keys without escapes are matched against the projection in place, so
+ * unselected members are skipped without any copying.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be parsed
+ * @param p Projection node of the object
+ * @return int Parsing result
+ */
+static int lept_parse_projected_object(lept_context *c, lept_value *v,
+                                       const lept_projection *p) {
+  size_t size = 0;
+  lept_member m;
+  int ret;
+  EXPECT(c, '{');
+  lept_parse_whitespace(c);
+  if (*c->json == '}') {
+    c->json++;
+    lept_set_object(v, 0);
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    const lept_projection *child;
+    const char *key = c->json + 1;
+    char *str = (char *)key;
+    if (*c->json != '"') {
+      ret = LEPT_PARSE_MISS_KEY;
+      break;
+    }
+    if ((ret = lept_skip_string(c)) != LEPT_PARSE_OK) {
+      break;
+    }
+    m.klen = (size_t)(c->json - key) - 1;
+    if (memchr(key, '\\', m.klen) != NULL) {
+      c->json = key - 1;
+      if ((ret = lept_parse_string_raw(c, &str, &m.klen)) != LEPT_PARSE_OK) {
+        break;
+      }
+    }
+    child = lept_projection_find(p, str, m.klen);
+    lept_parse_whitespace(c);
+    if (*c->json != ':') {
+      ret = LEPT_PARSE_MISS_COLON;
+      break;
+    }
+    c->json++;
+    lept_parse_whitespace(c);
+    if (child != NULL && !child->keep && *c->json != '[' && *c->json != '{') {
+      child = NULL; /* a path cannot continue through a scalar */
+    }
+    if (child == NULL) {
+      if ((ret = lept_skip_value(c)) != LEPT_PARSE_OK) {
+        break;
+      }
+    } else {
+      m.k = (char *)lept_malloc(c->allocator, m.klen + 1);
+      memcpy(m.k, str, m.klen);
+      m.k[m.klen] = '\0';
+      lept_init(&m.v);
+      SET_ALLOCATOR_ID(&m.v, c->allocator);
+      if ((ret = lept_parse_projected_value(c, &m.v, child)) !=
+          LEPT_PARSE_OK) {
+        lept_dealloc(c->allocator, m.k, m.klen + 1);
+        break;
+      }
+      memcpy(lept_context_push(c, sizeof(lept_member)), &m,
+             sizeof(lept_member));
+      size++;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == '}') {
+      c->json++;
+      lept_set_object(v, size);
+      if (size > 0) {
+        memcpy(v->u.o.m, lept_context_pop(c, size * sizeof(lept_member)),
+               size * sizeof(lept_member));
+      }
+      v->u.o.size = size;
+      return LEPT_PARSE_OK;
+    } else {
+      ret = LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+      break;
+    }
+  }
+  for (size_t i = 0; i < size; i++) {
+    lept_member *m = (lept_member *)lept_context_pop(c, sizeof(lept_member));
+    lept_free(&m->v);
+    lept_dealloc(c->allocator, m->k, m->klen + 1);
+  }
+  return ret;
+}
+
+static int lept_parse_projected_value(lept_context *c, lept_value *v,
+                                      const lept_projection *p) {
+  if (p->keep) {
+    return lept_parse_value(c, v);
+  }
+  switch (*c->json) {
+  case '[':
+    return lept_parse_projected_array(c, v, p);
+  case '{':
+    return lept_parse_projected_object(c, v, p);
+  default:
+    return lept_skip_value(c);
+  }
+}
+
+/**
+ * @brief Parses only the parts of a JSON string selected by a projection.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @param p Projection
+ * @return int Parsing result
+ */
+int lept_parse_projected(lept_value *v, const char *json,
+                         const lept_projection *p) {
+  lept_context c;
+  int ret;
+  assert(v != NULL && p != NULL);
+  c.json = json;
+  c.stack = NULL;
+  c.top = 0;
+  c.size = 0;
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  lept_init(v);
+  lept_parse_whitespace(&c);
+  if ((ret = lept_parse_projected_value(&c, v, p)) == LEPT_PARSE_OK) {
+    lept_parse_whitespace(&c);
+    if (*c.json != '\0') {
+      lept_free(v);
+      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  assert(c.top == 0);
+  lept_dealloc(c.allocator, c.stack, c.size);
+  return ret;
+}
+
+/**
+ * @brief Parses a JSON value into an existing value, reusing its allocations.
+ * 
+ * @param c Context for parsing
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result
+ */
+static int lept_reparse_value(lept_context *c, lept_value *v);
+
+/**
+ * @brief Parses a string value into an existing value.
+ * 
+ * A string buffer of the same length is overwritten in place, one of a
+ * different length is resized with a single reallocation.
+ * 
+ * @param c Context for parsing
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result
+ */
+static int lept_reparse_string(lept_context *c, lept_value *v) {
+  size_t len;
+  char *s;
+  int ret;
+  if ((ret = lept_parse_string_raw(c, &s, &len)) != LEPT_PARSE_OK) {
+    return ret;
+  }
+  if (v->type != LEPT_STRING) {
+    lept_set_string(v, s, len);
+    return LEPT_PARSE_OK;
+  }
+  if (v->u.s.len != len) {
+    v->u.s.s = (char *)lept_realloc(ALLOCATOR_ID(v), v->u.s.s, v->u.s.len + 1,
+                                    len + 1);
+    v->u.s.len = len;
+  }
+  memcpy(v->u.s.s, s, len);
+  v->u.s.s[len] = '\0';
+  return LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Parses an array value into an existing value.
+ * 
+ * Existing elements are parsed into in place and the capacity is kept. A
+ * packed array stays packed until a non-number element is met. Any other
+ * value falls back to lept_parse_array().
+ * 
+ * @param c Context for parsing
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result
+ */
+static int lept_reparse_array(lept_context *c, lept_value *v) {
+  size_t count = 0;
+  int ret;
+  if (v->type != LEPT_ARRAY) {
+    lept_free(v);
+    return lept_parse_array(c, v);
+  }
+  EXPECT(c, '[');
+  lept_parse_whitespace(c);
+  if (*c->json == ']') {
+    c->json++;
+    lept_clear_array(v);
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    if (IS_PACKED(v) && (*c->json == '-' || ISDIGIT(*c->json))) {
+      lept_value e;
+      lept_init(&e);
+      if ((ret = lept_parse_number(c, &e)) != LEPT_PARSE_OK) {
+        return ret;
+      }
+      if (count == v->u.p.size) {
+        lept_pushback_array_number(v, e.u.n);
+      } else {
+        v->u.p.n[count] = e.u.n;
+      }
+    } else {
+      if (IS_PACKED(v)) {
+        lept_unpack_array(v);
+      }
+      if (count == v->u.a.size) {
+        lept_pushback_array_element(v);
+      }
+      if ((ret = lept_reparse_value(c, &v->u.a.e[count])) != LEPT_PARSE_OK) {
+        return ret;
+      }
+    }
+    count++;
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == ']') {
+      c->json++;
+      lept_erase_array_element(v, count, v->u.a.size - count);
+      return LEPT_PARSE_OK;
+    } else {
+      return LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+    }
+  }
+}
+
+/**
+ * @brief Parses an object value into an existing value.
+ * 
+ * Members are matched by position: an equal key is kept as is, a different
+ * key overwrites the old one, and the member values are parsed into in
+ * place. Any other value falls back to lept_parse_object().
+ * 
+ * @param c Context for parsing
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result
+ */
+static int lept_reparse_object(lept_context *c, lept_value *v) {
+  size_t count = 0, klen;
+  char *str;
+  int ret;
+  if (v->type != LEPT_OBJECT) {
+    lept_free(v);
+    return lept_parse_object(c, v);
+  }
+  EXPECT(c, '{');
+  lept_parse_whitespace(c);
+  if (*c->json == '}') {
+    c->json++;
+    lept_clear_object(v);
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    if (*c->json != '"') {
+      return LEPT_PARSE_MISS_KEY;
+    }
+    if ((ret = lept_parse_string_raw(c, &str, &klen)) != LEPT_PARSE_OK) {
+      return ret;
+    }
+    if (count == v->u.o.size) {
+      lept_set_object_value(v, str, klen);
+    } else {
+      lept_member *m = &v->u.o.m[count];
+      if (m->klen != klen) {
+        m->k = (char *)lept_realloc(ALLOCATOR_ID(v), m->k, m->klen + 1,
+                                    klen + 1);
+        m->klen = klen;
+        m->k[klen] = '\0';
+      }
+      memcpy(m->k, str, klen);
+    }
+    lept_parse_whitespace(c);
+    if (*c->json != ':') {
+      return LEPT_PARSE_MISS_COLON;
+    }
+    c->json++;
+    lept_parse_whitespace(c);
+    if ((ret = lept_reparse_value(c, &v->u.o.m[count].v)) != LEPT_PARSE_OK) {
+      return ret;
+    }
+    count++;
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == '}') {
+      c->json++;
+      while (v->u.o.size > count) {
+        lept_remove_object_value(v, v->u.o.size - 1);
+      }
+      return LEPT_PARSE_OK;
+    } else {
+      return LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+    }
+  }
+}
+
+static int lept_reparse_value(lept_context *c, lept_value *v) {
+  /* A frozen tree may be shared by readers, so it is never written into */
+  if (IS_LAZY(v) || IS_FROZEN(v)) {
+    lept_free(v);
+  }
+  switch (*c->json) {
+  case 'n':
+    lept_free(v);
+    return lept_parse_literal(c, v, "null", LEPT_NULL);
+  case 't':
+    lept_free(v);
+    return lept_parse_literal(c, v, "true", LEPT_TRUE);
+  case 'f':
+    lept_free(v);
+    return lept_parse_literal(c, v, "false", LEPT_FALSE);
+  case '\"':
+    return lept_reparse_string(c, v);
+  case '[':
+    return lept_reparse_array(c, v);
+  case '\0':
+    return LEPT_PARSE_EXPECT_VALUE;
+  case '{':
+    return lept_reparse_object(c, v);
+  default:
+    lept_free(v);
+    return lept_parse_number(c, v);
+  }
+}
+
+/**
+ * @brief Parses a single root value into an existing value.
+ * 
+ * On failure the value is freed and left as null, like lept_parse_root().
+ * 
+ * @param c Context for parsing
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result
+ */
+static int lept_reparse_root(lept_context *c, lept_value *v) {
+  int ret;
+  lept_parse_whitespace(c);
+  if ((ret = lept_reparse_value(c, v)) == LEPT_PARSE_OK) {
+    lept_parse_whitespace(c);
+    if (*c->json != '\0') {
+      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  if (ret != LEPT_PARSE_OK) {
+    lept_free(v);
+  }
+  assert(c->top == 0);
+  return ret;
+}
+
+/**
+ * @brief States of a pull reader, naming what the next token may be.
+ */
+enum {
+  LEPT_READ_VALUE,         /**< A value */
+  LEPT_READ_FIRST_ELEMENT, /**< A value or ']' */
+  LEPT_READ_FIRST_KEY,     /**< A key or '}' */
+  LEPT_READ_KEY,           /**< A key */
+  LEPT_READ_AFTER,         /**< ',', the end of a container or of the input */
+  LEPT_READ_DONE           /**< Nothing */
+};
+
+#define READER_IN_OBJECT(r)                                                    \
+  (((r)->nest[((r)->depth - 1) / 8] >> (((r)->depth - 1) % 8)) & 1)
+
+/**
+ * @brief Initializes a pull reader over a JSON string.
+ * 
+ * @param r Reader
+ * @param json JSON string, which must outlive the reader
+ */
+void lept_reader_init(lept_reader *r, const char *json) {
+  assert(r != NULL && json != NULL);
+  r->start = json;
+  r->json = json;
+  r->depth = 0;
+  r->offset = 0;
+  r->state = LEPT_READ_VALUE;
+  r->error = LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Prepares a context for a pull reader.
+ * 
+ * The reader never pushes, so the context has no stack.
+ * 
+ * @param c Context to be prepared
+ * @param json Position to read from
+ */
+static void lept_reader_begin(lept_context *c, const char *json) {
+  c->json = json;
+  c->stack = NULL;
+  c->size = 0;
+  c->top = 0;
+  c->allocator = LEPT_DEFAULT_ALLOCATOR;
+  c->flags = 0;
+}
+
+/**
+ * @brief Stops a reader at an error.
+ * 
+ * @param r Reader
+ * @param c Context positioned at the error
+ * @param ret Parsing result
+ * @return int ret
+ */
+static int lept_reader_fail(lept_reader *r, lept_context *c, int ret) {
+  r->error = ret;
+  r->offset = (size_t)(c->json - r->start);
+  r->json = c->json;
+  return ret;
+}
+
+/**
+ * @brief Reads the closing bracket of the innermost container.
+ * 
+ * @param r Reader
+ * @param c Context positioned at the bracket
+ * @param t Receives the token
+ * @return int LEPT_PARSE_OK
+ */
+static int lept_reader_close(lept_reader *r, lept_context *c, lept_token *t) {
+  t->type = READER_IN_OBJECT(r) ? LEPT_TOKEN_END_OBJECT : LEPT_TOKEN_END_ARRAY;
+  t->json = c->json++;
+  t->len = 1;
+  r->depth--;
+  r->state = LEPT_READ_AFTER;
+  r->json = c->json;
+  return LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Reads the next token.
+ * 
+ * Follows the grammar of lept_parse_value() and reports the same errors,
+ * then stops: every later call returns the same error.
+ * 
+ * @param r Reader
+ * @param t Receives the token
+ * @return int LEPT_PARSE_OK, a parse error, or LEPT_READER_END
+ */
+int lept_reader_next(lept_reader *r, lept_token *t) {
+  lept_context c;
+  lept_value literal;
+  int ret, object;
+  assert(r != NULL && t != NULL);
+  if (r->error != LEPT_PARSE_OK) {
+    return r->error;
+  }
+  if (r->state == LEPT_READ_DONE) {
+    return LEPT_READER_END;
+  }
+  lept_reader_begin(&c, r->json);
+  lept_parse_whitespace(&c);
+  switch (r->state) {
+  case LEPT_READ_AFTER:
+    if (r->depth == 0) {
+      if (*c.json != '\0') {
+        return lept_reader_fail(r, &c, LEPT_PARSE_ROOT_NOT_SINGULAR);
+      }
+      r->json = c.json;
+      r->state = LEPT_READ_DONE;
+      return LEPT_READER_END;
+    }
+    object = READER_IN_OBJECT(r);
+    if (*c.json == ',') {
+      c.json++;
+      lept_parse_whitespace(&c);
+      r->state = object ? LEPT_READ_KEY : LEPT_READ_VALUE;
+    } else if (*c.json == (object ? '}' : ']')) {
+      return lept_reader_close(r, &c, t);
+    } else {
+      return lept_reader_fail(r, &c,
+                              object ? LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET
+                                     : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET);
+    }
+    break;
+  case LEPT_READ_FIRST_ELEMENT:
+    if (*c.json == ']') {
+      return lept_reader_close(r, &c, t);
+    }
+    r->state = LEPT_READ_VALUE;
+    break;
+  case LEPT_READ_FIRST_KEY:
+    if (*c.json == '}') {
+      return lept_reader_close(r, &c, t);
+    }
+    r->state = LEPT_READ_KEY;
+    break;
+  default:
+    break;
+  }
+  t->json = c.json;
+  if (r->state == LEPT_READ_KEY) {
+    if (*c.json != '"') {
+      return lept_reader_fail(r, &c, LEPT_PARSE_MISS_KEY);
+    }
+    if ((ret = lept_skip_string(&c)) != LEPT_PARSE_OK) {
+      return lept_reader_fail(r, &c, ret);
+    }
+    t->type = LEPT_TOKEN_KEY;
+    t->json++;
+    t->len = (size_t)(c.json - t->json - 1);
+    lept_parse_whitespace(&c);
+    if (*c.json != ':') {
+      return lept_reader_fail(r, &c, LEPT_PARSE_MISS_COLON);
+    }
+    c.json++;
+    r->state = LEPT_READ_VALUE;
+    r->json = c.json;
+    return LEPT_PARSE_OK;
+  }
+  r->state = LEPT_READ_AFTER;
+  switch (*c.json) {
+  case '[':
+  case '{':
+    if (r->depth == LEPT_READER_MAX_DEPTH) {
+      return lept_reader_fail(r, &c, LEPT_PARSE_TOO_DEEP);
+    }
+    object = *c.json++ == '{';
+    if (object) {
+      r->nest[r->depth / 8] |= (unsigned char)(1u << (r->depth % 8));
+    } else {
+      r->nest[r->depth / 8] &= (unsigned char)~(1u << (r->depth % 8));
+    }
+    r->depth++;
+    t->type = object ? LEPT_TOKEN_BEGIN_OBJECT : LEPT_TOKEN_BEGIN_ARRAY;
+    r->state = object ? LEPT_READ_FIRST_KEY : LEPT_READ_FIRST_ELEMENT;
+    ret = LEPT_PARSE_OK;
+    break;
+  case '"':
+    if ((ret = lept_skip_string(&c)) != LEPT_PARSE_OK) {
+      return lept_reader_fail(r, &c, ret);
+    }
+    t->type = LEPT_TOKEN_STRING;
+    t->json++;
+    t->len = (size_t)(c.json - t->json - 1);
+    r->json = c.json;
+    return LEPT_PARSE_OK;
+  case 'n':
+    ret = lept_parse_literal(&c, &literal, "null", LEPT_NULL);
+    t->type = LEPT_TOKEN_NULL;
+    break;
+  case 't':
+    ret = lept_parse_literal(&c, &literal, "true", LEPT_TRUE);
+    t->type = LEPT_TOKEN_TRUE;
+    break;
+  case 'f':
+    ret = lept_parse_literal(&c, &literal, "false", LEPT_FALSE);
+    t->type = LEPT_TOKEN_FALSE;
+    break;
+  case '\0':
+    return lept_reader_fail(r, &c, LEPT_PARSE_EXPECT_VALUE);
+  default:
+    ret = lept_parse_number(&c, &literal);
+    t->type = LEPT_TOKEN_NUMBER;
+    t->n = literal.u.n;
+    break;
+  }
+  if (ret != LEPT_PARSE_OK) {
+    return lept_reader_fail(r, &c, ret);
+  }
+  t->len = (size_t)(c.json - t->json);
+  r->json = c.json;
+  return LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Skips the next value, validating it without building it.
+ * 
+ * If a key comes next, the key and its value are skipped; if the end of a
+ * container comes next, its closing bracket is consumed.
+ * 
+ * @param r Reader
+ * @return int LEPT_PARSE_OK, a parse error, or LEPT_READER_END
+ */
+int lept_reader_skip(lept_reader *r) {
+  lept_context c;
+  lept_token t;
+  int ret;
+  if ((ret = lept_reader_next(r, &t)) != LEPT_PARSE_OK) {
+    return ret;
+  }
+  if (t.type == LEPT_TOKEN_KEY) {
+    return lept_reader_skip(r);
+  }
+  if (t.type != LEPT_TOKEN_BEGIN_ARRAY && t.type != LEPT_TOKEN_BEGIN_OBJECT) {
+    return LEPT_PARSE_OK;
+  }
+  /* Rescan the container from its opening bracket with the skipper */
+  r->depth--;
+  lept_reader_begin(&c, t.json);
+  if ((ret = lept_skip_value(&c)) != LEPT_PARSE_OK) {
+    return lept_reader_fail(r, &c, ret);
+  }
+  r->state = LEPT_READ_AFTER;
+  r->json = c.json;
+  return LEPT_PARSE_OK;
+}
+
+/**
+ * @brief Decodes the escapes of a string or key token.
+ * 
+ * The token was validated when it was read, and no escape decodes to more
+ * bytes than it is written with, so the decoder writes straight into buf
+ * through a context whose stack never needs to grow.
+ * 
+ * @param t String or key token
+ * @param buf Buffer of at least t->len + 1 bytes
+ * @return size_t Length of the decoded string, which is NUL-terminated
+ */
+size_t lept_token_string(const lept_token *t, char *buf) {
+  lept_context c;
+  char *s;
+  size_t len;
+  int ret;
+  assert(t != NULL && buf != NULL);
+  assert(t->type == LEPT_TOKEN_STRING || t->type == LEPT_TOKEN_KEY);
+  c.json = t->json - 1;
+  c.stack = buf;
+  c.size = t->len + 1;
+  c.top = 0;
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  ret = lept_parse_string_raw(&c, &s, &len);
+  assert(ret == LEPT_PARSE_OK && c.stack == buf);
+  (void)ret;
+  buf[len] = '\0';
+  return len;
+}
+
+/**
+ * @brief Decodes a string or key token in bounded chunks.
+ * 
+ * Runs without escapes are passed to the callback straight from the source
+ * text, cut to at most size bytes; only decoded escapes go through buf. No
+ * chunk exceeds size bytes, so memory stays flat however long the string is.
+ * A chunk may end inside a multi-byte UTF-8 sequence.
+ * 
+ * @param t String or key token
+ * @param buf Scratch buffer for decoded escapes
+ * @param size Size of buf and largest chunk, at least 4
+ * @param cb Callback receiving each chunk
+ * @param ctx User data passed to the callback
+ * @return int 0, or the non-zero value that stopped the callback
+ */
+int lept_token_string_chunked(const lept_token *t, char *buf, size_t size,
+                              lept_chunk_callback cb, void *ctx) {
+  const char *p = t->json, *end = t->json + t->len, *q;
+  size_t top = 0, n;
+  unsigned u, u2;
+  int ret;
+  assert(t != NULL && buf != NULL && size >= 4 && cb != NULL);
+  assert(t->type == LEPT_TOKEN_STRING || t->type == LEPT_TOKEN_KEY);
+  while (p < end) {
+    if ((q = (const char *)memchr(p, '\\', (size_t)(end - p))) == NULL) {
+      q = end;
+    }
+    if (q > p && top > 0) {
+      if ((ret = cb(ctx, buf, top)) != 0) {
+        return ret;
+      }
+      top = 0;
+    }
+    for (; p < q; p += n) {
+      n = (size_t)(q - p) < size ? (size_t)(q - p) : size;
+      if ((ret = cb(ctx, p, n)) != 0) {
+        return ret;
+      }
+    }
+    if (p == end) {
+      break;
+    }
+    /* A decoded escape takes at most 4 bytes */
+    if (top + 4 > size) {
+      if ((ret = cb(ctx, buf, top)) != 0) {
+        return ret;
+      }
+      top = 0;
+    }
+    switch (p[1]) {
+    case 'b':
+      buf[top++] = '\b';
+      break;
+    case 'f':
+      buf[top++] = '\f';
+      break;
+    case 'n':
+      buf[top++] = '\n';
+      break;
+    case 'r':
+      buf[top++] = '\r';
+      break;
+    case 't':
+      buf[top++] = '\t';
+      break;
+    case 'u':
+      p = lept_parse_hex4(p + 2, &u) - 2;
+      if (u >= 0xD800 && u <= 0xDBFF) {
+        p = lept_parse_hex4(p + 4, &u2) - 2;
+        u = 0x10000 + (((u - 0xD800) << 10) | (u2 - 0xDC00));
+      }
+      top += lept_utf8_write(buf + top, u);
+      break;
+    default:
+      buf[top++] = p[1];
+      break;
+    }
+    p += 2;
+  }
+  return top > 0 ? cb(ctx, buf, top) : 0;
+}
+
+/**
+ * @brief Maps a file into memory for parsing in place.
+ * 
+ * The file is mapped read-only over an anonymous mapping at least one page
+ * longer, so the text is always followed by a NUL even when its size is a
+ * multiple of the page size.
+ * 
+ * @param f File mapping
+ * @param path Path of the file
+ * @param flags LEPT_FILE_* flags
+ * @return int 0 on success, -1 if the file could not be opened or mapped
+ */
+int lept_file_map(lept_file *f, const char *path, int flags) {
+  struct stat st;
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  int fd, map = MAP_PRIVATE | MAP_FIXED;
+  void *base;
+  assert(f != NULL && path != NULL);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    return -1;
+  }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+  f->size = (size_t)st.st_size;
+  f->mapped = 0;
+  f->json = "";
+  if (f->size == 0) {
+    close(fd);
+    return 0;
+  }
+#ifdef MAP_POPULATE
+  if (flags & LEPT_FILE_POPULATE) {
+    map |= MAP_POPULATE;
+  }
+#else
+  (void)flags;
+#endif
+  f->mapped = (f->size / page + 1) * page;
+  base = mmap(NULL, f->mapped, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+  if (mmap(base, f->size, PROT_READ, map, fd, 0) == MAP_FAILED) {
+    munmap(base, f->mapped);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  madvise(base, f->size, MADV_SEQUENTIAL);
+  f->json = (const char *)base;
+  return 0;
+}
+
+/**
+ * @brief Unmaps a file mapped by lept_file_map().
+ * 
+ * @param f File mapping
+ */
+void lept_file_unmap(lept_file *f) {
+  assert(f != NULL);
+  if (f->mapped > 0) {
+    munmap((void *)f->json, f->mapped);
+  }
+  f->json = "";
+  f->size = 0;
+  f->mapped = 0;
+}
+
+/**
+ * @brief Parses a JSON file directly from a memory mapping.
+ * 
+ * @param v JSON value to be parsed
+ * @param path Path of the file
+ * @param flags LEPT_FILE_* flags
+ * @return int Parsing result, or LEPT_PARSE_FILE_ERROR
+ */
+int lept_parse_file(lept_value *v, const char *path, int flags) {
+  lept_file f;
+  int ret;
+  assert(v != NULL);
+  if (lept_file_map(&f, path, flags) != 0) {
+    lept_init(v);
+    return LEPT_PARSE_FILE_ERROR;
+  }
+  ret = lept_parse(v, f.json);
+  lept_file_unmap(&f);
+  return ret;
+}
+
+/**
+ * @brief Parses a JSON string into an existing value, reusing its
+ * allocations where the new document has the same shape.
+ * 
+ * @param v Initialized JSON value to be parsed into
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_reparse(lept_value *v, const char *json) {
+  lept_context c;
+  int ret;
+  assert(v != NULL);
+  c.json = json;
+  c.stack = NULL;
+  c.top = 0;
+  c.size = 0;
+  c.allocator = ALLOCATOR_ID(v);
+  c.flags = 0;
+  ret = lept_reparse_root(&c, v);
+  lept_dealloc(c.allocator, c.stack, c.size);
+  return ret;
+}
+
+/**
+ * @brief Stringifies a string value and pushes it onto the context stack.
+ * 
+ * @param c Context for parsing
+ * @param s String value to be stringified
+ * @param len Length of the string value
+ */
+static void lept_stringify_string(lept_context *c, const char *s, size_t len) {
+  static const char hex_digits[] = {'0', '1', '2', '3', '4', '5', '6', '7',
+                                    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'};
+  size_t i, size;
+  char *head, *p;
+  assert(s != NULL);
+  p = head = lept_context_push(c, size = len * 6 + 2); /* "\u00xx..." */
+  *p++ = '"';
+  for (i = 0; i < len; i++) {
+    unsigned char ch = (unsigned char)s[i];
+    switch (ch) {
+    case '\"':
+      *p++ = '\\';
+      *p++ = '\"';
+      break;
+    case '\\':
+      *p++ = '\\';
+      *p++ = '\\';
+      break;
+    case '\b':
+      *p++ = '\\';
+      *p++ = 'b';
+      break;
+    case '\f':
+      *p++ = '\\';
+      *p++ = 'f';
+      break;
+    case '\n':
+      *p++ = '\\';
+      *p++ = 'n';
+      break;
+    case '\r':
+      *p++ = '\\';
+      *p++ = 'r';
+      break;
+    case '\t':
+      *p++ = '\\';
+      *p++ = 't';
+      break;
+    default:
+      if (ch < 0x20) {
+        *p++ = '\\';
+        *p++ = 'u';
+        *p++ = '0';
+        *p++ = '0';
+        *p++ = hex_digits[ch >> 4];
+        *p++ = hex_digits[ch & 15];
+      } else
+        *p++ = s[i];
+    }
+  }
+  *p++ = '"';
+  c->top -= size - (p - head);
+}
+
+/**
+ * @brief Stringifies a packed numeric array and pushes it onto the context
+ * stack.
+ * 
+ * The worst-case length is reserved once so the loop only formats numbers.
+ * 
+ * @param c Context for parsing
+ * @param n Numbers to be stringified
+ * @param size Number of elements
+ */
+static void lept_stringify_numbers(lept_context *c, const double *n,
+                                   size_t size) {
+  size_t i, reserved = size * LEPT_NUMBER_MAX_LENGTH + 2;
+  char *head, *p;
+  p = head = lept_context_push(c, reserved);
+  *p++ = '[';
+  for (i = 0; i < size; i++) {
+    if (i > 0) {
+      *p++ = ',';
+    }
+    p += sprintf(p, "%.17g", n[i]);
+  }
+  *p++ = ']';
+  c->top -= reserved - (p - head);
+}
+
+/**
+ * @brief Stringifies a JSON value and pushes it onto the context stack.
+ * 
+ * @param c Context for parsing
+ * @param v JSON value to be stringified
+ */
+static void lept_stringify_value(lept_context *c, const lept_value *v) {
+  size_t i;
+  MATERIALIZE(v);
+  switch (v->type) {
+  case LEPT_NULL:
+    PUTS(c, "null", 4);
+    break;
+  case LEPT_FALSE:
+    PUTS(c, "false", 5);
+    break;
+  case LEPT_TRUE:
+    PUTS(c, "true", 4);
+    break;
+  case LEPT_NUMBER:
+    c->top -= 32 - sprintf(lept_context_push(c, 32), "%.17g", v->u.n);
+    break;
+  case LEPT_STRING:
+    lept_stringify_string(c, v->u.s.s, v->u.s.len);
+    break;
+  case LEPT_ARRAY:
+    if (IS_PACKED(v)) {
+      lept_stringify_numbers(c, v->u.p.n, v->u.p.size);
+      break;
+    }
+    PUTC(c, '[');
+    for (i = 0; i < v->u.a.size; i++) {
+      if (i > 0)
+        PUTC(c, ',');
+      lept_stringify_value(c, &v->u.a.e[i]);
+    }
+    PUTC(c, ']');
+    break;
+  case LEPT_OBJECT:
+    PUTC(c, '{');
+    for (i = 0; i < v->u.o.size; i++) {
+      if (i > 0)
+        PUTC(c, ',');
+      lept_stringify_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+      PUTC(c, ':');
+      lept_stringify_value(c, &v->u.o.m[i].v);
+    }
+    PUTC(c, '}');
+    break;
+  default:
+    assert(0 && "invalid type");
+    break;
+  }
+}
+
+/**
+ * @brief Stringifies a JSON value.
+ * 
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return char* Stringified JSON value
+ */
+char *lept_stringify(const lept_value *v, size_t *length) {
+  lept_context c;
+  assert(v != NULL);
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  c.stack = (char *)lept_malloc(c.allocator,
+                                c.size = LEPT_PARSE_STRINGFY_INIT_SIZE);
+  c.top = 0;
+  lept_stringify_value(&c, v);
+  if (length) {
+    *length = c.top;
+  }
+  PUTC(&c, '\0');
+  /* Hand out an exactly sized block so sized deallocation sees length + 1 */
+  return (char *)lept_realloc(c.allocator, c.stack, c.size, c.top);
+}
+
+/**
+ * @brief Member of an object being sorted for canonical output.
+ * 
+ * The first bytes of the key are kept inline so that most comparisons
+ * never touch the member array or the key itself.
+ */
+typedef struct {
+  unsigned long long prefix; /**< First 8 bytes of the key, big-endian */
+  const lept_member *m;      /**< Member */
+} lept_canonical_key;
+
+/**
+ * @brief Orders members bytewise by key, then by position for duplicates.
+ */
+static int lept_canonical_compare(const lept_canonical_key *x,
+                                  const lept_canonical_key *y) {
+  const lept_member *a = x->m, *b = y->m;
+  size_t len = a->klen < b->klen ? a->klen : b->klen;
+  int ret;
+  if (x->prefix != y->prefix) {
+    return x->prefix < y->prefix ? -1 : 1;
+  }
+  if (len > 8 && (ret = memcmp(a->k + 8, b->k + 8, len - 8)) != 0) {
+    return ret;
+  }
+  if (a->klen != b->klen) {
+    return a->klen < b->klen ? -1 : 1;
+  }
+  return a < b ? -1 : a > b;
+}
+
+static int lept_canonical_qsort(const void *a, const void *b) {
+  return lept_canonical_compare((const lept_canonical_key *)a,
+                                (const lept_canonical_key *)b);
+}
+
+/**
+ * @brief Formats a number with the fewest digits that read back exactly.
+ * 
+ * The exponent, if any, has no '+' sign and no leading zeros.
+ * 
+ * @param buf Output buffer of at least LEPT_NUMBER_MAX_LENGTH bytes
+ * @param n Number
+ * @return int Length of the output
+ */
+static int lept_canonical_number(char *buf, double n) {
+  int len = 0;
+  char *e, *p, *q;
+  if (n == 0) {
+    /* -0 and 0 are the same JSON number */
+    buf[0] = '0';
+    return 1;
+  }
+  /* 15 digits always round-trip, except for subnormals with less precision */
+  for (int precision = fabs(n) < DBL_MIN ? 1 : 15; precision <= 17;
+       precision++) {
+    len = sprintf(buf, "%.*g", precision, n);
+    if (strtod(buf, NULL) == n) {
+      break;
+    }
+  }
+  /* "1e+16" and "1e-07" become "1e16" and "1e-7" */
+  if ((e = strchr(buf, 'e')) != NULL) {
+    p = q = e + 1;
+    if (*p == '-') {
+      q++;
+    }
+    p += *p == '+' || *p == '-';
+    while (*p == '0') {
+      p++;
+    }
+    memmove(q, p, buf + len + 1 - p);
+    len -= (int)(p - q);
+  }
+  return len;
+}
+
+/**
+ * @brief Stringifies a JSON value in canonical form onto the context stack.
+ * 
+ * @param c Context for stringifying
+ * @param keys Scratch stack for sorting the members of objects
+ * @param v JSON value to be stringified
+ */
+static void lept_canonical_value(lept_context *c, lept_context *keys,
+                                 const lept_value *v) {
+  lept_canonical_key *k;
+  size_t i, j, base;
+  double n;
+  MATERIALIZE(v);
+  switch (v->type) {
+  case LEPT_NUMBER:
+    c->top -= LEPT_NUMBER_MAX_LENGTH -
+              lept_canonical_number(
+                  (char *)lept_context_push(c, LEPT_NUMBER_MAX_LENGTH), v->u.n);
+    break;
+  case LEPT_ARRAY:
+    PUTC(c, '[');
+    for (i = 0; i < v->u.a.size; i++) {
+      if (i > 0) {
+        PUTC(c, ',');
+      }
+      if (lept_array_number_at(v, i, &n)) {
+        c->top -= LEPT_NUMBER_MAX_LENGTH -
+                  lept_canonical_number(
+                      (char *)lept_context_push(c, LEPT_NUMBER_MAX_LENGTH), n);
+      } else {
+        lept_canonical_value(c, keys, &v->u.a.e[i]);
+      }
+    }
+    PUTC(c, ']');
+    break;
+  case LEPT_OBJECT:
+    PUTC(c, '{');
+    if (v->u.o.size == 0) {
+      PUTC(c, '}');
+      break;
+    }
+    base = keys->top;
+    k = (lept_canonical_key *)lept_context_push(
+        keys, v->u.o.size * sizeof(lept_canonical_key));
+    for (i = 0; i < v->u.o.size; i++) {
+      const lept_member *m = &v->u.o.m[i];
+      k[i].prefix = 0;
+      for (j = 0; j < 8; j++) {
+        k[i].prefix = (k[i].prefix << 8) |
+                      (j < m->klen ? (unsigned char)m->k[j] : 0);
+      }
+      k[i].m = m;
+    }
+    if (v->u.o.size <= 16) {
+      /* Insertion sort wins on small objects and on sorted input */
+      for (i = 1; i < v->u.o.size; i++) {
+        lept_canonical_key t = k[i];
+        for (j = i; j > 0 && lept_canonical_compare(&t, &k[j - 1]) < 0; j--) {
+          k[j] = k[j - 1];
+        }
+        k[j] = t;
+      }
+    } else {
+      qsort(k, v->u.o.size, sizeof(*k), lept_canonical_qsort);
+    }
+    for (i = 0; i < v->u.o.size; i++) {
+      /* Nested objects may grow the scratch stack */
+      const lept_member *m =
+          ((lept_canonical_key *)(keys->stack + base))[i].m;
+      if (i > 0) {
+        PUTC(c, ',');
+      }
+      lept_stringify_string(c, m->k, m->klen);
+      PUTC(c, ':');
+      lept_canonical_value(c, keys, &m->v);
+    }
+    keys->top = base;
+    PUTC(c, '}');
+    break;
+  default:
+    lept_stringify_value(c, v);
+    break;
+  }
+}
+
+/**
+ * @brief Stringifies a JSON value in canonical form.
+ * 
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return char* Stringified JSON value
+ */
+char *lept_stringify_canonical(const lept_value *v, size_t *length) {
+  lept_context c, keys;
+  assert(v != NULL);
+  c.allocator = keys.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = keys.flags = 0;
+  c.stack = (char *)lept_malloc(c.allocator,
+                                c.size = LEPT_PARSE_STRINGFY_INIT_SIZE);
+  c.top = 0;
+  keys.stack = NULL;
+  keys.size = keys.top = 0;
+  lept_canonical_value(&c, &keys, v);
+  lept_dealloc(keys.allocator, keys.stack, keys.size);
+  if (length) {
+    *length = c.top;
+  }
+  PUTC(&c, '\0');
+  return (char *)lept_realloc(c.allocator, c.stack, c.size, c.top);
+}
+
+/**
+ * @brief Copies a JSON value.
+ * 
+ * @param dst Destination JSON value
+ * @param src Source JSON value
+ */
+void lept_copy(lept_value *dst, const lept_value *src) {
+  assert(src != NULL && dst != NULL && src != dst);
+  if (IS_LAZY(src)) {
+    /* Both values refer to the same immutable source text */
+    lept_free(dst);
+    dst->u = src->u;
+    dst->type = src->type;
+    dst->flags |= LEPT_FLAG_LAZY;
+    return;
+  }
+  switch (src->type) {
+  case LEPT_STRING:
+    lept_set_string(dst, src->u.s.s, src->u.s.len);
+    break;
+  case LEPT_ARRAY:
+    if (IS_PACKED(src)) {
+      lept_set_packed_array(dst, src->u.p.capacity);
+      if (src->u.p.size > 0) {
+        memcpy(dst->u.p.n, src->u.p.n, src->u.p.size * sizeof(double));
+      }
+      dst->u.p.size = src->u.p.size;
+      break;
+    }
+    lept_set_array(dst, src->u.a.capacity);
+    for (size_t i = 0; i < src->u.a.size; i++) {
+      lept_copy(lept_pushback_array_element(dst), src->u.a.e + i);
+    }
+    break;
+  case LEPT_OBJECT:
+    lept_set_object(dst, src->u.a.capacity);
+    for (size_t i = 0; i < src->u.a.size; i++) {
+      lept_copy(lept_set_object_value(dst, src->u.o.m[i].k, src->u.o.m[i].klen),
+                &src->u.o.m[i].v);
+    }
+    break;
+  default:
+    lept_free(dst);
+    dst->u = src->u;
+    dst->type = src->type;
+    break;
+  }
+}
+
+/**
+ * @brief Moves a JSON value.
+ * 
+ * @param dst Destination JSON value
+ * @param src Source JSON value
+ */
+void lept_move(lept_value *dst, lept_value *src) {
+  assert(src != NULL && dst != NULL && src != dst);
+  lept_free(dst);
+  memcpy(dst, src, sizeof(lept_value));
+  lept_init(src);
+}
+
+/**
+ * @brief Swaps two JSON values.
+ * 
+ * @param lhs Left-hand side JSON value
+ * @param rhs Right-hand side JSON value
+ */
+void lept_swap(lept_value *lhs, lept_value *rhs) {
+  assert(lhs != NULL && rhs != NULL);
+  if (lhs != rhs) {
+    lept_value temp;
+    memcpy(&temp, lhs, sizeof(lept_value));
+    memcpy(lhs, rhs, sizeof(lept_value));
+    memcpy(rhs, &temp, sizeof(lept_value));
+  }
+}
+
+/**
+ * @brief Gets the number of hash slots stored after the members of a frozen
+ * object.
+ * 
+ * @param size Number of members
+ * @return size_t Power of two of at least twice the size, or 0 for objects
+ * too small to be indexed
+ */
+static size_t lept_frozen_slots(size_t size) {
+  size_t slots = 1;
+  if (size < LEPT_FROZEN_INDEX_MIN) {
+    return 0;
+  }
+  while (slots < 2 * size) {
+    slots <<= 1;
+  }
+  return slots;
+}
+
+/**
+ * @brief Frees a JSON value.
+ * 
+ * @param v JSON value to be freed
+ */
+void lept_free(lept_value *v) {
+  size_t i;
+  unsigned id;
+  assert(v != NULL);
+  id = ALLOCATOR_ID(v);
+  switch (IS_LAZY(v) ? LEPT_NULL : v->type) {
+  case LEPT_STRING:
+    lept_dealloc(id, v->u.s.s, v->u.s.len + 1);
+    break;
+  case LEPT_ARRAY:
+    if (IS_PACKED(v)) {
+      lept_dealloc(id, v->u.p.n, v->u.p.capacity * sizeof(double));
+      break;
+    }
+    for (i = 0; i < v->u.a.size; i++) {
+      lept_free(&v->u.a.e[i]);
+    }
+    lept_dealloc(id, v->u.a.e, v->u.a.capacity * sizeof(lept_value));
+    break;
+  case LEPT_OBJECT:
+    for (i = 0; i < v->u.o.size; i++) {
+      lept_free(&v->u.o.m[i].v);
+      lept_dealloc(id, v->u.o.m[i].k, v->u.o.m[i].klen + 1);
+    }
+    lept_dealloc(id, v->u.o.m,
+                 v->u.o.capacity * sizeof(lept_member) +
+                     (IS_FROZEN(v) ? lept_frozen_slots(v->u.o.size) *
+                                         sizeof(size_t)
+                                   : 0));
+    break;
+  default:
+    break;
+  }
+  v->type = LEPT_NULL;
+  v->flags &= ~LEPT_FLAG_MASK;
+}
+
+/**
+ * @brief Gets an array element as a number without unpacking the array.
+ * 
+ * @param v JSON array
+ * @param index Index of the element
+ * @param n Pointer to the number value
+ * @return int 1 if the element is a number, 0 otherwise
+ */
+static int lept_array_number_at(const lept_value *v, size_t index, double *n) {
+  if (IS_PACKED(v)) {
+    *n = v->u.p.n[index];
+    return 1;
+  }
+  if (v->u.a.e[index].type != LEPT_NUMBER) {
+    return 0;
+  }
+  MATERIALIZE(&v->u.a.e[index]);
+  *n = v->u.a.e[index].u.n;
+  return 1;
+}
+
+/**
+ * @brief Checks if two arrays of equal size, at least one packed, are equal.
+ * 
+ * @param lhs Left-hand side JSON array
+ * @param rhs Right-hand side JSON array
+ * @return int 1 if equal, 0 otherwise
+ */
+static int lept_is_equal_numbers(const lept_value *lhs, const lept_value *rhs) {
+  size_t i;
+  double l, r;
+  for (i = 0; i < lhs->u.a.size; i++) {
+    if (!lept_array_number_at(lhs, i, &l) ||
+        !lept_array_number_at(rhs, i, &r) || l != r) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Checks if two JSON values are equal.
+ * 
+ * @param lhs Left-hand side JSON value
+ * @param rhs Right-hand side JSON value
+ * @return int 1 if equal, 0 otherwise
+ */
+int lept_is_equal(const lept_value *lhs, const lept_value *rhs) {
+  size_t i;
+  assert(lhs != NULL && rhs != NULL);
+  if (lhs->type != rhs->type) {
+    return 0;
+  }
+  MATERIALIZE(lhs);
+  MATERIALIZE(rhs);
+  switch (lhs->type) {
+  case LEPT_STRING:
+    return lhs->u.s.len == rhs->u.s.len &&
+           memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
+  case LEPT_NUMBER:
+    return lhs->u.n == rhs->u.n;
+  case LEPT_ARRAY:
+    if (lhs->u.a.size != rhs->u.a.size) {
+      return 0;
+    }
+    if (IS_PACKED(lhs) || IS_PACKED(rhs)) {
+      return lept_is_equal_numbers(lhs, rhs);
+    }
+    for (i = 0; i < lhs->u.a.size; i++) {
+      if (lept_is_equal(lhs->u.a.e + i, rhs->u.a.e + i) == 0) {
+        return 0;
+      }
+    }
+    return 1;
+  case LEPT_OBJECT:
+    if (lhs->u.o.size != rhs->u.o.size) {
+      return 0;
+    }
+    for (i = 0; i < lhs->u.o.size; i++) {
+      size_t index;
+      if ((index = lept_find_object_index(rhs, lhs->u.o.m[i].k,
+                                          lhs->u.o.m[i].klen)) ==
+          LEPT_KEY_NOT_EXIST) {
+        return 0;
+      }
+      if (lept_is_equal(&lhs->u.o.m[i].v, &rhs->u.o.m[index].v) == 0) {
+        return 0;
+      }
+    }
+    return 1;
+  default:
+    return lhs->type == rhs->type;
+  }
+}
+
+/**
+ * @brief Gets the type of a JSON value.
+ * 
+ * @param v JSON value
+ * @return lept_type Type of the JSON value
+ */
+lept_type lept_get_type(const lept_value *v) {
+  assert(v != NULL);
+  return v->type;
+}
+
+/**
+ * @brief Gets the boolean value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return int Boolean value (0 or 1)
+ */
+int lept_get_boolean(const lept_value *v) {
+  assert(v != NULL && (v->type == LEPT_FALSE || v->type == LEPT_TRUE));
+  return (v->type == LEPT_FALSE) ? 0 : 1;
+}
+
+/**
+ * @brief Sets the boolean value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param b Boolean value (0 or 1)
+ */
+void lept_set_boolean(lept_value *v, int b) {
+  lept_free(v);
+  v->type = b ? LEPT_TRUE : LEPT_FALSE;
+}
+
+/**
+ * @brief Gets the number value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return double Number value
+ */
+double lept_get_number(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_NUMBER);
+  MATERIALIZE(v);
+  return v->u.n;
+}
+
+/**
+ * @brief Sets the number value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param n Number value
+ */
+void lept_set_number(lept_value *v, double n) {
+  lept_free(v);
+  v->u.n = n;
+  v->type = LEPT_NUMBER;
+}
+
+/**
+ * @brief Gets the string value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return const char* String value
+ */
+const char *lept_get_string(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_STRING);
+  MATERIALIZE(v);
+  return v->u.s.s;
+}
+
+/**
+ * @brief Gets the length of the string value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return size_t Length of the string value
+ */
+size_t lept_get_string_length(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_STRING);
+  MATERIALIZE(v);
+  return v->u.s.len;
+}
+
+/**
+ * @brief Sets the string value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param s String value
+ * @param len Length of the string value
+ */
+void lept_set_string(lept_value *v, const char *s, size_t len) {
+  assert(v != NULL && (s != NULL || len == 0));
+  lept_free(v);
+  v->u.s.s = (char *)lept_malloc(ALLOCATOR_ID(v), len + 1);
+  memcpy(v->u.s.s, s, len);
+  v->u.s.s[len] = '\0';
+  v->u.s.len = len;
+  v->type = LEPT_STRING;
+}
+
+/**
+ * @brief Sets the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity of the array
+ */
+void lept_set_array(lept_value *v, size_t capacity) {
+  assert(v != NULL);
+  lept_free(v);
+  v->type = LEPT_ARRAY;
+  v->u.a.size = 0;
+  v->u.a.capacity = capacity;
+  v->u.a.e = capacity > 0 ? (lept_value *)lept_malloc(
+                                 ALLOCATOR_ID(v), capacity * sizeof(lept_value))
+                           : NULL;
+}
+
+/**
+ * @brief Sets a JSON value to an empty packed numeric array.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity of the array
+ */
+static void lept_set_packed_array(lept_value *v, size_t capacity) {
+  assert(v != NULL);
+  lept_free(v);
+  v->type = LEPT_ARRAY;
+  v->flags |= LEPT_FLAG_PACKED;
+  v->u.p.size = 0;
+  v->u.p.capacity = capacity;
+  v->u.p.n = capacity > 0 ? (double *)lept_malloc(ALLOCATOR_ID(v),
+                                                   capacity * sizeof(double))
+                           : NULL;
+}
+
+/**
+ * @brief Converts a packed array back to an array of JSON values.
+ * 
+ * Called before handing out element pointers, which may be set to any type.
+ * 
+ * @param v JSON array
+ */
+static void lept_unpack_array(lept_value *v) {
+  double *n = v->u.p.n;
+  size_t i, size = v->u.p.size;
+  unsigned id = ALLOCATOR_ID(v);
+  v->u.a.e = v->u.a.capacity > 0
+                 ? (lept_value *)lept_malloc(id, v->u.a.capacity *
+                                                     sizeof(lept_value))
+                 : NULL;
+  for (i = 0; i < size; i++) {
+    v->u.a.e[i].type = LEPT_NUMBER;
+    v->u.a.e[i].flags = id << LEPT_ALLOCATOR_SHIFT;
+    v->u.a.e[i].u.n = n[i];
+  }
+  v->flags &= ~LEPT_FLAG_PACKED;
+  lept_dealloc(id, n, v->u.a.capacity * sizeof(double));
+}
+
+/**
+ * @brief Gets the size of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return size_t Size of the array
+ */
+size_t lept_get_array_size(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  MATERIALIZE(v);
+  return v->u.a.size;
+}
+
+/**
+ * @brief Gets the capacity of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return size_t Capacity of the array
+ */
+size_t lept_get_array_capacity(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  MATERIALIZE(v);
+  return v->u.a.capacity;
+}
+
+/**
+ * @brief Reserves the capacity of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity to be reserved
+ */
+void lept_reserve_array(lept_value *v, size_t capacity) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (IS_PACKED(v)) {
+    if (v->u.p.capacity < capacity) {
+      v->u.p.n = (double *)lept_realloc(ALLOCATOR_ID(v), v->u.p.n,
+                                        v->u.p.capacity * sizeof(double),
+                                        capacity * sizeof(double));
+      v->u.p.capacity = capacity;
+    }
+    return;
+  }
+  if (v->u.a.capacity < capacity) {
+    v->u.a.e = (lept_value *)lept_realloc(
+        ALLOCATOR_ID(v), v->u.a.e, v->u.a.capacity * sizeof(lept_value),
+        capacity * sizeof(lept_value));
+    v->u.a.capacity = capacity;
+  }
+}
+
+/**
+ * @brief Shrinks the capacity of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ */
+void lept_shrink_array(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (v->u.a.capacity > v->u.a.size) {
+    size_t element = IS_PACKED(v) ? sizeof(double) : sizeof(lept_value);
+    if (v->u.a.size == 0) {
+      lept_dealloc(ALLOCATOR_ID(v), v->u.a.e, v->u.a.capacity * element);
+      v->u.a.e = NULL;
+    } else {
+      v->u.a.e = (lept_value *)lept_realloc(ALLOCATOR_ID(v), v->u.a.e,
+                                            v->u.a.capacity * element,
+                                            v->u.a.size * element);
+    }
+    v->u.a.capacity = v->u.a.size;
+  }
+}
+
+/**
+ * @brief Clears the array value of a JSON value.
+ * 
+ * @param v JSON value
+ */
+void lept_clear_array(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  lept_erase_array_element(v, 0, v->u.a.size);
+}
+
+/**
+ * @brief Gets an element of the array value of a JSON value.
+ * 
+ * A packed array is unpacked first. Frozen arrays are never packed, so
+ * reading them writes nothing.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @return lept_value* Pointer to the element
+ */
+lept_value *lept_get_array_element(const lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  MATERIALIZE(v);
+  assert(index < v->u.a.size);
+  if (IS_PACKED(v)) {
+    assert(!IS_FROZEN(v));
+    lept_unpack_array((lept_value *)v);
+  }
+  return &v->u.a.e[index];
+}
+
+/**
+ * @brief Gets an element of the array value of a JSON value without
+ * modifying the array.
+ * 
+ * An element of a packed array has no lept_value of its own, so its number
+ * is written to the view and the view is returned.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @param view Receives the element of a packed array
+ * @return const lept_value* Pointer to the element or to the view
+ */
+const lept_value *lept_view_array_element(const lept_value *v, size_t index,
+                                          lept_value *view) {
+  assert(v != NULL && v->type == LEPT_ARRAY && view != NULL);
+  MATERIALIZE(v);
+  assert(index < v->u.a.size);
+  if (IS_PACKED(v)) {
+    lept_init(view);
+    lept_set_number(view, v->u.p.n[index]);
+    return view;
+  }
+  return &v->u.a.e[index];
+}
+
+/**
+ * @brief Pushes back an element to the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return lept_value* Pointer to the pushed element
+ */
+lept_value *lept_pushback_array_element(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (IS_PACKED(v)) {
+    lept_unpack_array(v);
+  }
+  if (v->u.a.size == v->u.a.capacity) {
+    lept_reserve_array(v,
+                       lept_grow_capacity(v->u.a.capacity, v->u.a.size + 1));
+  }
+  lept_init(v->u.a.e + v->u.a.size);
+  SET_ALLOCATOR_ID(v->u.a.e + v->u.a.size, ALLOCATOR_ID(v));
+  return v->u.a.e + (v->u.a.size++);
+}
+
+/**
+ * @brief Pops back an element from the array value of a JSON value.
+ * 
+ * @param v JSON value
+ */
+void lept_popback_array_element(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  assert(v->u.a.size > 0);
+  if (IS_PACKED(v)) {
+    v->u.p.size--;
+    return;
+  }
+  lept_free(v->u.a.e + (--v->u.a.size));
+}
+
+/**
+ * @brief Inserts an element to the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @return lept_value* Pointer to the inserted element
+ */
+lept_value *lept_insert_array_element(lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  assert(index <= v->u.a.size);
+  if (IS_PACKED(v)) {
+    lept_unpack_array(v);
+  }
+  if (v->u.a.size == v->u.a.capacity) {
+    lept_reserve_array(v,
+                       lept_grow_capacity(v->u.a.capacity, v->u.a.size + 1));
+  }
+  memmove(v->u.a.e + index + 1, v->u.a.e + index,
+          (v->u.a.size - index) * sizeof(lept_value));
+  v->u.a.size++;
+  lept_init(v->u.a.e + index);
+  SET_ALLOCATOR_ID(v->u.a.e + index, ALLOCATOR_ID(v));
+  return v->u.a.e + index;
+}
+
+/**
+ * @brief Erases elements from the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param index Index of the first element to be erased
+ * @param count Number of elements to be erased
+ */
+void lept_erase_array_element(lept_value *v, size_t index, size_t count) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  assert(index + count <= v->u.a.size);
+  if (IS_PACKED(v)) {
+    memmove(v->u.p.n + index, v->u.p.n + index + count,
+            (v->u.p.size - index - count) * sizeof(double));
+    v->u.p.size -= count;
+    return;
+  }
+  for (size_t i = 0; i < count; i++) {
+    lept_free(v->u.a.e + (index + i));
+  }
+  for (size_t i = index + count; i < v->u.a.size; i++) {
+    v->u.a.e[i - count] = v->u.a.e[i];
+  }
+  v->u.a.size -= count;
+}
+
+/**
+ * @brief Gets the packed numbers of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return double* Numbers of the array, or NULL if the array is not packed
+ */
+double *lept_get_array_numbers(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  MATERIALIZE(v);
+  return IS_PACKED(v) ? v->u.p.n : NULL;
+}
+
+/**
+ * @brief Gets a number element of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @return double Number value of the element
+ */
+double lept_get_array_number(const lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  MATERIALIZE(v);
+  assert(index < v->u.a.size);
+  if (IS_PACKED(v)) {
+    return v->u.p.n[index];
+  }
+  return lept_get_number(&v->u.a.e[index]);
+}
+
+/**
+ * @brief Pushes back a number to the array value of a JSON value.
+ * 
+ * Packed arrays stay packed; other arrays get a new number element.
+ * 
+ * @param v JSON value
+ * @param n Number value
+ */
+void lept_pushback_array_number(lept_value *v, double n) {
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (!IS_PACKED(v)) {
+    lept_set_number(lept_pushback_array_element(v), n);
+    return;
+  }
+  if (v->u.p.size == v->u.p.capacity) {
+    lept_reserve_array(v, lept_grow_capacity(v->u.p.capacity, v->u.p.size + 1));
+  }
+  v->u.p.n[v->u.p.size++] = n;
+}
+
+/**
+ * @brief Converts the array value of a JSON value to the packed representation.
+ * 
+ * @param v JSON value
+ * @return int 1 if the array is packed, 0 if it holds non-number elements
+ */
+int lept_pack_array(lept_value *v) {
+  lept_value *e;
+  size_t i, size;
+  assert(v != NULL && v->type == LEPT_ARRAY);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (IS_PACKED(v)) {
+    return 1;
+  }
+  e = v->u.a.e;
+  size = v->u.a.size;
+  for (i = 0; i < size; i++) {
+    if (e[i].type != LEPT_NUMBER) {
+      return 0;
+    }
+  }
+  v->u.p.n = v->u.p.capacity > 0
+                 ? (double *)lept_malloc(ALLOCATOR_ID(v),
+                                         v->u.p.capacity * sizeof(double))
+                 : NULL;
+  for (i = 0; i < size; i++) {
+    MATERIALIZE(&e[i]);
+    v->u.p.n[i] = e[i].u.n;
+  }
+  v->flags |= LEPT_FLAG_PACKED;
+  lept_dealloc(ALLOCATOR_ID(v), e, v->u.p.capacity * sizeof(lept_value));
+  return 1;
+}
+
+/**
+ * @brief Sets the object value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity of the object
+ */
+void lept_set_object(lept_value *v, size_t capacity) {
+  assert(v != NULL);
+  lept_free(v);
+  v->type = LEPT_OBJECT;
+  v->u.o.size = 0;
+  v->u.o.capacity = capacity;
+  v->u.o.m = capacity > 0
+                 ? (lept_member *)lept_malloc(ALLOCATOR_ID(v),
+                                              capacity * sizeof(lept_member))
+                 : NULL;
+}
+
+/**
+ * @brief Gets the capacity of the object value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return size_t Capacity of the object
+ */
+size_t lept_get_object_capacity(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  MATERIALIZE(v);
+  return v->u.o.capacity;
+}
+
+/**
+ * @brief Gets the size of the object value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return size_t Size of the object
+ */
+size_t lept_get_object_size(const lept_value *v) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  MATERIALIZE(v);
+  return v->u.o.size;
+}
+
+/**
+ * @brief Reserves the capacity of the object value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param capacity Capacity to be reserved
+ */
+void lept_reserve_object(lept_value *v, size_t capacity) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (v->u.o.capacity < capacity) {
+    v->u.o.m = (lept_member *)lept_realloc(
+        ALLOCATOR_ID(v), v->u.o.m, v->u.o.capacity * sizeof(lept_member),
+        capacity * sizeof(lept_member));
+    v->u.o.capacity = capacity;
+  }
+}
+
+/**
+ * @brief Shrinks the capacity of the object value of a JSON value.
+ * 
+ * @param v JSON value
+ */
+void lept_shrink_object(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (v->u.o.capacity > v->u.o.size) {
+    if (v->u.o.size == 0) {
+      lept_dealloc(ALLOCATOR_ID(v), v->u.o.m,
+                   v->u.o.capacity * sizeof(lept_member));
+      v->u.o.m = NULL;
+    } else {
+      v->u.o.m = (lept_member *)lept_realloc(
+          ALLOCATOR_ID(v), v->u.o.m, v->u.o.capacity * sizeof(lept_member),
+          v->u.o.size * sizeof(lept_member));
+    }
+    v->u.o.capacity = v->u.o.size;
+  }
+}
+
+/**
+ * @brief Clears the object value of a JSON value.
+ * 
+ * @param v JSON value
+ */
+void lept_clear_object(lept_value *v) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  for (size_t i = 0; i < v->u.o.size; i++) {
+    lept_free(&v->u.o.m[i].v);
+    lept_dealloc(ALLOCATOR_ID(v), v->u.o.m[i].k, v->u.o.m[i].klen + 1);
+  }
+  v->u.o.size = 0;
+}
+
+/**
+ * @brief Gets the key of an object member.
+ * 
+ * @param v JSON value
+ * @param index Index of the member
+ * @return const char* Key of the member
+ */
+const char *lept_get_object_key(const lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  MATERIALIZE(v);
+  assert(index < v->u.o.size);
+  return v->u.o.m[index].k;
+}
+
+/**
+ * @brief Gets the length of the key of an object member.
+ * 
+ * @param v JSON value
+ * @param index Index of the member
+ * @return size_t Length of the key
+ */
+size_t lept_get_object_key_length(const lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  MATERIALIZE(v);
+  assert(index < v->u.o.size);
+  return v->u.o.m[index].klen;
+}
+
+/**
+ * @brief Gets the value of an object member.
+ * 
+ * @param v JSON value
+ * @param index Index of the member
+ * @return lept_value* Value of the member
+ */
+lept_value *lept_get_object_value(const lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  MATERIALIZE(v);
+  assert(index < v->u.o.size);
+  return &v->u.o.m[index].v;
+}
+
+/**
+ * @brief Appends a hash index of the keys to the members of an object.
+ * 
+ * Slots hold member indices plus one, 0 marking an empty slot. Only the
+ * first of duplicate keys is indexed, matching the linear search.
+ * 
+ * @param v JSON object with no spare capacity
+ * @return int 1 if the keys are all distinct, 0 otherwise
+ */
+static int lept_freeze_index(lept_value *v) {
+  size_t i, h, size = v->u.o.size, count = lept_frozen_slots(size);
+  size_t *slots;
+  int unique = 1;
+  v->u.o.m = (lept_member *)lept_realloc(
+      ALLOCATOR_ID(v), v->u.o.m, size * sizeof(lept_member),
+      size * sizeof(lept_member) + count * sizeof(size_t));
+  slots = (size_t *)(v->u.o.m + size);
+  memset(slots, 0, count * sizeof(size_t));
+  for (i = 0; i < size; i++) {
+    const lept_member *m = &v->u.o.m[i];
+    for (h = lept_hash_bytes(m->k, m->klen, LEPT_HASH_SEED) & (count - 1);
+         slots[h] != 0; h = (h + 1) & (count - 1)) {
+      const lept_member *o = &v->u.o.m[slots[h] - 1];
+      if (o->klen == m->klen && memcmp(o->k, m->k, m->klen) == 0) {
+        break;
+      }
+    }
+    if (slots[h] == 0) {
+      slots[h] = i + 1;
+    } else {
+      unique = 0;
+    }
+  }
+  return unique;
+}
+
+/**
+ * @brief Checks that the keys of a small object are all distinct.
+ * 
+ * @param v JSON object
+ * @return int 1 if the keys are all distinct, 0 otherwise
+ */
+static int lept_freeze_unique(const lept_value *v) {
+  for (size_t i = 1; i < v->u.o.size; i++) {
+    for (size_t j = 0; j < i; j++) {
+      if (v->u.o.m[i].klen == v->u.o.m[j].klen &&
+          memcmp(v->u.o.m[i].k, v->u.o.m[j].k, v->u.o.m[i].klen) == 0) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/**
+ * @brief Finalizes a JSON value into a read-only form.
+ * 
+ * Lazy values are parsed, packed arrays unpacked and spare capacity
+ * released, and objects of at least LEPT_FROZEN_INDEX_MIN members get a
+ * hash index. Afterwards no getter or find function writes to the tree, so
+ * any number of threads may read it without locks. A frozen container must
+ * not be modified; lept_free() and lept_copy() still work.
+ * 
+ * @param v JSON value
+ */
+void lept_freeze(lept_value *v) {
+  size_t i;
+  assert(v != NULL);
+  if (IS_FROZEN(v)) {
+    return;
+  }
+  MATERIALIZE(v);
+  switch (v->type) {
+  case LEPT_ARRAY:
+    /* lept_get_array_element() hands out element pointers */
+    if (IS_PACKED(v)) {
+      lept_unpack_array(v);
+    }
+    lept_shrink_array(v);
+    for (i = 0; i < v->u.a.size; i++) {
+      lept_freeze(&v->u.a.e[i]);
+    }
+    break;
+  case LEPT_OBJECT:
+    lept_shrink_object(v);
+    for (i = 0; i < v->u.o.size; i++) {
+      lept_freeze(&v->u.o.m[i].v);
+    }
+    if (v->u.o.size >= LEPT_FROZEN_INDEX_MIN ? lept_freeze_index(v)
+                                             : lept_freeze_unique(v)) {
+      v->flags |= LEPT_FLAG_UNIQUE;
+    }
+    break;
+  default:
+    break;
+  }
+  v->flags |= LEPT_FLAG_FROZEN;
+}
+
+/**
+ * @brief Checks whether a JSON value has been frozen by lept_freeze().
+ * 
+ * @param v JSON value
+ * @return int 1 if frozen, 0 otherwise
+ */
+int lept_is_frozen(const lept_value *v) {
+  assert(v != NULL);
+  return IS_FROZEN(v);
+}
+
+typedef struct lept_shared_version lept_shared_version;
+
+/**
+ * @brief Published version of a shared document.
+ */
+struct lept_shared_version {
+  lept_value v;              /**< Frozen document */
+  lept_shared_version *next; /**< Next retired version */
+};
+
+/**
+ * @brief Hazard slot of a registered reader, a cache line in size.
+ * 
+ * With the fields at the front of a 64-byte slot, the hot fields of two
+ * readers never share a line, whatever the alignment of the table.
+ */
+typedef struct {
+  /** Version the reader may be using, or NULL */
+  _Atomic(lept_shared_version *) hazard;
+  atomic_int used; /**< Whether a reader holds the slot */
+  char pad[64 - sizeof(void *) - sizeof(int)]; /**< Fills the line */
+} lept_shared_slot;
+
+/**
+ * @brief Handle to a document that is replaced while threads read it.
+ */
+struct lept_shared {
+  _Atomic(lept_shared_version *) current; /**< Latest published version */
+  lept_shared_slot *slots;      /**< Reader slots */
+  int readers;                  /**< Number of reader slots */
+  lept_shared_version *retired; /**< Replaced versions not yet freed */
+  pthread_mutex_t lock;         /**< Serializes publishing and reclaiming */
+};
+
+/**
+ * @brief Creates a shared document handle with no published version.
+ * 
+ * @param readers Maximum number of readers registered at once
+ * @return lept_shared* Shared handle
+ */
+lept_shared *lept_shared_new(int readers) {
+  lept_shared *s;
+  assert(readers > 0);
+  s = (lept_shared *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, sizeof(*s));
+  atomic_init(&s->current, NULL);
+  s->slots = (lept_shared_slot *)lept_malloc(
+      LEPT_DEFAULT_ALLOCATOR, (size_t)readers * sizeof(lept_shared_slot));
+  s->readers = readers;
+  for (int i = 0; i < readers; i++) {
+    atomic_init(&s->slots[i].hazard, NULL);
+    atomic_init(&s->slots[i].used, 0);
+  }
+  s->retired = NULL;
+  pthread_mutex_init(&s->lock, NULL);
+  return s;
+}
+
+/**
+ * @brief Frees a version of a shared document.
+ * 
+ * @param version Version
+ */
+static void lept_shared_delete(lept_shared_version *version) {
+  lept_free(&version->v);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, version, sizeof(*version));
+}
+
+/**
+ * @brief Frees the retired versions no reader holds. Called with the lock
+ * held.
+ * 
+ * A reader publishes its hazard before checking that the version is still
+ * current, so a retired version absent from every slot can no longer be
+ * reached.
+ * 
+ * @param s Shared handle
+ */
+static void lept_shared_reclaim(lept_shared *s) {
+  lept_shared_version **p = &s->retired;
+  while (*p != NULL) {
+    lept_shared_version *version = *p;
+    size_t i;
+    for (i = 0; i < (size_t)s->readers; i++) {
+      if (atomic_load(&s->slots[i].hazard) == version) {
+        break;
+      }
+    }
+    if (i < (size_t)s->readers) {
+      p = &version->next;
+    } else {
+      *p = version->next;
+      lept_shared_delete(version);
+    }
+  }
+}
+
+/**
+ * @brief Frees a shared handle and every version it holds. No reader may be
+ * active.
+ * 
+ * @param s Shared handle
+ */
+void lept_shared_free(lept_shared *s) {
+  lept_shared_version *version;
+  assert(s != NULL);
+  if ((version = atomic_load(&s->current)) != NULL) {
+    lept_shared_delete(version);
+  }
+  while ((version = s->retired) != NULL) {
+    s->retired = version->next;
+    lept_shared_delete(version);
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, s->slots,
+               (size_t)s->readers * sizeof(lept_shared_slot));
+  pthread_mutex_destroy(&s->lock);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, s, sizeof(*s));
+}
+
+/**
+ * @brief Registers a reader thread with a shared handle.
+ * 
+ * @param s Shared handle
+ * @return int Reader id, or -1 if all slots are taken
+ */
+int lept_shared_register(lept_shared *s) {
+  assert(s != NULL);
+  for (int i = 0; i < s->readers; i++) {
+    int unused = 0;
+    if (atomic_compare_exchange_strong(&s->slots[i].used, &unused, 1)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Unregisters a reader, releasing any snapshot it still holds.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ */
+void lept_shared_unregister(lept_shared *s, int reader) {
+  assert(s != NULL && reader >= 0 && reader < s->readers);
+  lept_shared_release(s, reader);
+  atomic_store(&s->slots[reader].used, 0);
+}
+
+/**
+ * @brief Acquires a snapshot of the latest version without locking.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ * @return const lept_value* Frozen document, valid until
+ * lept_shared_release(), or NULL if nothing has been published
+ */
+const lept_value *lept_shared_acquire(lept_shared *s, int reader) {
+  lept_shared_version *version, *current;
+  assert(s != NULL && reader >= 0 && reader < s->readers);
+  current = atomic_load(&s->current);
+  /* Retry if the version was replaced before the hazard became visible */
+  do {
+    version = current;
+    atomic_store(&s->slots[reader].hazard, version);
+  } while ((current = atomic_load(&s->current)) != version);
+  return version != NULL ? &version->v : NULL;
+}
+
+/**
+ * @brief Releases the snapshot of a reader.
+ * 
+ * Only the hazard is cleared; replaced versions are freed by the writer, so
+ * the read path never pays for freeing a tree.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ */
+void lept_shared_release(lept_shared *s, int reader) {
+  assert(s != NULL && reader >= 0 && reader < s->readers);
+  atomic_store(&s->slots[reader].hazard, NULL);
+}
+
+/**
+ * @brief Publishes a new version, taking ownership of the value.
+ * 
+ * The value is frozen so that readers never write to it, then swapped in
+ * atomically. The replaced version is freed once no reader holds it.
+ * 
+ * @param s Shared handle
+ * @param v JSON value, moved into the handle and left null
+ */
+void lept_shared_publish(lept_shared *s, lept_value *v) {
+  lept_shared_version *version;
+  assert(s != NULL && v != NULL);
+  version = (lept_shared_version *)lept_malloc(LEPT_DEFAULT_ALLOCATOR,
+                                               sizeof(*version));
+  lept_init(&version->v);
+  lept_move(&version->v, v);
+  lept_freeze(&version->v);
+  pthread_mutex_lock(&s->lock);
+  version = atomic_exchange(&s->current, version);
+  if (version != NULL) {
+    version->next = s->retired;
+    s->retired = version;
+  }
+  lept_shared_reclaim(s);
+  pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * @brief Frees the replaced versions that no reader holds any more.
+ * 
+ * Publishing does this as well; a writer with nothing new to publish calls
+ * it to free versions whose readers have left since.
+ * 
+ * @param s Shared handle
+ */
+void lept_shared_collect(lept_shared *s) {
+  assert(s != NULL);
+  pthread_mutex_lock(&s->lock);
+  lept_shared_reclaim(s);
+  pthread_mutex_unlock(&s->lock);
+}
+
+typedef struct lept_reclaim_batch lept_reclaim_batch;
+
+/**
+ * @brief Documents detached together for a reclaimer.
+ */
+struct lept_reclaim_batch {
+  lept_reclaim_batch *next; /**< Next queued batch */
+  size_t count;             /**< Number of documents */
+  lept_value values[];      /**< Documents */
+};
+
+/**
+ * @brief Background thread freeing detached documents.
+ */
+struct lept_reclaimer {
+  pthread_t thread;          /**< Reclaimer thread */
+  pthread_mutex_t lock;      /**< Protects the fields below */
+  pthread_cond_t work;       /**< Signaled when batches arrive or on stop */
+  pthread_cond_t idle;       /**< Signaled when nothing is pending */
+  lept_reclaim_batch *queue; /**< Batches waiting to be freed */
+  size_t pending;            /**< Batches queued or being freed */
+  int stop;                  /**< Set to end the thread */
+};
+
+/**
+ * @brief Frees a batch and the documents in it.
+ * 
+ * @param b Batch
+ */
+static void lept_reclaim(lept_reclaim_batch *b) {
+  for (size_t i = 0; i < b->count; i++) {
+    lept_free(&b->values[i]);
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, b,
+               sizeof(*b) + b->count * sizeof(lept_value));
+}
+
+/**
+ * @brief Body of the reclaimer thread, freeing queued batches until
+ * stopped.
+ * 
+ * The whole queue is taken at once so that freeing runs without the lock.
+ * 
+ * @param arg Reclaimer
+ * @return void* NULL
+ */
+static void *lept_reclaimer_run(void *arg) {
+  lept_reclaimer *r = (lept_reclaimer *)arg;
+  pthread_mutex_lock(&r->lock);
+  for (;;) {
+    lept_reclaim_batch *b;
+    size_t n = 0;
+    while (r->queue == NULL && !r->stop) {
+      pthread_cond_wait(&r->work, &r->lock);
+    }
+    if (r->queue == NULL) {
+      break;
+    }
+    b = r->queue;
+    r->queue = NULL;
+    pthread_mutex_unlock(&r->lock);
+    while (b != NULL) {
+      lept_reclaim_batch *next = b->next;
+      lept_reclaim(b);
+      b = next;
+      n++;
+    }
+    pthread_mutex_lock(&r->lock);
+    if ((r->pending -= n) == 0) {
+      pthread_cond_broadcast(&r->idle);
+    }
+  }
+  pthread_mutex_unlock(&r->lock);
+  return NULL;
+}
+
+/**
+ * @brief Starts a reclaimer thread.
+ * 
+ * @return lept_reclaimer* Reclaimer, or NULL if the thread could not be
+ * created
+ */
+lept_reclaimer *lept_reclaimer_new(void) {
+  lept_reclaimer *r = (lept_reclaimer *)lept_malloc(LEPT_DEFAULT_ALLOCATOR,
+                                                    sizeof(*r));
+  r->queue = NULL;
+  r->pending = 0;
+  r->stop = 0;
+  pthread_mutex_init(&r->lock, NULL);
+  pthread_cond_init(&r->work, NULL);
+  pthread_cond_init(&r->idle, NULL);
+  if (pthread_create(&r->thread, NULL, lept_reclaimer_run, r) != 0) {
+    pthread_cond_destroy(&r->idle);
+    pthread_cond_destroy(&r->work);
+    pthread_mutex_destroy(&r->lock);
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, r, sizeof(*r));
+    return NULL;
+  }
+  return r;
+}
+
+/**
+ * @brief Frees every pending document, then stops the reclaimer thread and
+ * frees the reclaimer.
+ * 
+ * @param r Reclaimer
+ */
+void lept_reclaimer_free(lept_reclaimer *r) {
+  assert(r != NULL);
+  pthread_mutex_lock(&r->lock);
+  r->stop = 1;
+  pthread_cond_signal(&r->work);
+  pthread_mutex_unlock(&r->lock);
+  pthread_join(r->thread, NULL);
+  pthread_cond_destroy(&r->idle);
+  pthread_cond_destroy(&r->work);
+  pthread_mutex_destroy(&r->lock);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, r, sizeof(*r));
+}
+
+/**
+ * @brief Waits until every document handed to a reclaimer has been freed.
+ * 
+ * @param r Reclaimer
+ */
+void lept_reclaimer_drain(lept_reclaimer *r) {
+  assert(r != NULL);
+  pthread_mutex_lock(&r->lock);
+  while (r->pending > 0) {
+    pthread_cond_wait(&r->idle, &r->lock);
+  }
+  pthread_mutex_unlock(&r->lock);
+}
+
+/**
+ * @brief Detaches a JSON value and frees it on the reclaimer thread.
+ * 
+ * Detaching copies only the top-level value, so the cost on the calling
+ * thread does not depend on the size of the tree.
+ * 
+ * @param r Reclaimer, or NULL to free on the calling thread
+ * @param v JSON value, left null
+ */
+void lept_free_async(lept_reclaimer *r, lept_value *v) {
+  lept_free_batch(r, v, 1);
+}
+
+/**
+ * @brief Detaches several JSON values and frees them together on the
+ * reclaimer thread.
+ * 
+ * The values share one allocation and one hand-off to the reclaimer. Their
+ * allocators must be usable from the reclaimer thread.
+ * 
+ * @param r Reclaimer, or NULL to free on the calling thread
+ * @param values JSON values, left null
+ * @param count Number of values
+ */
+void lept_free_batch(lept_reclaimer *r, lept_value *values, size_t count) {
+  lept_reclaim_batch *b;
+  assert(values != NULL || count == 0);
+  if (r == NULL) {
+    for (size_t i = 0; i < count; i++) {
+      lept_free(&values[i]);
+    }
+    return;
+  }
+  if (count == 0) {
+    return;
+  }
+  b = (lept_reclaim_batch *)lept_malloc(
+      LEPT_DEFAULT_ALLOCATOR, sizeof(*b) + count * sizeof(lept_value));
+  b->count = count;
+  memcpy(b->values, values, count * sizeof(lept_value));
+  for (size_t i = 0; i < count; i++) {
+    /* Keep the allocator, as lept_free() does */
+    values[i].type = LEPT_NULL;
+    values[i].flags &= ~LEPT_FLAG_MASK;
+  }
+  pthread_mutex_lock(&r->lock);
+  b->next = r->queue;
+  r->queue = b;
+  r->pending++;
+  pthread_cond_signal(&r->work);
+  pthread_mutex_unlock(&r->lock);
+}
+
+/**
+ * @brief Finds the index of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return size_t Index of the member, or LEPT_KEY_NOT_EXIST if not found
+ */
+size_t lept_find_object_index(const lept_value *v, const char *key,
+                              size_t klen) {
+  assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+  MATERIALIZE(v);
+  if (IS_FROZEN(v) && v->u.o.size >= LEPT_FROZEN_INDEX_MIN) {
+    const size_t *slots = (const size_t *)(v->u.o.m + v->u.o.size);
+    size_t mask = lept_frozen_slots(v->u.o.size) - 1;
+    for (size_t h = lept_hash_bytes(key, klen, LEPT_HASH_SEED) & mask;
+         slots[h] != 0; h = (h + 1) & mask) {
+      const lept_member *m = &v->u.o.m[slots[h] - 1];
+      if (m->klen == klen && memcmp(m->k, key, klen) == 0) {
+        return slots[h] - 1;
+      }
+    }
+    return LEPT_KEY_NOT_EXIST;
+  }
+  for (size_t i = 0; i < v->u.o.size; ++i) {
+    if (v->u.o.m[i].klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0) {
+      return i;
+    }
+  }
+  return LEPT_KEY_NOT_EXIST;
+}
+
+/**
+ * @brief Finds the value of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member, or NULL if not found
+ */
+lept_value *lept_find_object_value(lept_value *v, const char *key,
+                                   size_t klen) {
+  size_t index = lept_find_object_index(v, key, klen);
+  return index != LEPT_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
+}
+
+/**
+ * @brief Sets the value of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member
+ */
+lept_value *lept_set_object_value(lept_value *v, const char *key, size_t klen) {
+  assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  if (v->u.o.size == v->u.o.capacity) {
+    lept_reserve_object(v,
+                        lept_grow_capacity(v->u.o.capacity, v->u.o.size + 1));
+  }
+  v->u.o.m[v->u.o.size].k = (char *)lept_malloc(ALLOCATOR_ID(v), klen + 1);
+  memcpy(v->u.o.m[v->u.o.size].k, key, klen);
+  v->u.o.m[v->u.o.size].k[klen] = '\0';
+  v->u.o.m[v->u.o.size].klen = klen;
+  lept_init(&v->u.o.m[v->u.o.size].v);
+  SET_ALLOCATOR_ID(&v->u.o.m[v->u.o.size].v, ALLOCATOR_ID(v));
+  return &v->u.o.m[v->u.o.size++].v;
+}
+
+/**
+ * @brief Removes an object member by index.
+ * 
+ * @param v JSON value
+ * @param index Index of the member
+ */
+void lept_remove_object_value(lept_value *v, size_t index) {
+  assert(v != NULL && v->type == LEPT_OBJECT);
+  assert(!IS_FROZEN(v));
+  MATERIALIZE(v);
+  assert(index < v->u.o.size);
+  lept_free(&v->u.o.m[index].v);
+  lept_dealloc(ALLOCATOR_ID(v), v->u.o.m[index].k, v->u.o.m[index].klen + 1);
+  for (size_t i = index + 1; i < v->u.a.size; i++) {
+    v->u.o.m[i - 1] = v->u.o.m[i];
+  }
+  v->u.o.size -= 1;
+}
+
+/**
+ * @brief Initializes an object builder with an empty scratch buffer.
+ * 
+ * @param b Object builder
+ */
+void lept_object_builder_init(lept_object_builder *b) {
+  assert(b != NULL);
+  b->m = NULL;
+  b->size = 0;
+  b->capacity = 0;
+}
+
+/**
+ * @brief Appends a member to the object builder.
+ * 
+ * @param b Object builder
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member, initialized to null
+ */
+lept_value *lept_object_builder_add(lept_object_builder *b, const char *key,
+                                    size_t klen) {
+  lept_member *m;
+  assert(b != NULL && (key != NULL || klen == 0));
+  if (b->size == b->capacity) {
+    size_t capacity = lept_grow_capacity(b->capacity, b->size + 1);
+    if (capacity < LEPT_OBJECT_BUILDER_INIT_SIZE) {
+      capacity = LEPT_OBJECT_BUILDER_INIT_SIZE;
+    }
+    b->m = (lept_member *)lept_realloc(LEPT_DEFAULT_ALLOCATOR, b->m,
+                                       b->capacity * sizeof(lept_member),
+                                       capacity * sizeof(lept_member));
+    b->capacity = capacity;
+  }
+  m = &b->m[b->size++];
+  m->k = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, klen + 1);
+  memcpy(m->k, key, klen);
+  m->k[klen] = '\0';
+  m->klen = klen;
+  lept_init(&m->v);
+  return &m->v;
+}
+
+/**
+ * @brief Moves the accumulated members into a JSON value as an object.
+ * 
+ * The member array of the object is allocated once with the exact size.
+ * The builder is left empty but keeps its scratch buffer for reuse. The
+ * object keeps the allocator of v: keys built with the default allocator
+ * are copied into it, while member values keep their own allocators.
+ * 
+ * @param b Object builder
+ * @param v JSON value to receive the object
+ */
+void lept_object_builder_commit(lept_object_builder *b, lept_value *v) {
+  unsigned id;
+  assert(b != NULL && v != NULL);
+  lept_free(v);
+  id = ALLOCATOR_ID(v);
+  lept_set_object(v, b->size);
+  if (b->size > 0) {
+    memcpy(v->u.o.m, b->m, b->size * sizeof(lept_member));
+  }
+  if (id != LEPT_DEFAULT_ALLOCATOR) {
+    for (size_t i = 0; i < b->size; i++) {
+      lept_member *m = &v->u.o.m[i];
+      char *k = (char *)lept_malloc(id, m->klen + 1);
+      memcpy(k, m->k, m->klen + 1);
+      lept_dealloc(LEPT_DEFAULT_ALLOCATOR, m->k, m->klen + 1);
+      m->k = k;
+    }
+  }
+  v->u.o.size = b->size;
+  b->size = 0;
+}
+
+/**
+ * @brief Frees an object builder, including any uncommitted members.
+ * 
+ * @param b Object builder
+ */
+void lept_object_builder_free(lept_object_builder *b) {
+  assert(b != NULL);
+  for (size_t i = 0; i < b->size; i++) {
+    lept_free(&b->m[i].v);
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, b->m[i].k, b->m[i].klen + 1);
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, b->m, b->capacity * sizeof(lept_member));
+  lept_object_builder_init(b);
+}
+
+/**
+ * @brief Sets the global default allocator.
+ * 
+ * @param a Allocator, or NULL to restore malloc(), realloc() and free()
+ */
+void lept_set_allocator(const lept_allocator *a) {
+  lept_allocators[LEPT_DEFAULT_ALLOCATOR] = a != NULL ? a : &lept_std_allocator;
+}
+
+/**
+ * @brief Registers an allocator for per-parse or per-document use.
+ * 
+ * @param a Allocator, which must outlive every value allocated from it
+ * @return int Allocator id, or -1 if the registry is full
+ */
+int lept_register_allocator(const lept_allocator *a) {
+  int id;
+  assert(a != NULL && a->malloc_fn != NULL && a->realloc_fn != NULL &&
+         a->free_fn != NULL);
+  for (id = 1; id < LEPT_MAX_ALLOCATORS; id++) {
+    if (lept_allocators[id] == a) {
+      return id;
+    }
+    if (lept_allocators[id] == NULL) {
+      lept_allocators[id] = a;
+      return id;
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Initializes a JSON value whose buffers come from an allocator.
+ * 
+ * @param v JSON value to be initialized
+ * @param allocator Allocator id
+ */
+void lept_init_with_allocator(lept_value *v, int allocator) {
+  assert(v != NULL);
+  assert(allocator >= 0 && allocator < LEPT_MAX_ALLOCATORS &&
+         lept_allocators[allocator] != NULL);
+  lept_init(v);
+  SET_ALLOCATOR_ID(v, allocator);
+}
+
+/**
+ * @brief Prepares a context that borrows the scratch stack of a parser.
+ * 
+ * @param p Parser
+ * @param c Context to be prepared
+ * @param json JSON string to be parsed
+ */
+static void lept_parser_begin(lept_parser *p, lept_context *c,
+                              const char *json) {
+  assert(p->allocator >= 0 && p->allocator < LEPT_MAX_ALLOCATORS &&
+         lept_allocators[p->allocator] != NULL);
+  c->json = json;
+  c->stack = p->stack;
+  c->size = p->size;
+  c->top = 0;
+  c->allocator = (unsigned)p->allocator;
+  c->flags = 0;
+}
+
+/**
+ * @brief Returns the scratch stack of a context to its parser.
+ * 
+ * The stack is released if it grew beyond the retention cap.
+ * 
+ * @param p Parser
+ * @param c Context borrowed by lept_parser_begin()
+ */
+static void lept_parser_end(lept_parser *p, lept_context *c) {
+  if (c->size > p->max_retained) {
+    lept_dealloc(c->allocator, c->stack, c->size);
+    c->stack = NULL;
+    c->size = 0;
+  }
+  p->stack = c->stack;
+  p->size = c->size;
+}
+
+/**
+ * @brief Initializes a reusable parser.
+ * 
+ * @param p Parser
+ */
+void lept_parser_init(lept_parser *p) {
+  assert(p != NULL);
+  p->stack = NULL;
+  p->size = 0;
+  p->max_retained = LEPT_PARSER_MAX_RETAINED;
+  p->allocator = LEPT_DEFAULT_ALLOCATOR;
+}
+
+/**
+ * @brief Parses a JSON string, reusing the scratch stack of the parser.
+ * 
+ * @param p Parser
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_parser_parse(lept_parser *p, lept_value *v, const char *json) {
+  lept_context c;
+  int ret;
+  assert(p != NULL && v != NULL);
+  lept_parser_begin(p, &c, json);
+  ret = lept_parse_root(&c, v);
+  lept_parser_end(p, &c);
+  return ret;
+}
+
+/**
+ * @brief Parses a JSON string into an existing value, reusing the scratch
+ * stack of the parser and the allocations of the value.
+ * 
+ * @param p Parser
+ * @param v Initialized JSON value to be parsed into
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_parser_reparse(lept_parser *p, lept_value *v, const char *json) {
+  lept_context c;
+  int ret;
+  assert(p != NULL && v != NULL);
+  lept_parser_begin(p, &c, json);
+  ret = lept_reparse_root(&c, v);
+  lept_parser_end(p, &c);
+  return ret;
+}
+
+/**
+ * @brief Frees the scratch stack of a parser.
+ * 
+ * @param p Parser
+ */
+void lept_parser_free(lept_parser *p) {
+  assert(p != NULL);
+  lept_dealloc((unsigned)p->allocator, p->stack, p->size);
+  p->stack = NULL;
+  p->size = 0;
+}
+
+/**
+ * @brief Initializes a reusable writer.
+ * 
+ * @param w Writer
+ */
+void lept_writer_init(lept_writer *w) {
+  assert(w != NULL);
+  w->stack = NULL;
+  w->size = 0;
+  w->keys = NULL;
+  w->keys_size = 0;
+  w->max_retained = LEPT_PARSER_MAX_RETAINED;
+}
+
+/**
+ * @brief Stringifies a JSON value into the buffer of the writer.
+ * 
+ * A buffer grown beyond max_retained by the previous call is released first,
+ * since the previous result stays valid until this call.
+ * 
+ * @param w Writer
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return const char* Stringified JSON value, valid until the next call
+ */
+const char *lept_writer_stringify(lept_writer *w, const lept_value *v,
+                                  size_t *length) {
+  lept_context c;
+  assert(w != NULL && v != NULL);
+  if (w->size > w->max_retained) {
+    lept_writer_free(w);
+  }
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  c.stack = w->stack;
+  c.size = w->size;
+  c.top = 0;
+  lept_stringify_value(&c, v);
+  if (length) {
+    *length = c.top;
+  }
+  PUTC(&c, '\0');
+  w->stack = c.stack;
+  w->size = c.size;
+  return w->stack;
+}
+
+/**
+ * @brief Stringifies a JSON value in canonical form into the buffer of a
+ * writer.
+ * 
+ * The member sort buffer is kept by the writer as well, so repeated calls
+ * make no allocations once both buffers are large enough.
+ * 
+ * @param w Writer
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return const char* Stringified JSON value, valid until the next call
+ */
+const char *lept_writer_stringify_canonical(lept_writer *w,
+                                            const lept_value *v,
+                                            size_t *length) {
+  lept_context c, keys;
+  assert(w != NULL && v != NULL);
+  if (w->size + w->keys_size > w->max_retained) {
+    lept_writer_free(w);
+  }
+  c.allocator = keys.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = keys.flags = 0;
+  c.stack = w->stack;
+  c.size = w->size;
+  keys.stack = w->keys;
+  keys.size = w->keys_size;
+  c.top = keys.top = 0;
+  lept_canonical_value(&c, &keys, v);
+  if (length) {
+    *length = c.top;
+  }
+  PUTC(&c, '\0');
+  w->stack = c.stack;
+  w->size = c.size;
+  w->keys = keys.stack;
+  w->keys_size = keys.size;
+  return w->stack;
+}
+
+/**
+ * @brief Frees the buffers of a writer.
+ * 
+ * @param w Writer
+ */
+void lept_writer_free(lept_writer *w) {
+  assert(w != NULL);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, w->stack, w->size);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, w->keys, w->keys_size);
+  w->stack = NULL;
+  w->size = 0;
+  w->keys = NULL;
+  w->keys_size = 0;
+}
+
+/**
+ * @brief Pushes an unsigned integer in big-endian byte order.
+ * 
+ * @param c Context for encoding
+ * @param u Integer
+ * @param n Number of bytes
+ */
+static void lept_encode_be(lept_context *c, unsigned long long u, size_t n) {
+  unsigned char *p = (unsigned char *)lept_context_push(c, n);
+  for (size_t i = 0; i < n; i++) {
+    p[n - 1 - i] = (unsigned char)(u >> (8 * i));
+  }
+}
+
+/**
+ * @brief Pushes a MessagePack type byte followed by a big-endian integer.
+ * 
+ * @param c Context for encoding
+ * @param type Type byte
+ * @param u Integer
+ * @param n Number of bytes of the integer
+ */
+static void lept_msgpack_put(lept_context *c, unsigned type,
+                             unsigned long long u, size_t n) {
+  PUTC(c, (char)type);
+  lept_encode_be(c, u, n);
+}
+
+/**
+ * @brief Pushes the header of a MessagePack string, array or map.
+ * 
+ * @param c Context for encoding
+ * @param type LEPT_STRING, LEPT_ARRAY or LEPT_OBJECT
+ * @param n Length in bytes, elements or members
+ */
+static void lept_msgpack_head(lept_context *c, lept_type type, size_t n) {
+  /* fix form, its limit, then the 8-, 16- and 32-bit forms */
+  static const unsigned forms[][5] = {{0xa0, 31, 0xd9, 0xda, 0xdb},
+                                      {0x90, 15, 0, 0xdc, 0xdd},
+                                      {0x80, 15, 0, 0xde, 0xdf}};
+  const unsigned *f = forms[type == LEPT_STRING ? 0 : type == LEPT_ARRAY ? 1
+                                                                         : 2];
+  if (n <= f[1]) {
+    PUTC(c, (char)(f[0] | n));
+  } else if (n <= 0xff && f[2] != 0) {
+    lept_msgpack_put(c, f[2], n, 1);
+  } else if (n <= 0xffff) {
+    lept_msgpack_put(c, f[3], n, 2);
+  } else {
+    lept_msgpack_put(c, f[4], n, 4);
+  }
+}
+
+/**
+ * @brief Pushes the head of a CBOR data item.
+ * 
+ * @param c Context for encoding
+ * @param major Major type
+ * @param u Argument
+ */
+static void lept_cbor_head(lept_context *c, unsigned major,
+                           unsigned long long u) {
+  major <<= 5;
+  if (u < 24) {
+    PUTC(c, (char)(major | u));
+  } else if (u <= 0xff) {
+    PUTC(c, (char)(major | 24));
+    lept_encode_be(c, u, 1);
+  } else if (u <= 0xffff) {
+    PUTC(c, (char)(major | 25));
+    lept_encode_be(c, u, 2);
+  } else if (u <= 0xffffffffULL) {
+    PUTC(c, (char)(major | 26));
+    lept_encode_be(c, u, 4);
+  } else {
+    PUTC(c, (char)(major | 27));
+    lept_encode_be(c, u, 8);
+  }
+}
+
+/**
+ * @brief Pushes the header of a string, array or map.
+ * 
+ * @param c Context for encoding
+ * @param format Binary encoding
+ * @param type LEPT_STRING, LEPT_ARRAY or LEPT_OBJECT
+ * @param n Length in bytes, elements or members
+ */
+static void lept_encode_head(lept_context *c, lept_format format,
+                             lept_type type, size_t n) {
+  if (format == LEPT_CBOR) {
+    lept_cbor_head(c, type == LEPT_STRING ? 3 : type == LEPT_ARRAY ? 4 : 5, n);
+  } else {
+    lept_msgpack_head(c, type, n);
+  }
+}
+
+/**
+ * @brief Pushes a number, as the shortest integer if it is integral.
+ * 
+ * @param c Context for encoding
+ * @param format Binary encoding
+ * @param n Number
+ */
+static void lept_encode_number(lept_context *c, lept_format format, double n) {
+  unsigned long long bits;
+  long long i;
+  /* -0.0 and numbers outside the 64-bit range stay doubles */
+  if (n >= -9223372036854775808.0 && n < 9223372036854775808.0 &&
+      (double)(i = (long long)n) == n && !(n == 0 && signbit(n))) {
+    if (format == LEPT_CBOR) {
+      lept_cbor_head(c, i >= 0 ? 0 : 1,
+                     i >= 0 ? (unsigned long long)i
+                            : (unsigned long long)(-1 - i));
+    } else if (i >= 0) {
+      if (i <= 0x7f) {
+        PUTC(c, (char)i);
+      } else if (i <= 0xff) {
+        lept_msgpack_put(c, 0xcc, (unsigned long long)i, 1);
+      } else if (i <= 0xffff) {
+        lept_msgpack_put(c, 0xcd, (unsigned long long)i, 2);
+      } else if (i <= 0xffffffffLL) {
+        lept_msgpack_put(c, 0xce, (unsigned long long)i, 4);
+      } else {
+        lept_msgpack_put(c, 0xcf, (unsigned long long)i, 8);
+      }
+    } else if (i >= -32) {
+      PUTC(c, (char)i);
+    } else if (i >= -128) {
+      lept_msgpack_put(c, 0xd0, (unsigned long long)i, 1);
+    } else if (i >= -32768) {
+      lept_msgpack_put(c, 0xd1, (unsigned long long)i, 2);
+    } else if (i >= -2147483647LL - 1) {
+      lept_msgpack_put(c, 0xd2, (unsigned long long)i, 4);
+    } else {
+      lept_msgpack_put(c, 0xd3, (unsigned long long)i, 8);
+    }
+    return;
+  }
+  memcpy(&bits, &n, sizeof(bits));
+  PUTC(c, (char)(format == LEPT_CBOR ? 0xfb : 0xcb));
+  lept_encode_be(c, bits, 8);
+}
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR onto the context stack.
+ * 
+ * @param c Context for encoding
+ * @param v JSON value
+ * @param format Binary encoding
+ */
+static void lept_encode_value(lept_context *c, const lept_value *v,
+                              lept_format format) {
+  static const unsigned char literals[][3] = {{0xc0, 0xc2, 0xc3},
+                                              {0xf6, 0xf4, 0xf5}};
+  size_t i;
+  MATERIALIZE(v);
+  switch (v->type) {
+  case LEPT_NULL:
+  case LEPT_FALSE:
+  case LEPT_TRUE:
+    PUTC(c, (char)literals[format == LEPT_CBOR][v->type]);
+    break;
+  case LEPT_NUMBER:
+    lept_encode_number(c, format, v->u.n);
+    break;
+  case LEPT_STRING:
+    lept_encode_head(c, format, LEPT_STRING, v->u.s.len);
+    if (v->u.s.len > 0) {
+      PUTS(c, v->u.s.s, v->u.s.len);
+    }
+    break;
+  case LEPT_ARRAY:
+    lept_encode_head(c, format, LEPT_ARRAY, v->u.a.size);
+    for (i = 0; i < v->u.a.size; i++) {
+      double n;
+      if (lept_array_number_at(v, i, &n)) {
+        lept_encode_number(c, format, n);
+      } else {
+        lept_encode_value(c, &v->u.a.e[i], format);
+      }
+    }
+    break;
+  case LEPT_OBJECT:
+    lept_encode_head(c, format, LEPT_OBJECT, v->u.o.size);
+    for (i = 0; i < v->u.o.size; i++) {
+      lept_encode_head(c, format, LEPT_STRING, v->u.o.m[i].klen);
+      if (v->u.o.m[i].klen > 0) {
+        PUTS(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+      }
+      lept_encode_value(c, &v->u.o.m[i].v, format);
+    }
+    break;
+  }
+}
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR.
+ * 
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param length Receives the length of the encoding
+ * @return char* Encoding, to be released with free()
+ */
+char *lept_encode(const lept_value *v, lept_format format, size_t *length) {
+  lept_context c;
+  assert(v != NULL && length != NULL);
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  c.stack = (char *)lept_malloc(c.allocator,
+                                c.size = LEPT_PARSE_STRINGFY_INIT_SIZE);
+  c.top = 0;
+  lept_encode_value(&c, v, format);
+  *length = c.top;
+  /* Hand out an exactly sized block so sized deallocation sees length */
+  return (char *)lept_realloc(c.allocator, c.stack, c.size,
+                              c.top > 0 ? c.top : 1);
+}
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR into the buffer of a
+ * writer.
+ * 
+ * @param w Writer
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param length Receives the length of the encoding
+ * @return const char* Encoding, valid until the next call
+ */
+const char *lept_writer_encode(lept_writer *w, const lept_value *v,
+                               lept_format format, size_t *length) {
+  lept_context c;
+  assert(w != NULL && v != NULL && length != NULL);
+  if (w->size > w->max_retained) {
+    lept_writer_free(w);
+  }
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  c.stack = w->stack;
+  c.size = w->size;
+  c.top = 0;
+  lept_encode_value(&c, v, format);
+  *length = c.top;
+  w->stack = c.stack;
+  w->size = c.size;
+  return w->stack;
+}
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR into a caller buffer.
+ * 
+ * Nothing is allocated when the encoding fits. Otherwise encoding goes on
+ * in a temporary block, only to measure the length, like snprintf().
+ * 
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param buf Buffer
+ * @param size Size of the buffer
+ * @return size_t Length of the encoding, which is in buf only if it is at
+ * most size
+ */
+size_t lept_encode_buffer(const lept_value *v, lept_format format, char *buf,
+                          size_t size) {
+  lept_context c;
+  assert(v != NULL && (buf != NULL || size == 0));
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.top = 0;
+  if (size > 0) {
+    /* Pushing keeps a spare byte, which an encoding does not need */
+    c.stack = buf;
+    c.size = size + 1;
+    c.flags = LEPT_CONTEXT_BORROWED;
+  } else {
+    c.stack = NULL;
+    c.size = 0;
+    c.flags = 0;
+  }
+  lept_encode_value(&c, v, format);
+  if (!(c.flags & LEPT_CONTEXT_BORROWED)) {
+    lept_dealloc(c.allocator, c.stack, c.size);
+  }
+  return c.top;
+}
+
+/**
+ * @brief State of a binary decoder.
+ */
+typedef struct {
+  const unsigned char *p;   /**< Next unread byte */
+  const unsigned char *end; /**< End of the input */
+  lept_format format;       /**< Binary encoding */
+  size_t depth;             /**< Number of open arrays and maps */
+} lept_decoder;
+
+static int lept_decode_value(lept_decoder *d, lept_value *v);
+
+/**
+ * @brief Reads a big-endian unsigned integer.
+ * 
+ * @param d Decoder
+ * @param n Number of bytes
+ * @param u Receives the integer
+ * @return int LEPT_DECODE_OK or LEPT_DECODE_TRUNCATED
+ */
+static int lept_decode_be(lept_decoder *d, size_t n, unsigned long long *u) {
+  if ((size_t)(d->end - d->p) < n) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  for (*u = 0; n > 0; n--) {
+    *u = (*u << 8) | *d->p++;
+  }
+  return LEPT_DECODE_OK;
+}
+
+/**
+ * @brief Reads the head of a CBOR data item.
+ * 
+ * @param d Decoder
+ * @param major Receives the major type
+ * @param info Receives the additional information
+ * @param u Receives the argument, unset for major type 7
+ * @return int Decoding result
+ */
+static int lept_cbor_read_head(lept_decoder *d, unsigned *major,
+                               unsigned *info, unsigned long long *u) {
+  if (d->p == d->end) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  *major = *d->p >> 5;
+  *info = *d->p++ & 0x1f;
+  if (*major == 7) {
+    return LEPT_DECODE_OK;
+  }
+  if (*info < 24) {
+    *u = *info;
+    return LEPT_DECODE_OK;
+  }
+  /* Indefinite lengths and reserved values */
+  if (*info > 27) {
+    return LEPT_DECODE_UNSUPPORTED;
+  }
+  return lept_decode_be(d, (size_t)1 << (*info - 24), u);
+}
+
+/**
+ * @brief Reads the header of a string.
+ * 
+ * @param d Decoder
+ * @param len Receives the length of the string
+ * @return int Decoding result, LEPT_DECODE_INVALID_KEY if the next item is
+ * no string
+ */
+static int lept_decode_string_head(lept_decoder *d, size_t *len) {
+  unsigned long long u;
+  unsigned major, info;
+  int ret;
+  if (d->p == d->end) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  if (d->format == LEPT_CBOR) {
+    if ((*d->p >> 5) != 3) {
+      return LEPT_DECODE_INVALID_KEY;
+    }
+    if ((ret = lept_cbor_read_head(d, &major, &info, &u)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+  } else if ((*d->p & 0xe0) == 0xa0) {
+    u = *d->p++ & 0x1f;
+  } else if (*d->p >= 0xd9 && *d->p <= 0xdb) {
+    if ((ret = lept_decode_be(d, (size_t)1 << (*d->p++ - 0xd9), &u)) !=
+        LEPT_DECODE_OK) {
+      return ret;
+    }
+  } else {
+    return LEPT_DECODE_INVALID_KEY;
+  }
+  if (u > (unsigned long long)(d->end - d->p)) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  *len = (size_t)u;
+  return LEPT_DECODE_OK;
+}
+
+/**
+ * @brief Decodes the elements of an array.
+ * 
+ * @param d Decoder
+ * @param v JSON value receiving the array
+ * @param n Number of elements
+ * @return int Decoding result
+ */
+static int lept_decode_array(lept_decoder *d, lept_value *v,
+                             unsigned long long n) {
+  int ret;
+  /* Every element takes at least one byte */
+  if (n > (unsigned long long)(d->end - d->p)) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  if (d->depth == LEPT_READER_MAX_DEPTH) {
+    return LEPT_DECODE_TOO_DEEP;
+  }
+  d->depth++;
+  lept_set_array(v, (size_t)n);
+  for (size_t i = 0; i < n; i++) {
+    lept_value *e = &v->u.a.e[i];
+    lept_init(e);
+    SET_ALLOCATOR_ID(e, ALLOCATOR_ID(v));
+    if ((ret = lept_decode_value(d, e)) != LEPT_DECODE_OK) {
+      lept_free(e);
+      return ret;
+    }
+    v->u.a.size++;
+  }
+  d->depth--;
+  return LEPT_DECODE_OK;
+}
+
+/**
+ * @brief Decodes the members of a map into an object.
+ * 
+ * @param d Decoder
+ * @param v JSON value receiving the object
+ * @param n Number of members
+ * @return int Decoding result
+ */
+static int lept_decode_object(lept_decoder *d, lept_value *v,
+                              unsigned long long n) {
+  int ret;
+  /* Every member takes at least two bytes */
+  if (n > (unsigned long long)(d->end - d->p) / 2) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  if (d->depth == LEPT_READER_MAX_DEPTH) {
+    return LEPT_DECODE_TOO_DEEP;
+  }
+  d->depth++;
+  lept_set_object(v, (size_t)n);
+  for (size_t i = 0; i < n; i++) {
+    lept_member *m = &v->u.o.m[i];
+    if ((ret = lept_decode_string_head(d, &m->klen)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+    m->k = (char *)lept_malloc(ALLOCATOR_ID(v), m->klen + 1);
+    memcpy(m->k, d->p, m->klen);
+    m->k[m->klen] = '\0';
+    d->p += m->klen;
+    lept_init(&m->v);
+    SET_ALLOCATOR_ID(&m->v, ALLOCATOR_ID(v));
+    if ((ret = lept_decode_value(d, &m->v)) != LEPT_DECODE_OK) {
+      lept_free(&m->v);
+      lept_dealloc(ALLOCATOR_ID(v), m->k, m->klen + 1);
+      return ret;
+    }
+    v->u.o.size++;
+  }
+  d->depth--;
+  return LEPT_DECODE_OK;
+}
+
+/**
+ * @brief Decodes a MessagePack item.
+ * 
+ * @param d Decoder
+ * @param v JSON value receiving the item
+ * @return int Decoding result
+ */
+static int lept_msgpack_value(lept_decoder *d, lept_value *v) {
+  unsigned long long u;
+  unsigned b = *d->p;
+  size_t len;
+  int ret;
+  float f;
+  double n;
+  if (b <= 0x7f || b >= 0xe0) {
+    d->p++;
+    v->type = LEPT_NUMBER;
+    v->u.n = b <= 0x7f ? (double)b : (double)((int)b - 256);
+    return LEPT_DECODE_OK;
+  }
+  if ((b & 0xe0) == 0xa0 || (b >= 0xd9 && b <= 0xdb)) {
+    if ((ret = lept_decode_string_head(d, &len)) == LEPT_DECODE_OK) {
+      lept_set_string(v, (const char *)d->p, len);
+      d->p += len;
+    }
+    return ret;
+  }
+  d->p++;
+  if (b <= 0x8f) {
+    return lept_decode_object(d, v, b & 0x0f);
+  }
+  if (b <= 0x9f) {
+    return lept_decode_array(d, v, b & 0x0f);
+  }
+  switch (b) {
+  case 0xc0:
+    v->type = LEPT_NULL;
+    return LEPT_DECODE_OK;
+  case 0xc2:
+  case 0xc3:
+    v->type = b == 0xc2 ? LEPT_FALSE : LEPT_TRUE;
+    return LEPT_DECODE_OK;
+  case 0xca:
+  case 0xcb:
+    if ((ret = lept_decode_be(d, b == 0xca ? 4 : 8, &u)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+    if (b == 0xca) {
+      unsigned bits = (unsigned)u;
+      memcpy(&f, &bits, sizeof(f));
+      n = f;
+    } else {
+      memcpy(&n, &u, sizeof(n));
+    }
+    /* JSON has no NaN or infinity */
+    if (!isfinite(n)) {
+      return LEPT_DECODE_UNSUPPORTED;
+    }
+    v->type = LEPT_NUMBER;
+    v->u.n = n;
+    return LEPT_DECODE_OK;
+  case 0xcc:
+  case 0xcd:
+  case 0xce:
+  case 0xcf:
+    if ((ret = lept_decode_be(d, (size_t)1 << (b - 0xcc), &u)) !=
+        LEPT_DECODE_OK) {
+      return ret;
+    }
+    v->type = LEPT_NUMBER;
+    v->u.n = (double)u;
+    return LEPT_DECODE_OK;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3:
+    len = (size_t)1 << (b - 0xd0);
+    if ((ret = lept_decode_be(d, len, &u)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+    /* Sign-extend the two's complement integer */
+    if (len < 8 && (u >> (8 * len - 1)) != 0) {
+      u |= ~0ULL << (8 * len);
+    }
+    v->type = LEPT_NUMBER;
+    v->u.n = (double)(long long)u;
+    return LEPT_DECODE_OK;
+  case 0xdc:
+  case 0xdd:
+  case 0xde:
+  case 0xdf:
+    if ((ret = lept_decode_be(d, (b & 1) ? 4 : 2, &u)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+    return b <= 0xdd ? lept_decode_array(d, v, u) : lept_decode_object(d, v, u);
+  default:
+    /* Binary data, extension types and the unused 0xc1 */
+    return LEPT_DECODE_UNSUPPORTED;
+  }
+}
+
+/**
+ * @brief Decodes a CBOR data item.
+ * 
+ * @param d Decoder
+ * @param v JSON value receiving the item
+ * @return int Decoding result
+ */
+static int lept_cbor_value(lept_decoder *d, lept_value *v) {
+  unsigned long long u;
+  unsigned major, info;
+  int ret;
+  float f;
+  double n;
+  /* Tags only annotate the item that follows, so they are skipped */
+  do {
+    if ((ret = lept_cbor_read_head(d, &major, &info, &u)) != LEPT_DECODE_OK) {
+      return ret;
+    }
+  } while (major == 6);
+  switch (major) {
+  case 0:
+  case 1:
+    v->type = LEPT_NUMBER;
+    v->u.n = major == 0 ? (double)u : -1.0 - (double)u;
+    return LEPT_DECODE_OK;
+  case 3:
+    if (u > (unsigned long long)(d->end - d->p)) {
+      return LEPT_DECODE_TRUNCATED;
+    }
+    lept_set_string(v, (const char *)d->p, (size_t)u);
+    d->p += u;
+    return LEPT_DECODE_OK;
+  case 4:
+    return lept_decode_array(d, v, u);
+  case 5:
+    return lept_decode_object(d, v, u);
+  case 7:
+    switch (info) {
+    case 20:
+    case 21:
+      v->type = info == 20 ? LEPT_FALSE : LEPT_TRUE;
+      return LEPT_DECODE_OK;
+    case 22:
+    case 23:
+      /* undefined has no JSON equivalent closer than null */
+      v->type = LEPT_NULL;
+      return LEPT_DECODE_OK;
+    case 25:
+    case 26:
+    case 27:
+      if ((ret = lept_decode_be(d, (size_t)1 << (info - 24), &u)) !=
+          LEPT_DECODE_OK) {
+        return ret;
+      }
+      if (info == 25) {
+        /* Half precision: widen the exponent and mantissa to a double */
+        unsigned exp = (unsigned)(u >> 10) & 0x1f;
+        unsigned long long bits = (u & 0x8000) << 48;
+        if (exp == 0) {
+          n = (double)(u & 0x3ff) / 16777216.0;
+          n = (u & 0x8000) ? -n : n;
+        } else {
+          bits |= (unsigned long long)(exp == 31 ? 2047 : exp - 15 + 1023)
+                  << 52;
+          bits |= (u & 0x3ff) << 42;
+          memcpy(&n, &bits, sizeof(n));
+        }
+      } else if (info == 26) {
+        unsigned bits = (unsigned)u;
+        memcpy(&f, &bits, sizeof(f));
+        n = f;
+      } else {
+        memcpy(&n, &u, sizeof(n));
+      }
+      /* JSON has no NaN or infinity */
+      if (!isfinite(n)) {
+        return LEPT_DECODE_UNSUPPORTED;
+      }
+      v->type = LEPT_NUMBER;
+      v->u.n = n;
+      return LEPT_DECODE_OK;
+    default:
+      return LEPT_DECODE_UNSUPPORTED;
+    }
+  default:
+    /* Byte strings */
+    return LEPT_DECODE_UNSUPPORTED;
+  }
+}
+
+static int lept_decode_value(lept_decoder *d, lept_value *v) {
+  if (d->p == d->end) {
+    return LEPT_DECODE_TRUNCATED;
+  }
+  return d->format == LEPT_CBOR ? lept_cbor_value(d, v)
+                                : lept_msgpack_value(d, v);
+}
+
+/**
+ * @brief Decodes MessagePack or CBOR into a JSON value.
+ * 
+ * Containers are sized from their headers, so every array, object, key and
+ * string takes exactly one allocation from the allocator of v.
+ * 
+ * @param v Initialized JSON value, whose allocator is used
+ * @param data Encoded data
+ * @param len Length of the data
+ * @param format Binary encoding
+ * @return int Decoding result
+ */
+int lept_decode(lept_value *v, const char *data, size_t len,
+                lept_format format) {
+  lept_decoder d;
+  int ret;
+  assert(v != NULL && (data != NULL || len == 0));
+  lept_free(v);
+  d.p = (const unsigned char *)data;
+  d.end = d.p + len;
+  d.format = format;
+  d.depth = 0;
+  if ((ret = lept_decode_value(&d, v)) == LEPT_DECODE_OK && d.p != d.end) {
+    ret = LEPT_DECODE_TRAILING_DATA;
+  }
+  if (ret != LEPT_DECODE_OK) {
+    lept_free(v);
+  }
+  return ret;
+}
+
+/*
+ * A tape is an 8-byte header followed by the root node. Every node starts
+ * with its lept_type in one byte; integers are 64-bit little-endian and
+ * offsets are relative to the start of the node holding them:
+ *
+ *   number  bits of the double
+ *   string  length, bytes, NUL
+ *   array   size, offset of each element, elements
+ *   object  size, (key offset, value offset) of each member in document
+ *           order, member indices sorted by key, keys and values
+ *
+ * Keys are stored as length, bytes, NUL. Nothing needs alignment, so a tape
+ * can be read straight from a mapped file.
+ */
+static const char lept_tape_magic[8] = {'L', 'E', 'P', 'T', 'A', 'P', 'E', 1};
+
+/**
+ * @brief Pushes a 64-bit little-endian integer.
+ * 
+ * @param c Context for encoding
+ * @param u Integer
+ */
+static void lept_tape_put(lept_context *c, unsigned long long u) {
+  unsigned char *p = (unsigned char *)lept_context_push(c, 8);
+  for (size_t i = 0; i < 8; i++) {
+    p[i] = (unsigned char)(u >> (8 * i));
+  }
+}
+
+/**
+ * @brief Overwrites a 64-bit little-endian integer already on the stack.
+ * 
+ * @param c Context for encoding
+ * @param pos Position of the integer on the stack
+ * @param u Integer
+ */
+static void lept_tape_set(lept_context *c, size_t pos, unsigned long long u) {
+  for (size_t i = 0; i < 8; i++) {
+    c->stack[pos + i] = (char)(u >> (8 * i));
+  }
+}
+
+/**
+ * @brief Reads a 64-bit little-endian integer.
+ * 
+ * @param p Integer in the tape
+ * @return unsigned long long Integer
+ */
+static unsigned long long lept_tape_get(const char *p) {
+  unsigned long long u = 0;
+  for (size_t i = 8; i > 0; i--) {
+    u = (u << 8) | (unsigned char)p[i - 1];
+  }
+  return u;
+}
+
+/**
+ * @brief Pushes a length-prefixed, NUL-terminated string.
+ * 
+ * @param c Context for encoding
+ * @param s String
+ * @param len Length of the string
+ */
+static void lept_tape_put_string(lept_context *c, const char *s, size_t len) {
+  lept_tape_put(c, len);
+  if (len > 0) {
+    PUTS(c, s, len);
+  }
+  PUTC(c, '\0');
+}
+
+/**
+ * @brief Compares two members by key, bytewise and then by length, and
+ * duplicate keys by position so that the first one sorts first.
+ */
+static int lept_tape_compare(const void *a, const void *b) {
+  const lept_member *x = *(const lept_member *const *)a;
+  const lept_member *y = *(const lept_member *const *)b;
+  int ret = memcmp(x->k, y->k, x->klen < y->klen ? x->klen : y->klen);
+  if (ret != 0) {
+    return ret;
+  }
+  if (x->klen != y->klen) {
+    return x->klen < y->klen ? -1 : 1;
+  }
+  return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Pushes a number node.
+ * 
+ * @param c Context for encoding
+ * @param n Number
+ */
+static void lept_tape_number(lept_context *c, double n) {
+  unsigned long long bits;
+  PUTC(c, (char)LEPT_NUMBER);
+  memcpy(&bits, &n, sizeof(bits));
+  lept_tape_put(c, bits);
+}
+
+/**
+ * @brief Serializes a JSON value onto the context stack as a tape node.
+ * 
+ * @param c Context for encoding
+ * @param v JSON value
+ */
+static void lept_tape_value(lept_context *c, const lept_value *v) {
+  size_t i, node = c->top, table;
+  MATERIALIZE(v);
+  if (v->type == LEPT_NUMBER) {
+    lept_tape_number(c, v->u.n);
+    return;
+  }
+  PUTC(c, (char)v->type);
+  switch (v->type) {
+  case LEPT_STRING:
+    lept_tape_put_string(c, v->u.s.s, v->u.s.len);
+    break;
+  case LEPT_ARRAY:
+    lept_tape_put(c, v->u.a.size);
+    table = c->top;
+    if (v->u.a.size > 0) {
+      lept_context_push(c, 8 * v->u.a.size);
+    }
+    for (i = 0; i < v->u.a.size; i++) {
+      double n;
+      lept_tape_set(c, table + 8 * i, c->top - node);
+      if (lept_array_number_at(v, i, &n)) {
+        lept_tape_number(c, n);
+      } else {
+        lept_tape_value(c, &v->u.a.e[i]);
+      }
+    }
+    break;
+  case LEPT_OBJECT: {
+    const lept_member **sorted;
+    lept_tape_put(c, v->u.o.size);
+    table = c->top;
+    if (v->u.o.size > 0) {
+      lept_context_push(c, 24 * v->u.o.size);
+      sorted = (const lept_member **)lept_malloc(
+          c->allocator, v->u.o.size * sizeof(*sorted));
+      for (i = 0; i < v->u.o.size; i++) {
+        sorted[i] = &v->u.o.m[i];
+      }
+      qsort(sorted, v->u.o.size, sizeof(*sorted), lept_tape_compare);
+      for (i = 0; i < v->u.o.size; i++) {
+        lept_tape_set(c, table + 16 * v->u.o.size + 8 * i,
+                      (size_t)(sorted[i] - v->u.o.m));
+      }
+      lept_dealloc(c->allocator, sorted, v->u.o.size * sizeof(*sorted));
+    }
+    for (i = 0; i < v->u.o.size; i++) {
+      lept_tape_set(c, table + 16 * i, c->top - node);
+      lept_tape_put_string(c, v->u.o.m[i].k, v->u.o.m[i].klen);
+      lept_tape_set(c, table + 16 * i + 8, c->top - node);
+      lept_tape_value(c, &v->u.o.m[i].v);
+    }
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+/**
+ * @brief Serializes a JSON value as a binary tape, which can be read in
+ * place with the lept_tape_* accessors.
+ * 
+ * The tape comes from the default allocator, like lept_stringify() output.
+ * 
+ * @param v JSON value
+ * @param length Receives the length of the tape
+ * @return char* Tape, to be released with the default allocator
+ */
+char *lept_tape_encode(const lept_value *v, size_t *length) {
+  lept_context c;
+  assert(v != NULL && length != NULL);
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  c.stack = (char *)lept_malloc(c.allocator,
+                                c.size = LEPT_PARSE_STRINGFY_INIT_SIZE);
+  c.top = 0;
+  PUTS(&c, lept_tape_magic, sizeof(lept_tape_magic));
+  lept_tape_value(&c, v);
+  *length = c.top;
+  return (char *)lept_realloc(c.allocator, c.stack, c.size, c.top);
+}
+
+/**
+ * @brief Checks a length-prefixed, NUL-terminated string of a tape.
+ * 
+ * @param tape Tape
+ * @param length Length of the tape
+ * @param pos Position of the string, at most length
+ * @return size_t Position after the string, or 0 if it is out of bounds
+ */
+static size_t lept_tape_check_string(const char *tape, size_t length,
+                                     size_t pos) {
+  unsigned long long len;
+  if (length - pos < 9) {
+    return 0;
+  }
+  len = lept_tape_get(tape + pos);
+  if (len > length - pos - 9 || tape[pos + 8 + len] != '\0') {
+    return 0;
+  }
+  return pos + 9 + (size_t)len;
+}
+
+/**
+ * @brief Checks that a tape node and its children lie inside the tape.
+ * 
+ * Children must follow each other in the order lept_tape_encode() writes
+ * them, which keeps the check linear: no offset can point back into data
+ * that was already checked.
+ * 
+ * @param tape Tape
+ * @param length Length of the tape
+ * @param pos Position of the node
+ * @param depth Number of enclosing containers
+ * @return size_t Position after the node, or 0 if it is invalid
+ */
+static size_t lept_tape_check(const char *tape, size_t length, size_t pos,
+                              size_t depth) {
+  size_t node = pos, table, width;
+  unsigned long long size, i;
+  if (pos >= length) {
+    return 0;
+  }
+  switch (tape[pos]) {
+  case LEPT_NULL:
+  case LEPT_FALSE:
+  case LEPT_TRUE:
+    return pos + 1;
+  case LEPT_NUMBER:
+    return length - pos < 9 ? 0 : pos + 9;
+  case LEPT_STRING:
+    return lept_tape_check_string(tape, length, pos + 1);
+  case LEPT_ARRAY:
+  case LEPT_OBJECT:
+    width = tape[pos] == LEPT_ARRAY ? 8 : 24;
+    if (depth == LEPT_READER_MAX_DEPTH || length - pos < 9) {
+      return 0;
+    }
+    size = lept_tape_get(tape + pos + 1);
+    if (size > (length - pos - 9) / width) {
+      return 0;
+    }
+    table = pos + 9;
+    pos = table + width * (size_t)size;
+    for (i = 0; i < size; i++) {
+      if (width == 24) {
+        if (lept_tape_get(tape + table + 16 * i) != pos - node ||
+            lept_tape_get(tape + table + 16 * size + 8 * i) >= size ||
+            (pos = lept_tape_check_string(tape, length, pos)) == 0) {
+          return 0;
+        }
+      }
+      if (lept_tape_get(tape + table + (width == 24 ? 16 * i + 8 : 8 * i)) !=
+              pos - node ||
+          (pos = lept_tape_check(tape, length, pos, depth + 1)) == 0) {
+        return 0;
+      }
+    }
+    return pos;
+  default:
+    return 0;
+  }
+}
+
+/**
+ * @brief Checks a tape and returns its root node.
+ * 
+ * Besides the header, every length and offset is checked against the size
+ * of the tape once, so the accessors never read outside of it afterwards.
+ * 
+ * @param tape Tape, e.g. mapped by lept_file_map()
+ * @param length Length of the tape
+ * @return const char* Root node, or NULL if the tape is invalid
+ */
+const char *lept_tape_root(const char *tape, size_t length) {
+  assert(tape != NULL || length == 0);
+  if (length <= sizeof(lept_tape_magic) ||
+      memcmp(tape, lept_tape_magic, sizeof(lept_tape_magic)) != 0 ||
+      lept_tape_check(tape, length, sizeof(lept_tape_magic), 0) != length) {
+    return NULL;
+  }
+  return tape + sizeof(lept_tape_magic);
+}
+
+/**
+ * @brief Gets the type of a tape node.
+ * 
+ * @param node Node
+ * @return lept_type Type
+ */
+lept_type lept_tape_get_type(const char *node) {
+  assert(node != NULL);
+  return (lept_type)(unsigned char)node[0];
+}
+
+/**
+ * @brief Gets the boolean value of a tape node.
+ * 
+ * @param node Boolean node
+ * @return int Boolean value (0 or 1)
+ */
+int lept_tape_get_boolean(const char *node) {
+  assert(node != NULL && (node[0] == LEPT_TRUE || node[0] == LEPT_FALSE));
+  return node[0] == LEPT_TRUE;
+}
+
+/**
+ * @brief Gets the number value of a tape node.
+ * 
+ * @param node Number node
+ * @return double Number
+ */
+double lept_tape_get_number(const char *node) {
+  unsigned long long bits;
+  double n;
+  assert(node != NULL && node[0] == LEPT_NUMBER);
+  bits = lept_tape_get(node + 1);
+  memcpy(&n, &bits, sizeof(n));
+  return n;
+}
+
+/**
+ * @brief Gets the string of a tape node.
+ * 
+ * @param node String node
+ * @return const char* NUL-terminated string inside the tape
+ */
+const char *lept_tape_get_string(const char *node) {
+  assert(node != NULL && node[0] == LEPT_STRING);
+  return node + 9;
+}
+
+/**
+ * @brief Gets the length of the string of a tape node.
+ * 
+ * @param node String node
+ * @return size_t Length
+ */
+size_t lept_tape_get_string_length(const char *node) {
+  assert(node != NULL && node[0] == LEPT_STRING);
+  return (size_t)lept_tape_get(node + 1);
+}
+
+/**
+ * @brief Gets the size of an array node.
+ * 
+ * @param node Array node
+ * @return size_t Number of elements
+ */
+size_t lept_tape_get_array_size(const char *node) {
+  assert(node != NULL && node[0] == LEPT_ARRAY);
+  return (size_t)lept_tape_get(node + 1);
+}
+
+/**
+ * @brief Gets an element of an array node.
+ * 
+ * @param node Array node
+ * @param index Index
+ * @return const char* Element node
+ */
+const char *lept_tape_get_array_element(const char *node, size_t index) {
+  assert(index < lept_tape_get_array_size(node));
+  return node + lept_tape_get(node + 9 + 8 * index);
+}
+
+/**
+ * @brief Gets the size of an object node.
+ * 
+ * @param node Object node
+ * @return size_t Number of members
+ */
+size_t lept_tape_get_object_size(const char *node) {
+  assert(node != NULL && node[0] == LEPT_OBJECT);
+  return (size_t)lept_tape_get(node + 1);
+}
+
+/**
+ * @brief Gets a key of an object node, in document order.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return const char* NUL-terminated key inside the tape
+ */
+const char *lept_tape_get_object_key(const char *node, size_t index) {
+  assert(index < lept_tape_get_object_size(node));
+  return node + lept_tape_get(node + 9 + 16 * index) + 8;
+}
+
+/**
+ * @brief Gets the length of a key of an object node.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return size_t Length
+ */
+size_t lept_tape_get_object_key_length(const char *node, size_t index) {
+  assert(index < lept_tape_get_object_size(node));
+  return (size_t)lept_tape_get(node + lept_tape_get(node + 9 + 16 * index));
+}
+
+/**
+ * @brief Gets a value of an object node, in document order.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return const char* Value node
+ */
+const char *lept_tape_get_object_value(const char *node, size_t index) {
+  assert(index < lept_tape_get_object_size(node));
+  return node + lept_tape_get(node + 9 + 16 * index + 8);
+}
+
+/**
+ * @brief Finds the value of a key in an object node by binary search.
+ * 
+ * The search looks for the lowest sorted position of the key, so that the
+ * first of duplicate keys is found, as lept_find_object_value() does.
+ * 
+ * @param node Object node
+ * @param key Key
+ * @param klen Length of the key
+ * @return const char* Value node, or NULL if the key is absent
+ */
+const char *lept_tape_find_object_value(const char *node, const char *key,
+                                        size_t klen) {
+  size_t size = lept_tape_get_object_size(node), lo = 0, hi = size;
+  const char *sorted = node + 9 + 16 * size;
+  assert(key != NULL || klen == 0);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    size_t index = (size_t)lept_tape_get(sorted + 8 * mid);
+    size_t len = lept_tape_get_object_key_length(node, index);
+    int ret = memcmp(lept_tape_get_object_key(node, index), key,
+                     len < klen ? len : klen);
+    if (ret == 0) {
+      ret = len < klen ? -1 : len > klen;
+    }
+    if (ret < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < size) {
+    size_t index = (size_t)lept_tape_get(sorted + 8 * lo);
+    if (lept_tape_get_object_key_length(node, index) == klen &&
+        memcmp(lept_tape_get_object_key(node, index), key, klen) == 0) {
+      return lept_tape_get_object_value(node, index);
+    }
+  }
+  return NULL;
+}
+
+/**
+ * @brief Compiles a JSON Pointer (RFC 6901).
+ * 
+ * Reference tokens are unescaped once into a single buffer and tokens that
+ * are valid array indices are converted to numbers.
+ * 
+ * @param p Pointer to be compiled
+ * @param path JSON Pointer string, e.g. "/a/b/3/c"
+ * @param len Length of the string
+ * @param flags LEPT_POINTER_CACHE to remember the member index of each step
+ * @return int LEPT_POINTER_OK or an error code
+ */
+int lept_pointer_compile(lept_pointer *p, const char *path, size_t len,
+                         int flags) {
+  size_t i, count = 0;
+  char *k;
+  assert(p != NULL && (path != NULL || len == 0));
+  p->tokens = NULL;
+  p->count = 0;
+  p->flags = flags;
+  p->keys = NULL;
+  p->size = 0;
+  if (len == 0) {
+    return LEPT_POINTER_OK;
+  }
+  if (path[0] != '/') {
+    return LEPT_POINTER_MISS_SLASH;
+  }
+  for (i = 0; i < len; i++) {
+    if (path[i] == '/') {
+      count++;
+    } else if (path[i] == '~' &&
+               (i + 1 == len || (path[i + 1] != '0' && path[i + 1] != '1'))) {
+      return LEPT_POINTER_INVALID_ESCAPE;
+    }
+  }
+  /* Unescaped keys are never longer than the path, plus a NUL per token */
+  p->size = len + count;
+  p->keys = k = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, p->size);
+  p->tokens = (lept_pointer_token *)lept_malloc(
+      LEPT_DEFAULT_ALLOCATOR, count * sizeof(lept_pointer_token));
+  p->count = count;
+  for (i = 1, count = 0; count < p->count; count++) {
+    lept_pointer_token *t = &p->tokens[count];
+    t->key = k;
+    for (; i < len && path[i] != '/'; i++) {
+      if (path[i] == '~') {
+        *k++ = path[++i] == '0' ? '~' : '/';
+      } else {
+        *k++ = path[i];
+      }
+    }
+    i++; /* skip '/' */
+    t->klen = (size_t)(k - t->key);
+    *k++ = '\0';
+    t->cache = LEPT_KEY_NOT_EXIST;
+    t->index = LEPT_KEY_NOT_EXIST;
+    if (t->klen == 1 && t->key[0] == '-') {
+      t->index = LEPT_POINTER_END;
+    } else if (t->klen > 0 && ISDIGIT(t->key[0]) &&
+               (t->key[0] != '0' || t->klen == 1)) {
+      size_t j, index = 0;
+      for (j = 0; j < t->klen && ISDIGIT(t->key[j]); j++) {
+        if (index > (LEPT_POINTER_END - 1 - (t->key[j] - '0')) / 10) {
+          break; /* too large to be an index */
+        }
+        index = index * 10 + (t->key[j] - '0');
+      }
+      if (j == t->klen) {
+        t->index = index;
+      }
+    }
+  }
+  return LEPT_POINTER_OK;
+}
+
+/**
+ * @brief Evaluates the first tokens of a compiled JSON Pointer.
+ * 
+ * With LEPT_POINTER_CACHE, the member index found at each step is tried
+ * first on the next evaluation, so documents of the same shape resolve
+ * without scanning object members. The cached index is only trusted on
+ * frozen objects known to have distinct keys; elsewhere an earlier member
+ * with the same key may exist, and the first one must win.
+ * 
+ * Elements of packed arrays are read through the view when one is given,
+ * which leaves the document untouched; otherwise the array is unpacked so
+ * that the element can be modified.
+ * 
+ * @param p Compiled pointer
+ * @param v JSON value
+ * @param count Number of tokens to follow
+ * @param view Receives a packed element, or NULL to unpack the array
+ * @return lept_value* Referenced value, or NULL if it does not exist
+ */
+static lept_value *lept_pointer_walk(lept_pointer *p, const lept_value *v,
+                                     size_t count, lept_value *view) {
+  size_t i;
+  for (i = 0; i < count; i++) {
+    lept_pointer_token *t = &p->tokens[i];
+    MATERIALIZE(v);
+    if (v->type == LEPT_OBJECT) {
+      size_t index = t->cache;
+      if (!IS_UNIQUE(v) || index >= v->u.o.size ||
+          v->u.o.m[index].klen != t->klen ||
+          memcmp(v->u.o.m[index].k, t->key, t->klen) != 0) {
+        index = lept_find_object_index(v, t->key, t->klen);
+        if (index == LEPT_KEY_NOT_EXIST) {
+          return NULL;
+        }
+        if (p->flags & LEPT_POINTER_CACHE) {
+          t->cache = index;
+        }
+      }
+      v = &v->u.o.m[index].v;
+    } else if (v->type == LEPT_ARRAY) {
+      if (t->index >= v->u.a.size) {
+        return NULL;
+      }
+      v = view != NULL ? lept_view_array_element(v, t->index, view)
+                       : lept_get_array_element(v, t->index);
+    } else {
+      return NULL;
+    }
+  }
+  return (lept_value *)v;
+}
+
+/**
+ * @brief Evaluates a compiled JSON Pointer against a JSON value.
+ * 
+ * @param p Compiled pointer
+ * @param v JSON value
+ * @return lept_value* Referenced value, or NULL if it does not exist
+ */
+lept_value *lept_pointer_get(lept_pointer *p, const lept_value *v) {
+  assert(p != NULL && v != NULL);
+  return lept_pointer_walk(p, v, p->count, NULL);
+}
+
+/**
+ * @brief Frees a compiled JSON Pointer.
+ * 
+ * @param p Compiled pointer
+ */
+void lept_pointer_free(lept_pointer *p) {
+  assert(p != NULL);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->keys, p->size);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->tokens,
+               p->count * sizeof(lept_pointer_token));
+  p->tokens = NULL;
+  p->keys = NULL;
+  p->count = 0;
+  p->size = 0;
+}
+
+/**
+ * @brief Initializes an empty projection, which selects nothing.
+ * 
+ * @param p Projection
+ */
+void lept_projection_init(lept_projection *p) {
+  assert(p != NULL);
+  p->key = NULL;
+  p->klen = 0;
+  p->index = LEPT_KEY_NOT_EXIST;
+  p->children = NULL;
+  p->size = 0;
+  p->capacity = 0;
+  p->keep = 0;
+}
+
+/**
+ * @brief Adds a path to keep to a projection.
+ * 
+ * @param p Projection
+ * @param path JSON Pointer of the value to keep, "*" matching any token
+ * @param len Length of the path
+ * @return int LEPT_POINTER_OK or an error code
+ */
+int lept_projection_add(lept_projection *p, const char *path, size_t len) {
+  lept_pointer pointer;
+  int ret;
+  assert(p != NULL);
+  if ((ret = lept_pointer_compile(&pointer, path, len, 0)) != LEPT_POINTER_OK) {
+    return ret;
+  }
+  for (size_t i = 0; i < pointer.count && !p->keep; i++) {
+    const lept_pointer_token *t = &pointer.tokens[i];
+    lept_projection *child = NULL;
+    for (size_t j = 0; j < p->size; j++) {
+      if (p->children[j].klen == t->klen &&
+          memcmp(p->children[j].key, t->key, t->klen) == 0) {
+        child = &p->children[j];
+        break;
+      }
+    }
+    if (child == NULL) {
+      if (p->size == p->capacity) {
+        size_t capacity = lept_grow_capacity(p->capacity, p->size + 1);
+        p->children = (lept_projection *)lept_realloc(
+            LEPT_DEFAULT_ALLOCATOR, p->children,
+            p->capacity * sizeof(lept_projection),
+            capacity * sizeof(lept_projection));
+        p->capacity = capacity;
+      }
+      child = &p->children[p->size++];
+      lept_projection_init(child);
+      child->key = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, t->klen + 1);
+      memcpy(child->key, t->key, t->klen + 1);
+      child->klen = t->klen;
+      child->index = t->index;
+    }
+    p = child;
+  }
+  /* A kept value is parsed whole, so deeper paths no longer matter */
+  p->keep = 1;
+  lept_pointer_free(&pointer);
+  return LEPT_POINTER_OK;
+}
+
+/**
+ * @brief Frees a projection.
+ * 
+ * @param p Projection
+ */
+void lept_projection_free(lept_projection *p) {
+  assert(p != NULL);
+  for (size_t i = 0; i < p->size; i++) {
+    lept_projection_free(&p->children[i]);
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->children,
+               p->capacity * sizeof(lept_projection));
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->key, p->klen + 1);
+  lept_projection_init(p);
+}
+
+/**
+ * @brief Initializes a JSONPath step.
+ * 
+ * @param step Step to be initialized
+ * @param type Type of the step
+ * @param descendant Whether the step follows ".."
+ */
+static void lept_path_step_init(lept_path_step *step, int type,
+                                int descendant) {
+  step->type = type;
+  step->descendant = descendant;
+  step->key = NULL;
+  step->klen = 0;
+  step->index = LEPT_KEY_NOT_EXIST;
+  step->field.tokens = NULL;
+  step->field.count = 0;
+  step->field.flags = 0;
+  step->field.keys = NULL;
+  step->field.size = 0;
+  step->op = LEPT_PATH_EXISTS;
+  lept_init(&step->operand);
+}
+
+/**
+ * @brief Frees a JSONPath step.
+ * 
+ * @param step Step to be freed
+ */
+static void lept_path_step_free(lept_path_step *step) {
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, step->key, step->klen + 1);
+  lept_pointer_free(&step->field);
+  lept_free(&step->operand);
+}
+
+/**
+ * @brief Reads a quoted string of a JSONPath expression.
+ * 
+ * A backslash makes the next character literal.
+ * 
+ * @param e Pointer to the opening quote
+ * @param s Receives the string, allocated with the default allocator
+ * @param len Receives the length of the string
+ * @return const char* Pointer past the closing quote, or NULL
+ */
+static const char *lept_path_quoted(const char *e, char **s, size_t *len) {
+  char quote = *e++;
+  const char *p;
+  size_t n = 0;
+  for (p = e; *p != quote; p++) {
+    if (*p == '\0' || (*p == '\\' && *++p == '\0')) {
+      return NULL;
+    }
+  }
+  *s = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, (size_t)(p - e) + 1);
+  for (; e < p; e++) {
+    if (*e == '\\') {
+      e++;
+    }
+    (*s)[n++] = *e;
+  }
+  (*s)[n] = '\0';
+  *len = n;
+  return p + 1;
+}
+
+/**
+ * @brief Reads a member name or '*' following '.' or "..".
+ * 
+ * @param e Pointer to the name
+ * @param step Step to be filled in
+ * @param end Characters ending the name besides '.', '[' and NUL
+ * @return const char* Pointer past the name, or NULL if it is empty
+ */
+static const char *lept_path_name(const char *e, lept_path_step *step,
+                                  const char *end) {
+  const char *p = e;
+  if (*e == '*') {
+    step->type = LEPT_PATH_WILDCARD;
+    return e + 1;
+  }
+  while (*p != '\0' && *p != '.' && *p != '[' && strchr(end, *p) == NULL) {
+    p++;
+  }
+  if (p == e) {
+    return NULL;
+  }
+  step->klen = (size_t)(p - e);
+  step->key = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, step->klen + 1);
+  memcpy(step->key, e, step->klen);
+  step->key[step->klen] = '\0';
+  return p;
+}
+
+/**
+ * @brief Compiles the "?(@.field op literal)" part of a filter step.
+ * 
+ * @param e Pointer to the '?'
+ * @param step Step to be filled in
+ * @return const char* Pointer past the closing parenthesis, or NULL
+ */
+static const char *lept_path_filter_compile(const char *e,
+                                            lept_path_step *step) {
+  static const char *const ops[] = {"==", "!=", "<=", ">=", "<", ">"};
+  static const int codes[] = {LEPT_PATH_EQ, LEPT_PATH_NE, LEPT_PATH_LE,
+                              LEPT_PATH_GE, LEPT_PATH_LT, LEPT_PATH_GT};
+  const char *end = " )=!<>";
+  size_t size = 0, capacity, i, len;
+  char *pointer, *s;
+  if (e[0] != '?' || e[1] != '(' || e[2] != '@') {
+    return NULL;
+  }
+  e += 3;
+  /* The field becomes a JSON Pointer, where '~' and '/' need two bytes */
+  capacity = 2 * strlen(e) + 1;
+  pointer = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, capacity);
+  while (*e == '.') {
+    const char *p = ++e;
+    while (*p != '\0' && *p != '.' && strchr(end, *p) == NULL) {
+      p++;
+    }
+    if (p == e) {
+      break;
+    }
+    pointer[size++] = '/';
+    for (; e < p; e++) {
+      if (*e == '~' || *e == '/') {
+        pointer[size++] = '~';
+        pointer[size++] = *e == '~' ? '0' : '1';
+      } else {
+        pointer[size++] = *e;
+      }
+    }
+  }
+  lept_pointer_compile(&step->field, pointer, size, 0);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, pointer, capacity);
+  while (*e == ' ') {
+    e++;
+  }
+  if (*e == ')') {
+    return e + 1;
+  }
+  for (i = 0; i < sizeof(codes) / sizeof(codes[0]); i++) {
+    if (strncmp(e, ops[i], strlen(ops[i])) == 0) {
+      break;
+    }
+  }
+  if (i == sizeof(codes) / sizeof(codes[0])) {
+    return NULL;
+  }
+  step->op = codes[i];
+  e += strlen(ops[i]);
+  while (*e == ' ') {
+    e++;
+  }
+  if (*e == '\'' || *e == '"') {
+    if ((e = lept_path_quoted(e, &s, &len)) == NULL) {
+      return NULL;
+    }
+    lept_set_string(&step->operand, s, len);
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, s, len + 1);
+  } else if (strncmp(e, "true", 4) == 0 || strncmp(e, "false", 5) == 0 ||
+             strncmp(e, "null", 4) == 0) {
+    lept_set_boolean(&step->operand, *e == 't');
+    if (*e == 'n') {
+      lept_free(&step->operand);
+    }
+    e += *e == 'f' ? 5 : 4;
+  } else {
+    const char *p = lept_scan_number(e);
+    if (p == NULL) {
+      return NULL;
+    }
+    lept_set_number(&step->operand, strtod(e, NULL));
+    e = p;
+  }
+  while (*e == ' ') {
+    e++;
+  }
+  return *e == ')' ? e + 1 : NULL;
+}
+
+/**
+ * @brief Compiles the bracketed part of a step.
+ * 
+ * @param e Pointer past the '['
+ * @param step Step to be filled in
+ * @return const char* Pointer past the closing bracket, or NULL
+ */
+static const char *lept_path_bracket(const char *e, lept_path_step *step) {
+  if (*e == '*') {
+    step->type = LEPT_PATH_WILDCARD;
+    e++;
+  } else if (*e == '\'' || *e == '"') {
+    e = lept_path_quoted(e, &step->key, &step->klen);
+  } else if (ISDIGIT(*e)) {
+    step->type = LEPT_PATH_INDEX;
+    step->index = 0;
+    while (ISDIGIT(*e)) {
+      if (step->index > ((size_t)-1 - (size_t)(*e - '0')) / 10) {
+        return NULL; /* too large to be an index */
+      }
+      step->index = step->index * 10 + (size_t)(*e++ - '0');
+    }
+  } else if (*e == '?') {
+    step->type = LEPT_PATH_FILTER;
+    e = lept_path_filter_compile(e, step);
+  } else {
+    return NULL;
+  }
+  return e != NULL && *e == ']' ? e + 1 : NULL;
+}
+
+/**
+ * @brief Compiles a JSONPath expression into a reusable plan.
+ * 
+ * @param p Plan to be compiled
+ * @param expr JSONPath expression
+ * @return int LEPT_PATH_OK or an error code
+ */
+int lept_path_compile(lept_path *p, const char *expr) {
+  const char *e = expr;
+  size_t capacity = 0;
+  assert(p != NULL && expr != NULL);
+  p->steps = NULL;
+  p->count = 0;
+  if (*e++ != '$') {
+    return LEPT_PATH_MISS_ROOT;
+  }
+  while (*e != '\0') {
+    lept_path_step *step;
+    int dotted = *e == '.';
+    if (p->count == capacity) {
+      size_t size = lept_grow_capacity(capacity, p->count + 1);
+      p->steps = (lept_path_step *)lept_realloc(
+          LEPT_DEFAULT_ALLOCATOR, p->steps, capacity * sizeof(lept_path_step),
+          size * sizeof(lept_path_step));
+      capacity = size;
+    }
+    step = &p->steps[p->count++];
+    lept_path_step_init(step, LEPT_PATH_KEY, dotted && e[1] == '.');
+    e += dotted + step->descendant;
+    if (dotted && *e != '[') {
+      e = lept_path_name(e, step, "");
+    } else if (*e == '[') {
+      e = lept_path_bracket(e + 1, step);
+    } else {
+      e = NULL;
+    }
+    if (e == NULL) {
+      int ret = step->type == LEPT_PATH_FILTER ? LEPT_PATH_INVALID_FILTER
+                                               : LEPT_PATH_INVALID_STEP;
+      for (size_t i = 0; i < p->count; i++) {
+        lept_path_step_free(&p->steps[i]);
+      }
+      lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->steps,
+                   capacity * sizeof(lept_path_step));
+      p->steps = NULL;
+      p->count = 0;
+      return ret;
+    }
+  }
+  /* Plans are kept for a long time, so drop the growth slack */
+  if (capacity > p->count) {
+    p->steps = (lept_path_step *)lept_realloc(
+        LEPT_DEFAULT_ALLOCATOR, p->steps, capacity * sizeof(lept_path_step),
+        p->count * sizeof(lept_path_step));
+  }
+  return LEPT_PATH_OK;
+}
+
+/**
+ * @brief State of a JSONPath evaluation.
+ * 
+ * The states of a value are the indices of the steps still to be applied to
+ * its children; a value whose states include the step count is a match.
+ * State sets live on a scratch stack, one set per depth.
+ */
+typedef struct {
+  const lept_path *p;             /**< Plan being evaluated */
+  lept_context states;            /**< Scratch stack of state sets */
+  lept_path_callback cb;          /**< Callback for tree matches */
+  lept_path_view_callback view;   /**< Callback for text matches */
+  void *ctx;                      /**< User data passed to the callback */
+  size_t count;                   /**< Number of matches so far */
+  int stop;                       /**< Set once a callback asks to stop */
+} lept_path_state;
+
+/**
+ * @brief Evaluates a filter step against a value.
+ * 
+ * @param step Filter step
+ * @param v JSON value
+ * @return int 1 if the value passes the filter, 0 otherwise
+ */
+static int lept_path_filter(const lept_path_step *step, const lept_value *v) {
+  lept_value view;
+  const lept_value *f =
+      lept_pointer_walk((lept_pointer *)&step->field, v, step->field.count,
+                        &view);
+  const lept_value *o = &step->operand;
+  int cmp;
+  if (f == NULL) {
+    return 0;
+  }
+  switch (step->op) {
+  case LEPT_PATH_EXISTS:
+    return 1;
+  case LEPT_PATH_EQ:
+    return lept_is_equal(f, o);
+  case LEPT_PATH_NE:
+    return !lept_is_equal(f, o);
+  default:
+    break;
+  }
+  if (f->type == LEPT_NUMBER && o->type == LEPT_NUMBER) {
+    double l = lept_get_number(f), r = o->u.n;
+    cmp = l < r ? -1 : l > r;
+  } else if (f->type == LEPT_STRING && o->type == LEPT_STRING) {
+    size_t l = lept_get_string_length(f), r = o->u.s.len;
+    if ((cmp = memcmp(f->u.s.s, o->u.s.s, l < r ? l : r)) == 0) {
+      cmp = l < r ? -1 : l > r;
+    }
+  } else {
+    return 0;
+  }
+  switch (step->op) {
+  case LEPT_PATH_LT:
+    return cmp < 0;
+  case LEPT_PATH_LE:
+    return cmp <= 0;
+  case LEPT_PATH_GT:
+    return cmp > 0;
+  default:
+    return cmp >= 0;
+  }
+}
+
+/**
+ * @brief Checks whether any of a set of states is a filter step.
+ * 
+ * @param s Evaluation state
+ * @param head Offset of the state set
+ * @param n Number of states
+ * @return int 1 if a filter needs the child value, 0 otherwise
+ */
+static int lept_path_needs_value(lept_path_state *s, size_t head, size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    size_t state = PATH_STATE(s, head, i);
+    if (state < s->p->count &&
+        s->p->steps[state].type == LEPT_PATH_FILTER) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * @brief Adds a state to the set being built, ignoring duplicates.
+ * 
+ * @param s Evaluation state
+ * @param head Offset of the set
+ * @param n Number of states in the set
+ * @param state State to be added
+ * @return size_t New number of states
+ */
+static size_t lept_path_add_state(lept_path_state *s, size_t head, size_t n,
+                                  size_t state) {
+  for (size_t i = 0; i < n; i++) {
+    if (PATH_STATE(s, head, i) == state) {
+      return n;
+    }
+  }
+  *(size_t *)lept_context_push(&s->states, sizeof(size_t)) = state;
+  return n + 1;
+}
+
+/**
+ * @brief Pushes the state set of a child.
+ * 
+ * @param s Evaluation state
+ * @param head Offset of the state set of the parent
+ * @param n Number of states of the parent
+ * @param key Member key, or NULL for an array element
+ * @param klen Length of the key, or the element index
+ * @param child Child value, needed only by filters
+ * @return size_t Number of states of the child, pushed on top
+ */
+static size_t lept_path_child_states(lept_path_state *s, size_t head,
+                                     size_t n, const char *key, size_t klen,
+                                     const lept_value *child) {
+  size_t top = s->states.top, m = 0;
+  for (size_t i = 0; i < n; i++) {
+    size_t state = PATH_STATE(s, head, i);
+    const lept_path_step *step;
+    int match;
+    if (state == s->p->count) {
+      continue;
+    }
+    step = &s->p->steps[state];
+    switch (step->type) {
+    case LEPT_PATH_KEY:
+      match = key != NULL && step->klen == klen &&
+              memcmp(step->key, key, klen) == 0;
+      break;
+    case LEPT_PATH_INDEX:
+      match = key == NULL && step->index == klen;
+      break;
+    case LEPT_PATH_WILDCARD:
+      match = 1;
+      break;
+    default:
+      match = lept_path_filter(step, child);
+      break;
+    }
+    if (match) {
+      m = lept_path_add_state(s, top, m, state + 1);
+    }
+    if (step->descendant) {
+      m = lept_path_add_state(s, top, m, state);
+    }
+  }
+  return m;
+}
+
+/**
+ * @brief Evaluates the state set of a value over a parsed tree.
+ * 
+ * @param s Evaluation state
+ * @param v JSON value
+ * @param head Offset of the state set of the value
+ * @param n Number of states
+ */
+static void lept_path_walk(lept_path_state *s, const lept_value *v,
+                           size_t head, size_t n) {
+  size_t i, m, top = s->states.top;
+  int filter = lept_path_needs_value(s, head, n);
+  for (i = 0; i < n; i++) {
+    if (PATH_STATE(s, head, i) == s->p->count) {
+      s->count++;
+      if (s->cb(s->ctx, v) != 0) {
+        s->stop = 1;
+        return;
+      }
+      break;
+    }
+  }
+  if (v->type == LEPT_ARRAY) {
+    size_t size = lept_get_array_size(v);
+    for (i = 0; i < size && !s->stop; i++) {
+      lept_value view;
+      /* Only fetch the element when a filter needs it */
+      const lept_value *e =
+          filter ? lept_view_array_element(v, i, &view) : NULL;
+      if ((m = lept_path_child_states(s, head, n, NULL, i, e)) > 0) {
+        lept_path_walk(s, e != NULL ? e : lept_view_array_element(v, i, &view),
+                       top, m);
+      }
+      s->states.top = top;
+    }
+  } else if (v->type == LEPT_OBJECT) {
+    size_t size = lept_get_object_size(v);
+    for (i = 0; i < size && !s->stop; i++) {
+      const lept_member *member = &v->u.o.m[i];
+      if ((m = lept_path_child_states(s, head, n, member->k, member->klen,
+                                      &member->v)) > 0) {
+        lept_path_walk(s, &member->v, top, m);
+      }
+      s->states.top = top;
+    }
+  }
+}
+
+/**
+ * @brief Prepares the evaluation state with the initial state set.
+ * 
+ * @param s Evaluation state
+ * @param p Compiled plan
+ */
+static void lept_path_begin(lept_path_state *s, const lept_path *p) {
+  s->p = p;
+  s->states.json = NULL;
+  s->states.stack = NULL;
+  s->states.size = 0;
+  s->states.top = 0;
+  s->states.allocator = LEPT_DEFAULT_ALLOCATOR;
+  s->states.flags = 0;
+  s->count = 0;
+  s->stop = 0;
+  *(size_t *)lept_context_push(&s->states, sizeof(size_t)) = 0;
+}
+
+/**
+ * @brief Evaluates a compiled JSONPath plan over a parsed tree.
+ * 
+ * @param p Compiled plan
+ * @param v Root JSON value
+ * @param cb Called with each match in document order; a non-zero return
+ * stops the evaluation
+ * @param ctx User data passed to the callback
+ * @return size_t Number of matches reported
+ */
+size_t lept_path_eval(const lept_path *p, const lept_value *v,
+                      lept_path_callback cb, void *ctx) {
+  lept_path_state s;
+  assert(p != NULL && v != NULL && cb != NULL);
+  lept_path_begin(&s, p);
+  s.cb = cb;
+  s.ctx = ctx;
+  lept_path_walk(&s, v, 0, 1);
+  lept_dealloc(s.states.allocator, s.states.stack, s.states.size);
+  return s.count;
+}
+
+/**
+ * @brief Evaluates the state set of a value directly over its text.
+ * 
+ * @param s Evaluation state
+ * @param c Context positioned at the value
+ * @param head Offset of the state set of the value
+ * @param n Number of states
+ * @return int Parsing result
+ */
+static int lept_path_walk_text(lept_path_state *s, lept_context *c,
+                               size_t head, size_t n) {
+  size_t i, m, klen, top = s->states.top, index = 0;
+  int filter = lept_path_needs_value(s, head, n), ret;
+  char close = *c->json == '[' ? ']' : '}';
+  for (i = 0; i < n; i++) {
+    if (PATH_STATE(s, head, i) == s->p->count) {
+      lept_context end = *c;
+      if ((ret = lept_skip_value(&end)) != LEPT_PARSE_OK) {
+        return ret;
+      }
+      s->count++;
+      if (s->view(s->ctx, c->json, (size_t)(end.json - c->json)) != 0) {
+        s->stop = 1;
+        return LEPT_PARSE_OK;
+      }
+      if (n == 1) {
+        c->json = end.json;
+        return LEPT_PARSE_OK;
+      }
+      break;
+    }
+  }
+  if (*c->json != '[' && *c->json != '{') {
+    return lept_skip_value(c);
+  }
+  c->json++;
+  lept_parse_whitespace(c);
+  if (*c->json == close) {
+    c->json++;
+    return LEPT_PARSE_OK;
+  }
+  while (1) {
+    const char *key = NULL;
+    lept_value child;
+    lept_init(&child);
+    if (close == '}') {
+      char *str;
+      if (*c->json != '"') {
+        return LEPT_PARSE_MISS_KEY;
+      }
+      if ((ret = lept_parse_string_raw(c, &str, &klen)) != LEPT_PARSE_OK) {
+        return ret;
+      }
+      key = str;
+      lept_parse_whitespace(c);
+      if (*c->json != ':') {
+        return LEPT_PARSE_MISS_COLON;
+      }
+      c->json++;
+      lept_parse_whitespace(c);
+    } else {
+      klen = index++;
+    }
+    if (filter) {
+      /* Filters see the child as a lazy value built from its text */
+      lept_context t = *c;
+      t.flags = LEPT_CONTEXT_LAZY;
+      if ((ret = lept_parse_value(&t, &child)) != LEPT_PARSE_OK) {
+        return ret;
+      }
+    }
+    m = lept_path_child_states(s, head, n, key, klen, &child);
+    lept_free(&child);
+    ret = m > 0 ? lept_path_walk_text(s, c, top, m) : lept_skip_value(c);
+    s->states.top = top;
+    if (ret != LEPT_PARSE_OK || s->stop) {
+      return ret;
+    }
+    lept_parse_whitespace(c);
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (*c->json == close) {
+      c->json++;
+      return LEPT_PARSE_OK;
+    } else {
+      return close == ']' ? LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET
+                          : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+    }
+  }
+}
+
+/**
+ * @brief Evaluates a compiled JSONPath plan directly over JSON text.
+ * 
+ * Matches are reported as views into json; nothing is built except the
+ * children tested by filters.
+ * 
+ * @param p Compiled plan
+ * @param json JSON string
+ * @param cb Called with each match in document order; a non-zero return
+ * stops the evaluation
+ * @param ctx User data passed to the callback
+ * @param count Receives the number of matches reported, may be NULL
+ * @return int Parsing result
+ */
+int lept_path_eval_text(const lept_path *p, const char *json,
+                        lept_path_view_callback cb, void *ctx,
+                        size_t *count) {
+  lept_path_state s;
+  lept_context c;
+  int ret;
+  assert(p != NULL && json != NULL && cb != NULL);
+  lept_path_begin(&s, p);
+  s.view = cb;
+  s.ctx = ctx;
+  c.json = json;
+  c.stack = NULL;
+  c.size = 0;
+  c.top = 0;
+  c.allocator = LEPT_DEFAULT_ALLOCATOR;
+  c.flags = 0;
+  lept_parse_whitespace(&c);
+  if ((ret = lept_path_walk_text(&s, &c, 0, 1)) == LEPT_PARSE_OK &&
+      !s.stop) {
+    lept_parse_whitespace(&c);
+    if (*c.json != '\0') {
+      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  if (count != NULL) {
+    *count = s.count;
+  }
+  lept_dealloc(c.allocator, c.stack, c.size);
+  lept_dealloc(s.states.allocator, s.states.stack, s.states.size);
+  return ret;
+}
+
+/**
+ * @brief Frees a compiled JSONPath plan.
+ * 
+ * @param p Compiled plan
+ */
+void lept_path_free(lept_path *p) {
+  assert(p != NULL);
+  for (size_t i = 0; i < p->count; i++) {
+    lept_path_step_free(&p->steps[i]);
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->steps,
+               p->count * sizeof(lept_path_step));
+  p->steps = NULL;
+  p->count = 0;
+}
+
+/**
+ * @brief Hashes a byte string with 64-bit FNV-1a.
+ * 
+ * @param s Bytes to be hashed
+ * @param len Number of bytes
+ * @param h Hash to continue from, LEPT_HASH_SEED to start
+ * @return size_t Hash value
+ */
+static size_t lept_hash_bytes(const char *s, size_t len, size_t h) {
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char)s[i]) * (size_t)0x100000001b3ULL;
+  }
+  return h;
+}
+
+/**
+ * @brief Initializes a patcher with an empty pointer cache.
+ * 
+ * @param p Patcher
+ */
+void lept_patcher_init(lept_patcher *p) {
+  assert(p != NULL);
+  p->entries = NULL;
+  p->size = 0;
+  p->capacity = 0;
+}
+
+/**
+ * @brief Finds the slot of a path in the pointer cache of a patcher.
+ * 
+ * @param p Patcher with a non-empty table
+ * @param path JSON Pointer string
+ * @param len Length of the string
+ * @return lept_patch_entry* Slot holding the path, or the empty slot where
+ * it belongs
+ */
+static lept_patch_entry *lept_patcher_slot(lept_patcher *p, const char *path,
+                                           size_t len) {
+  size_t mask = p->capacity - 1;
+  size_t i = lept_hash_bytes(path, len, LEPT_HASH_SEED) & mask;
+  while (p->entries[i].path != NULL &&
+         (p->entries[i].len != len ||
+          memcmp(p->entries[i].path, path, len) != 0)) {
+    i = (i + 1) & mask;
+  }
+  return &p->entries[i];
+}
+
+/**
+ * @brief Gets the compiled, index-caching pointer for a path.
+ * 
+ * @param p Patcher
+ * @param path JSON Pointer string
+ * @param len Length of the string
+ * @return lept_pointer* Compiled pointer, or NULL if the path is invalid
+ */
+static lept_pointer *lept_patcher_pointer(lept_patcher *p, const char *path,
+                                          size_t len) {
+  lept_patch_entry *e;
+  lept_pointer pointer;
+  if (p->capacity > 0) {
+    e = lept_patcher_slot(p, path, len);
+    if (e->path != NULL) {
+      return &e->pointer;
+    }
+  }
+  if (lept_pointer_compile(&pointer, path, len, LEPT_POINTER_CACHE) !=
+      LEPT_POINTER_OK) {
+    return NULL;
+  }
+  /* Keep the open-addressed table at most half full */
+  if (2 * (p->size + 1) > p->capacity) {
+    lept_patch_entry *old = p->entries;
+    size_t capacity = p->capacity;
+    p->capacity = capacity > 0 ? capacity * 2 : 16;
+    p->entries = (lept_patch_entry *)lept_malloc(
+        LEPT_DEFAULT_ALLOCATOR, p->capacity * sizeof(lept_patch_entry));
+    for (size_t i = 0; i < p->capacity; i++) {
+      p->entries[i].path = NULL;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+      if (old[i].path != NULL) {
+        *lept_patcher_slot(p, old[i].path, old[i].len) = old[i];
+      }
+    }
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, old,
+                 capacity * sizeof(lept_patch_entry));
+  }
+  e = lept_patcher_slot(p, path, len);
+  e->path = (char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, len + 1);
+  memcpy(e->path, path, len);
+  e->path[len] = '\0';
+  e->len = len;
+  e->pointer = pointer;
+  p->size++;
+  return &e->pointer;
+}
+
+/**
+ * @brief Moves the value a pointer refers to out of a document.
+ * 
+ * @param p Compiled pointer
+ * @param doc Document
+ * @param out Receives the removed value
+ * @return int LEPT_PATCH_OK or LEPT_PATCH_PATH_NOT_FOUND
+ */
+static int lept_patch_take(lept_pointer *p, lept_value *doc, lept_value *out) {
+  const lept_pointer_token *t;
+  lept_value *parent;
+  size_t index;
+  if (p->count == 0) {
+    lept_move(out, doc);
+    return LEPT_PATCH_OK;
+  }
+  if ((parent = lept_pointer_walk(p, doc, p->count - 1, NULL)) == NULL) {
+    return LEPT_PATCH_PATH_NOT_FOUND;
+  }
+  t = &p->tokens[p->count - 1];
+  if (parent->type == LEPT_OBJECT) {
+    if ((index = lept_find_object_index(parent, t->key, t->klen)) ==
+        LEPT_KEY_NOT_EXIST) {
+      return LEPT_PATCH_PATH_NOT_FOUND;
+    }
+    lept_move(out, lept_get_object_value(parent, index));
+    lept_remove_object_value(parent, index);
+  } else if (parent->type == LEPT_ARRAY &&
+             t->index < lept_get_array_size(parent)) {
+    lept_move(out, lept_get_array_element(parent, t->index));
+    lept_erase_array_element(parent, t->index, 1);
+  } else {
+    return LEPT_PATCH_PATH_NOT_FOUND;
+  }
+  return LEPT_PATCH_OK;
+}
+
+/**
+ * @brief Moves a value into a document at the location a pointer refers to.
+ * 
+ * @param p Compiled pointer
+ * @param doc Document
+ * @param v Value to be moved in, left null on success
+ * @param replace Whether the location must already exist ("replace")
+ * rather than be added to ("add")
+ * @return int LEPT_PATCH_OK or LEPT_PATCH_PATH_NOT_FOUND
+ */
+static int lept_patch_put(lept_pointer *p, lept_value *doc, lept_value *v,
+                          int replace) {
+  const lept_pointer_token *t;
+  lept_value *parent;
+  size_t index;
+  if (p->count == 0) {
+    lept_move(doc, v);
+    return LEPT_PATCH_OK;
+  }
+  if ((parent = lept_pointer_walk(p, doc, p->count - 1, NULL)) == NULL) {
+    return LEPT_PATCH_PATH_NOT_FOUND;
+  }
+  t = &p->tokens[p->count - 1];
+  if (parent->type == LEPT_OBJECT) {
+    index = lept_find_object_index(parent, t->key, t->klen);
+    if (index != LEPT_KEY_NOT_EXIST) {
+      lept_move(lept_get_object_value(parent, index), v);
+    } else if (!replace) {
+      lept_move(lept_set_object_value(parent, t->key, t->klen), v);
+    } else {
+      return LEPT_PATCH_PATH_NOT_FOUND;
+    }
+  } else if (parent->type == LEPT_ARRAY) {
+    size_t size = lept_get_array_size(parent);
+    index = t->index == LEPT_POINTER_END && !replace ? size : t->index;
+    if (replace && index < size) {
+      lept_move(lept_get_array_element(parent, index), v);
+    } else if (!replace && index <= size) {
+      lept_move(lept_insert_array_element(parent, index), v);
+    } else {
+      return LEPT_PATCH_PATH_NOT_FOUND;
+    }
+  } else {
+    return LEPT_PATCH_PATH_NOT_FOUND;
+  }
+  return LEPT_PATCH_OK;
+}
+
+/**
+ * @brief Gets a string member of a patch operation.
+ * 
+ * @param op Patch operation
+ * @param name Member name
+ * @param len Receives the length of the string
+ * @return const char* String, or NULL if the member is missing or no string
+ */
+static const char *lept_patch_member(const lept_value *op, const char *name,
+                                     size_t *len) {
+  size_t index = lept_find_object_index(op, name, strlen(name));
+  const lept_value *v;
+  if (index == LEPT_KEY_NOT_EXIST) {
+    return NULL;
+  }
+  v = lept_get_object_value(op, index);
+  if (v->type != LEPT_STRING) {
+    return NULL;
+  }
+  *len = lept_get_string_length(v);
+  return lept_get_string(v);
+}
+
+/**
+ * @brief Applies one JSON Patch operation.
+ * 
+ * @param p Patcher
+ * @param doc Document
+ * @param op Patch operation
+ * @return int LEPT_PATCH_OK or an error code
+ */
+static int lept_patch_operation(lept_patcher *p, lept_value *doc,
+                                const lept_value *op) {
+  const char *name, *path, *from = NULL;
+  size_t nlen, len, flen = 0, index;
+  lept_pointer *target, *source = NULL;
+  const lept_value *value = NULL;
+  lept_value tmp;
+  int ret;
+  if (op->type != LEPT_OBJECT ||
+      (name = lept_patch_member(op, "op", &nlen)) == NULL ||
+      (path = lept_patch_member(op, "path", &len)) == NULL) {
+    return LEPT_PATCH_INVALID_OPERATION;
+  }
+  if ((index = lept_find_object_index(op, "value", 5)) != LEPT_KEY_NOT_EXIST) {
+    value = lept_get_object_value(op, index);
+  }
+  if ((nlen == 4 && memcmp(name, "move", 4) == 0) ||
+      (nlen == 4 && memcmp(name, "copy", 4) == 0)) {
+    if ((from = lept_patch_member(op, "from", &flen)) == NULL) {
+      return LEPT_PATCH_INVALID_OPERATION;
+    }
+    if ((source = lept_patcher_pointer(p, from, flen)) == NULL) {
+      return LEPT_PATCH_INVALID_POINTER;
+    }
+  } else if (value == NULL && !(nlen == 6 && memcmp(name, "remove", 6) == 0)) {
+    return LEPT_PATCH_INVALID_OPERATION;
+  }
+  if ((target = lept_patcher_pointer(p, path, len)) == NULL) {
+    return LEPT_PATCH_INVALID_POINTER;
+  }
+  /* Compiling the target may have grown the table under the source entry */
+  if (source != NULL) {
+    source = lept_patcher_pointer(p, from, flen);
+  }
+  lept_init_with_allocator(&tmp, (int)ALLOCATOR_ID(doc));
+  if (nlen == 3 && memcmp(name, "add", 3) == 0) {
+    lept_copy(&tmp, value);
+    ret = lept_patch_put(target, doc, &tmp, 0);
+  } else if (nlen == 6 && memcmp(name, "remove", 6) == 0) {
+    ret = lept_patch_take(target, doc, &tmp);
+  } else if (nlen == 7 && memcmp(name, "replace", 7) == 0) {
+    lept_copy(&tmp, value);
+    ret = lept_patch_put(target, doc, &tmp, 1);
+  } else if (nlen == 4 && memcmp(name, "move", 4) == 0) {
+    if (flen == len && memcmp(from, path, len) == 0) {
+      return LEPT_PATCH_OK;
+    }
+    /* A value cannot be moved into one of its own children */
+    if (flen < len && memcmp(from, path, flen) == 0 && path[flen] == '/') {
+      return LEPT_PATCH_INVALID_OPERATION;
+    }
+    if ((ret = lept_patch_take(source, doc, &tmp)) == LEPT_PATCH_OK &&
+        (ret = lept_patch_put(target, doc, &tmp, 0)) != LEPT_PATCH_OK) {
+      lept_patch_put(source, doc, &tmp, 0);
+    }
+  } else if (nlen == 4 && memcmp(name, "copy", 4) == 0) {
+    lept_value view;
+    const lept_value *v = lept_pointer_walk(source, doc, source->count, &view);
+    if (v == NULL) {
+      return LEPT_PATCH_PATH_NOT_FOUND;
+    }
+    lept_copy(&tmp, v);
+    ret = lept_patch_put(target, doc, &tmp, 0);
+  } else if (nlen == 4 && memcmp(name, "test", 4) == 0) {
+    lept_value view;
+    const lept_value *v = lept_pointer_walk(target, doc, target->count, &view);
+    ret = v == NULL                   ? LEPT_PATCH_PATH_NOT_FOUND
+          : lept_is_equal(v, value) ? LEPT_PATCH_OK
+                                    : LEPT_PATCH_TEST_FAILED;
+  } else {
+    ret = LEPT_PATCH_INVALID_OPERATION;
+  }
+  lept_free(&tmp);
+  return ret;
+}
+
+/**
+ * @brief Applies a JSON Patch with a patcher, reusing its compiled paths.
+ * 
+ * @param p Patcher
+ * @param doc Document to be patched in place
+ * @param patch JSON Patch, an array of operations
+ * @return int LEPT_PATCH_OK or the error of the first failing operation
+ */
+int lept_patcher_apply(lept_patcher *p, lept_value *doc,
+                       const lept_value *patch) {
+  int ret = LEPT_PATCH_OK;
+  assert(p != NULL && doc != NULL && patch != NULL);
+  if (patch->type != LEPT_ARRAY) {
+    return LEPT_PATCH_INVALID_OPERATION;
+  }
+  for (size_t i = 0; i < lept_get_array_size(patch) && ret == LEPT_PATCH_OK;
+       i++) {
+    lept_value view;
+    ret = lept_patch_operation(p, doc,
+                               lept_view_array_element(patch, i, &view));
+  }
+  return ret;
+}
+
+/**
+ * @brief Frees a patcher and its compiled paths.
+ * 
+ * @param p Patcher
+ */
+void lept_patcher_free(lept_patcher *p) {
+  assert(p != NULL);
+  for (size_t i = 0; i < p->capacity; i++) {
+    if (p->entries[i].path != NULL) {
+      lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->entries[i].path,
+                   p->entries[i].len + 1);
+      lept_pointer_free(&p->entries[i].pointer);
+    }
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, p->entries,
+               p->capacity * sizeof(lept_patch_entry));
+  lept_patcher_init(p);
+}
+
+/**
+ * @brief Applies a JSON Patch (RFC 6902) in place.
+ * 
+ * @param doc Document to be patched in place
+ * @param patch JSON Patch, an array of operations
+ * @return int LEPT_PATCH_OK or the error of the first failing operation
+ */
+int lept_patch(lept_value *doc, const lept_value *patch) {
+  lept_patcher p;
+  int ret;
+  lept_patcher_init(&p);
+  ret = lept_patcher_apply(&p, doc, patch);
+  lept_patcher_free(&p);
+  return ret;
+}
+
+/**
+ * @brief Applies a JSON Merge Patch (RFC 7386) in place.
+ * 
+ * @param target Document to be patched in place
+ * @param patch Merge patch
+ */
+void lept_merge_patch(lept_value *target, const lept_value *patch) {
+  assert(target != NULL && patch != NULL);
+  if (patch->type != LEPT_OBJECT) {
+    lept_copy(target, patch);
+    return;
+  }
+  if (target->type != LEPT_OBJECT) {
+    lept_set_object(target, 0);
+  }
+  for (size_t i = 0; i < lept_get_object_size(patch); i++) {
+    const char *key = lept_get_object_key(patch, i);
+    size_t klen = lept_get_object_key_length(patch, i);
+    const lept_value *v = lept_get_object_value(patch, i);
+    size_t index = lept_find_object_index(target, key, klen);
+    if (v->type == LEPT_NULL) {
+      if (index != LEPT_KEY_NOT_EXIST) {
+        lept_remove_object_value(target, index);
+      }
+    } else {
+      lept_merge_patch(index != LEPT_KEY_NOT_EXIST
+                           ? lept_get_object_value(target, index)
+                           : lept_set_object_value(target, key, klen),
+                       v);
+    }
+  }
+}
+
+/**
+ * @brief Cached subtree hash of a container in a diff.
+ */
+typedef struct {
+  const lept_value *v; /**< Array or object, NULL if the slot is empty */
+  size_t h;            /**< Hash of the subtree */
+} lept_diff_hash_slot;
+
+/**
+ * @brief State of a structural diff.
+ */
+typedef struct {
+  lept_value *patch; /**< JSON Patch being built */
+  lept_context path; /**< Escaped JSON Pointer of the current value */
+  lept_diff_hash_slot *hashes; /**< Open-addressed cache of subtree hashes */
+  size_t hash_count;           /**< Number of cached hashes */
+  size_t hash_capacity;        /**< Capacity of the cache, a power of two */
+} lept_diff_state;
+
+/**
+ * @brief Appends an escaped member key to the current path.
+ * 
+ * @param s Diff state
+ * @param key Member key
+ * @param klen Length of the key
+ * @return size_t Length of the path before the key, to be restored after
+ */
+static size_t lept_diff_push_key(lept_diff_state *s, const char *key,
+                                 size_t klen) {
+  size_t top = s->path.top;
+  *(char *)lept_context_push(&s->path, 1) = '/';
+  for (size_t i = 0; i < klen; i++) {
+    if (key[i] == '~' || key[i] == '/') {
+      char *p = (char *)lept_context_push(&s->path, 2);
+      p[0] = '~';
+      p[1] = key[i] == '~' ? '0' : '1';
+    } else {
+      *(char *)lept_context_push(&s->path, 1) = key[i];
+    }
+  }
+  return top;
+}
+
+/**
+ * @brief Appends an array index to the current path.
+ * 
+ * @param s Diff state
+ * @param index Array index
+ * @return size_t Length of the path before the index, to be restored after
+ */
+static size_t lept_diff_push_index(lept_diff_state *s, size_t index) {
+  size_t top = s->path.top;
+  /* "/" plus at most 20 digits and the NUL written by sprintf */
+  s->path.top -=
+      22 - sprintf((char *)lept_context_push(&s->path, 22), "/%zu", index);
+  return top;
+}
+
+/**
+ * @brief Appends an operation on the current path to the patch.
+ * 
+ * @param s Diff state
+ * @param op Operation name
+ * @param value Value of the operation, or NULL for "remove"
+ */
+static void lept_diff_emit(lept_diff_state *s, const char *op,
+                           const lept_value *value) {
+  lept_value *e = lept_pushback_array_element(s->patch);
+  lept_set_object(e, 3);
+  lept_set_string(lept_set_object_value(e, "op", 2), op, strlen(op));
+  lept_set_string(lept_set_object_value(e, "path", 4),
+                  s->path.top > 0 ? s->path.stack : "", s->path.top);
+  if (value != NULL) {
+    lept_copy(lept_set_object_value(e, "value", 5), value);
+  }
 }
 
 /**
- * @brief Checks if two JSON values are equal.
+ * @brief Finds the cache slot of a container's subtree hash.
  * 
- * @param lhs Left-hand side JSON value
- * @param rhs Right-hand side JSON value
- * @return int 1 if equal, 0 otherwise
+ * @param s Diff state
+ * @param v Array or object
+ * @return lept_diff_hash_slot* Slot holding the hash, or the empty slot
+ * where it belongs
  */
-int lept_is_equal(const lept_value *lhs, const lept_value *rhs) {
-  size_t i;
-  assert(lhs != NULL && rhs != NULL);
-  if (lhs->type != rhs->type) {
-    return 0;
+static lept_diff_hash_slot *lept_diff_hash_slot_of(lept_diff_state *s,
+                                                   const lept_value *v) {
+  size_t mask = s->hash_capacity - 1;
+  size_t i = lept_hash_bytes((const char *)&v, sizeof(v), LEPT_HASH_SEED) &
+             mask;
+  while (s->hashes[i].v != NULL && s->hashes[i].v != v) {
+    i = (i + 1) & mask;
   }
-  switch (lhs->type) {
-  case LEPT_STRING:
-    return lhs->u.s.len == rhs->u.s.len &&
-           memcmp(lhs->u.s.s, rhs->u.s.s, lhs->u.s.len) == 0;
+  return &s->hashes[i];
+}
+
+/**
+ * @brief Hashes a subtree so that equal values hash equal.
+ * 
+ * Hashes of arrays and objects are cached by address, so a subtree is
+ * hashed once however deep the diff recurses into it. Members of objects
+ * are combined by sum, as their order does not matter.
+ * 
+ * @param s Diff state
+ * @param v JSON value
+ * @return size_t Hash value
+ */
+static size_t lept_diff_hash(lept_diff_state *s, const lept_value *v) {
+  lept_diff_hash_slot *slot;
+  size_t h, i;
+  double n;
+  MATERIALIZE(v);
+  switch (v->type) {
   case LEPT_NUMBER:
-    return lhs->u.n == rhs->u.n;
+    /* -0 and 0 are equal */
+    n = v->u.n == 0 ? 0 : v->u.n;
+    return lept_hash_bytes((const char *)&n, sizeof(n), LEPT_HASH_SEED);
+  case LEPT_STRING:
+    return lept_hash_bytes(v->u.s.s, v->u.s.len, LEPT_HASH_SEED);
   case LEPT_ARRAY:
-    if (lhs->u.a.size != rhs->u.a.size) {
-      return 0;
-    }
-    for (i = 0; i < lhs->u.a.size; i++) {
-      if (lept_is_equal(lhs->u.a.e + i, rhs->u.a.e + i) == 0) {
-        return 0;
-      }
-    }
-    return 1;
   case LEPT_OBJECT:
-    if (lhs->u.o.size != rhs->u.o.size) {
-      return 0;
+    if (s->hash_capacity > 0 &&
+        (slot = lept_diff_hash_slot_of(s, v))->v != NULL) {
+      return slot->h;
     }
-    for (i = 0; i < lhs->u.o.size; i++) {
-      size_t index;
-      if ((index = lept_find_object_index(rhs, lhs->u.o.m[i].k,
-                                          lhs->u.o.m[i].klen)) ==
-          LEPT_KEY_NOT_EXIST) {
-        return index;
+    h = LEPT_HASH_SEED ^ v->type;
+    if (v->type == LEPT_OBJECT) {
+      for (i = 0; i < v->u.o.size; i++) {
+        h += lept_hash_bytes(v->u.o.m[i].k, v->u.o.m[i].klen,
+                             lept_diff_hash(s, &v->u.o.m[i].v));
       }
-      if (lept_is_equal(&lhs->u.o.m[i].v, &rhs->u.o.m[index].v) == 0) {
-        return 0;
+    } else {
+      for (i = 0; i < v->u.a.size; i++) {
+        lept_value e;
+        /* A packed element hashes as the number it stands for */
+        h = (h ^ lept_diff_hash(s, lept_view_array_element(v, i, &e))) *
+            (size_t)0x100000001b3ULL;
       }
     }
-    return 1;
+    /* Keep the cache at most half full */
+    if (2 * (s->hash_count + 1) > s->hash_capacity) {
+      lept_diff_hash_slot *old = s->hashes;
+      size_t capacity = s->hash_capacity;
+      s->hash_capacity = capacity > 0 ? capacity * 2 : 64;
+      s->hashes = (lept_diff_hash_slot *)lept_malloc(
+          LEPT_DEFAULT_ALLOCATOR, s->hash_capacity * sizeof(*s->hashes));
+      memset(s->hashes, 0, s->hash_capacity * sizeof(*s->hashes));
+      for (i = 0; i < capacity; i++) {
+        if (old[i].v != NULL) {
+          *lept_diff_hash_slot_of(s, old[i].v) = old[i];
+        }
+      }
+      lept_dealloc(LEPT_DEFAULT_ALLOCATOR, old, capacity * sizeof(*old));
+    }
+    slot = lept_diff_hash_slot_of(s, v);
+    slot->v = v;
+    slot->h = h;
+    s->hash_count++;
+    return h;
   default:
-    return lhs->type == rhs->type;
+    return v->type;
   }
 }
 
 /**
- * @brief Gets the type of a JSON value.
+ * @brief Checks if two array elements are equal, rejecting by hash first.
  * 
- * @param v JSON value
- * @return lept_type Type of the JSON value
+ * @param s Diff state
+ * @param a Source array
+ * @param i Index in the source array
+ * @param b Target array
+ * @param j Index in the target array
+ * @return int 1 if equal, 0 otherwise
  */
-lept_type lept_get_type(const lept_value *v) {
-  assert(v != NULL);
-  return v->type;
+static int lept_diff_same(lept_diff_state *s, const lept_value *a, size_t i,
+                          const lept_value *b, size_t j) {
+  lept_value av, bv;
+  const lept_value *ae = lept_view_array_element(a, i, &av);
+  const lept_value *be = lept_view_array_element(b, j, &bv);
+  return lept_diff_hash(s, ae) == lept_diff_hash(s, be) &&
+         lept_is_equal(ae, be);
 }
 
+static void lept_diff_value(lept_diff_state *s, const lept_value *a,
+                            const lept_value *b);
+
 /**
- * @brief Gets the boolean value of a JSON value.
+ * @brief Diffs two arrays.
  * 
- * @param v JSON value
- * @return int Boolean value (0 or 1)
+ * Arrays of the same size are compared position by position. Otherwise the
+ * common prefix and suffix are trimmed, the overlap of the rest is compared
+ * position by position and the remaining elements are removed or added.
+ * Trimming compares subtree hashes, so only elements that are trimmed are
+ * walked in full.
+ * 
+ * @param s Diff state
+ * @param a Source array
+ * @param b Target array
  */
-int lept_get_boolean(const lept_value *v) {
-  assert(v != NULL && (v->type == LEPT_FALSE || v->type == LEPT_TRUE));
-  return (v->type == LEPT_FALSE) ? 0 : 1;
+static void lept_diff_array(lept_diff_state *s, const lept_value *a,
+                            const lept_value *b) {
+  size_t asize = lept_get_array_size(a), bsize = lept_get_array_size(b);
+  size_t min = asize < bsize ? asize : bsize, head = 0, tail = 0, top;
+  lept_value av, bv;
+  if (asize != bsize) {
+    while (head < min && lept_diff_same(s, a, head, b, head)) {
+      head++;
+    }
+    while (tail < min - head &&
+           lept_diff_same(s, a, asize - 1 - tail, b, bsize - 1 - tail)) {
+      tail++;
+    }
+  }
+  for (size_t i = head; i < min - tail; i++) {
+    top = lept_diff_push_index(s, i);
+    lept_diff_value(s, lept_view_array_element(a, i, &av),
+                    lept_view_array_element(b, i, &bv));
+    s->path.top = top;
+  }
+  /* Remove from the back so that earlier indices stay valid */
+  for (size_t i = asize - tail; i > min - tail; i--) {
+    top = lept_diff_push_index(s, i - 1);
+    lept_diff_emit(s, "remove", NULL);
+    s->path.top = top;
+  }
+  for (size_t i = min - tail; i < bsize - tail; i++) {
+    top = lept_diff_push_index(s, i);
+    lept_diff_emit(s, "add", lept_view_array_element(b, i, &bv));
+    s->path.top = top;
+  }
 }
 
 /**
- * @brief Sets the boolean value of a JSON value.
+ * @brief Finds the slot of a key in a hash index of object members.
  * 
- * @param v JSON value
- * @param b Boolean value (0 or 1)
+ * @param o Indexed object
+ * @param slots Open-addressed table of member indices plus one, 0 if empty
+ * @param mask Table capacity minus one
+ * @param key Member key
+ * @param klen Length of the key
+ * @return size_t* Slot holding the member, or the empty slot where it belongs
  */
-void lept_set_boolean(lept_value *v, int b) {
-  lept_free(v);
-  v->type = b ? LEPT_TRUE : LEPT_FALSE;
+static size_t *lept_diff_slot(const lept_value *o, size_t *slots, size_t mask,
+                              const char *key, size_t klen) {
+  size_t i = lept_hash_bytes(key, klen, LEPT_HASH_SEED) & mask;
+  while (slots[i] != 0 && (o->u.o.m[slots[i] - 1].klen != klen ||
+                           memcmp(o->u.o.m[slots[i] - 1].k, key, klen) != 0)) {
+    i = (i + 1) & mask;
+  }
+  return &slots[i];
 }
 
 /**
- * @brief Gets the number value of a JSON value.
+ * @brief Diffs two objects.
  * 
- * @param v JSON value
- * @return double Number value
+ * Objects whose keys line up position by position are compared directly.
+ * Otherwise the members of the target are indexed by key hash, so matching
+ * stays linear in the number of members.
+ * 
+ * @param s Diff state
+ * @param a Source object
+ * @param b Target object
  */
-double lept_get_number(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_NUMBER);
-  return v->u.n;
+static void lept_diff_object(lept_diff_state *s, const lept_value *a,
+                             const lept_value *b) {
+  size_t asize = a->u.o.size, bsize = b->u.o.size, capacity, mask, top, i;
+  size_t *slots;
+  unsigned char *seen;
+  for (i = 0; asize == bsize && i < asize; i++) {
+    if (a->u.o.m[i].klen != b->u.o.m[i].klen ||
+        memcmp(a->u.o.m[i].k, b->u.o.m[i].k, a->u.o.m[i].klen) != 0) {
+      break;
+    }
+  }
+  if (asize == bsize && i == asize) {
+    for (i = 0; i < asize; i++) {
+      top = lept_diff_push_key(s, a->u.o.m[i].k, a->u.o.m[i].klen);
+      lept_diff_value(s, &a->u.o.m[i].v, &b->u.o.m[i].v);
+      s->path.top = top;
+    }
+    return;
+  }
+  /* Keep the open-addressed index at most half full */
+  for (capacity = 8; capacity < 2 * bsize; capacity *= 2) {
+  }
+  mask = capacity - 1;
+  slots = (size_t *)lept_malloc(LEPT_DEFAULT_ALLOCATOR,
+                                capacity * sizeof(size_t));
+  memset(slots, 0, capacity * sizeof(size_t));
+  seen = (unsigned char *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, bsize + 1);
+  memset(seen, 0, bsize + 1);
+  for (i = 0; i < bsize; i++) {
+    size_t *slot = lept_diff_slot(b, slots, mask, b->u.o.m[i].k,
+                                  b->u.o.m[i].klen);
+    if (*slot == 0) {
+      *slot = i + 1;
+    }
+  }
+  for (i = 0; i < asize; i++) {
+    size_t j = *lept_diff_slot(b, slots, mask, a->u.o.m[i].k,
+                               a->u.o.m[i].klen);
+    top = lept_diff_push_key(s, a->u.o.m[i].k, a->u.o.m[i].klen);
+    if (j == 0) {
+      lept_diff_emit(s, "remove", NULL);
+    } else {
+      seen[j - 1] = 1;
+      lept_diff_value(s, &a->u.o.m[i].v, &b->u.o.m[j - 1].v);
+    }
+    s->path.top = top;
+  }
+  for (i = 0; i < bsize; i++) {
+    if (!seen[i]) {
+      top = lept_diff_push_key(s, b->u.o.m[i].k, b->u.o.m[i].klen);
+      lept_diff_emit(s, "add", &b->u.o.m[i].v);
+      s->path.top = top;
+    }
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, seen, bsize + 1);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, slots, capacity * sizeof(size_t));
 }
 
 /**
- * @brief Sets the number value of a JSON value.
+ * @brief Diffs two values and appends the operations to the patch.
  * 
- * @param v JSON value
- * @param n Number value
+ * @param s Diff state
+ * @param a Source value
+ * @param b Target value
  */
-void lept_set_number(lept_value *v, double n) {
-  lept_free(v);
-  v->u.n = n;
-  v->type = LEPT_NUMBER;
+static void lept_diff_value(lept_diff_state *s, const lept_value *a,
+                            const lept_value *b) {
+  /* Shared subtrees and unparsed spans with the same text are equal */
+  if (a == b || (IS_LAZY(a) && IS_LAZY(b) && a->u.s.len == b->u.s.len &&
+                 memcmp(a->u.s.s, b->u.s.s, a->u.s.len) == 0)) {
+    return;
+  }
+  if (a->type != b->type) {
+    lept_diff_emit(s, "replace", b);
+    return;
+  }
+  MATERIALIZE(a);
+  MATERIALIZE(b);
+  switch (a->type) {
+  case LEPT_NUMBER:
+    if (a->u.n != b->u.n) {
+      lept_diff_emit(s, "replace", b);
+    }
+    break;
+  case LEPT_STRING:
+    if (a->u.s.len != b->u.s.len ||
+        memcmp(a->u.s.s, b->u.s.s, a->u.s.len) != 0) {
+      lept_diff_emit(s, "replace", b);
+    }
+    break;
+  case LEPT_ARRAY:
+    lept_diff_array(s, a, b);
+    break;
+  case LEPT_OBJECT:
+    lept_diff_object(s, a, b);
+    break;
+  default:
+    break;
+  }
 }
 
 /**
- * @brief Gets the string value of a JSON value.
+ * @brief Computes a JSON Patch that turns one document into another.
  * 
- * @param v JSON value
- * @return const char* String value
+ * @param patch Receives the JSON Patch, an array of operations
+ * @param a Source document
+ * @param b Target document
  */
-const char *lept_get_string(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_STRING);
-  return v->u.s.s;
+void lept_diff(lept_value *patch, const lept_value *a, const lept_value *b) {
+  lept_diff_state s;
+  assert(patch != NULL && a != NULL && b != NULL);
+  assert(patch != a && patch != b);
+  lept_set_array(patch, 0);
+  s.patch = patch;
+  s.path.json = NULL;
+  s.path.stack = NULL;
+  s.path.size = 0;
+  s.path.top = 0;
+  s.path.allocator = LEPT_DEFAULT_ALLOCATOR;
+  s.path.flags = 0;
+  s.hashes = NULL;
+  s.hash_count = 0;
+  s.hash_capacity = 0;
+  lept_diff_value(&s, a, b);
+  lept_dealloc(s.path.allocator, s.path.stack, s.path.size);
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, s.hashes,
+               s.hash_capacity * sizeof(*s.hashes));
 }
 
 /**
- * @brief Gets the length of the string value of a JSON value.
+ * @brief Initializes a reader over NDJSON text.
  * 
- * @param v JSON value
- * @return size_t Length of the string value
+ * @param r Reader
+ * @param json NDJSON text, which must outlive the reader
  */
-size_t lept_get_string_length(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_STRING);
-  return v->u.s.len;
+void lept_ndjson_init(lept_ndjson_reader *r, const char *json) {
+  assert(r != NULL && json != NULL);
+  lept_parser_init(&r->parser);
+  r->start = json;
+  r->json = json;
+  r->end = NULL;
+  r->line = 0;
+  r->offset = 0;
 }
 
 /**
- * @brief Sets the string value of a JSON value.
+ * @brief Parses the next non-blank line of NDJSON text.
  * 
- * @param v JSON value
- * @param s String value
- * @param len Length of the string value
+ * A record must end on its own line. A record still open at the end of its
+ * line is reported there as a missing bracket of its outermost container,
+ * and reading resumes on the next line.
+ * 
+ * @param r Reader
+ * @param v JSON value to be parsed
+ * @param reparse Non-zero to reuse the allocations of v
+ * @return int Parsing result of the record, or LEPT_NDJSON_END
  */
-void lept_set_string(lept_value *v, const char *s, size_t len) {
-  assert(v != NULL && (s != NULL || len == 0));
-  lept_free(v);
-  v->u.s.s = (char *)malloc(len + 1);
-  memcpy(v->u.s.s, s, len);
-  v->u.s.s[len] = '\0';
-  v->u.s.len = len;
-  v->type = LEPT_STRING;
+static int lept_ndjson_read(lept_ndjson_reader *r, lept_value *v,
+                            int reparse) {
+  lept_context c;
+  const char *begin, *end;
+  int ret;
+  for (;;) {
+    while (r->json != r->end &&
+           (*r->json == ' ' || *r->json == '\t' || *r->json == '\r')) {
+      r->json++;
+    }
+    if (r->json == r->end || *r->json == '\0') {
+      return LEPT_NDJSON_END;
+    }
+    r->line++;
+    if (*r->json != '\n') {
+      break;
+    }
+    r->json++;
+  }
+  begin = r->json;
+  if ((end = strchr(begin, '\n')) == NULL) {
+    end = begin + strlen(begin);
+  }
+  lept_parser_begin(&r->parser, &c, begin);
+  if (!reparse) {
+    lept_init_with_allocator(v, r->parser.allocator);
+  }
+  ret = reparse ? lept_reparse_value(&c, v) : lept_parse_value(&c, v);
+  if (c.json > end) {
+    c.json = end;
+    ret = *begin == '[' ? LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET
+                        : LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET;
+  } else if (ret == LEPT_PARSE_OK) {
+    while (*c.json == ' ' || *c.json == '\t' || *c.json == '\r') {
+      c.json++;
+    }
+    if (c.json != end) {
+      ret = LEPT_PARSE_ROOT_NOT_SINGULAR;
+    }
+  }
+  assert(c.top == 0);
+  lept_parser_end(&r->parser, &c);
+  if (ret != LEPT_PARSE_OK) {
+    lept_free(v);
+  }
+  r->offset = (size_t)((ret == LEPT_PARSE_OK ? begin : c.json) - r->start);
+  r->json = *end == '\n' ? end + 1 : end;
+  return ret;
 }
 
 /**
- * @brief Sets the array value of a JSON value.
+ * @brief Parses the next record into an existing value, reusing its
+ * allocations.
  * 
- * @param v JSON value
- * @param capacity Capacity of the array
+ * @param r Reader
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result of the record, or LEPT_NDJSON_END
  */
-void lept_set_array(lept_value *v, size_t capacity) {
-  assert(v != NULL);
-  lept_free(v);
-  v->type = LEPT_ARRAY;
-  v->u.a.size = 0;
-  v->u.a.capacity = capacity;
-  v->u.a.e =
-      capacity > 0 ? (lept_value *)malloc(capacity * sizeof(lept_value)) : NULL;
+int lept_ndjson_next(lept_ndjson_reader *r, lept_value *v) {
+  assert(r != NULL && v != NULL);
+  return lept_ndjson_read(r, v, 1);
 }
 
 /**
- * @brief Gets the size of the array value of a JSON value.
+ * @brief Frees the scratch stack of a reader.
  * 
- * @param v JSON value
- * @return size_t Size of the array
+ * @param r Reader
  */
-size_t lept_get_array_size(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  return v->u.a.size;
+void lept_ndjson_free(lept_ndjson_reader *r) {
+  assert(r != NULL);
+  lept_parser_free(&r->parser);
 }
 
 /**
- * @brief Gets the capacity of the array value of a JSON value.
+ * @brief Parses the remaining records of a reader into an array.
  * 
- * @param v JSON value
- * @return size_t Capacity of the array
+ * @param r Reader
+ * @param docs Array receiving the records
+ * @param errors Receives the first malformed lines, may be NULL
+ * @param max_errors Capacity of errors
+ * @return size_t Number of malformed lines
  */
-size_t lept_get_array_capacity(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  return v->u.a.capacity;
+static size_t lept_ndjson_collect(lept_ndjson_reader *r, lept_value *docs,
+                                  lept_ndjson_error *errors,
+                                  size_t max_errors) {
+  size_t count = 0;
+  int ret;
+  for (;;) {
+    lept_value *e = lept_pushback_array_element(docs);
+    if ((ret = lept_ndjson_read(r, e, 0)) == LEPT_PARSE_OK) {
+      continue;
+    }
+    lept_popback_array_element(docs);
+    if (ret == LEPT_NDJSON_END) {
+      break;
+    }
+    if (count < max_errors) {
+      errors[count].line = r->line;
+      errors[count].offset = r->offset;
+      errors[count].code = ret;
+    }
+    count++;
+  }
+  return count;
 }
 
 /**
- * @brief Reserves the capacity of the array value of a JSON value.
+ * @brief Parses every record of NDJSON text into an array.
  * 
- * @param v JSON value
- * @param capacity Capacity to be reserved
+ * Records are parsed in place into the elements of the array with its
+ * allocator, so registering an arena allocator for docs places the whole
+ * batch in one arena. Malformed lines are skipped.
+ * 
+ * @param docs Initialized JSON value receiving the array of records
+ * @param json NDJSON text
+ * @param errors Receives the first malformed lines, may be NULL
+ * @param max_errors Capacity of errors
+ * @return size_t Number of malformed lines
  */
-void lept_reserve_array(lept_value *v, size_t capacity) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  if (v->u.a.capacity < capacity) {
-    v->u.a.capacity = capacity;
-    v->u.a.e =
-        (lept_value *)realloc(v->u.a.e, v->u.a.capacity * sizeof(lept_value));
-  }
+size_t lept_parse_ndjson(lept_value *docs, const char *json,
+                         lept_ndjson_error *errors, size_t max_errors) {
+  lept_ndjson_reader r;
+  size_t count;
+  assert(docs != NULL && json != NULL);
+  assert(errors != NULL || max_errors == 0);
+  lept_set_array(docs, 0);
+  lept_ndjson_init(&r, json);
+  r.parser.allocator = (int)ALLOCATOR_ID(docs);
+  count = lept_ndjson_collect(&r, docs, errors, max_errors);
+  lept_ndjson_free(&r);
+  return count;
 }
 
 /**
- * @brief Shrinks the capacity of the array value of a JSON value.
+ * @brief Chunk of NDJSON text parsed by one thread.
+ */
+typedef struct {
+  pthread_t thread;          /**< Worker thread */
+  int started;               /**< Whether the worker thread was started */
+  lept_ndjson_reader r;      /**< Reader over the chunk */
+  lept_value docs;           /**< Records of the chunk */
+  lept_ndjson_error *errors; /**< First malformed lines of the chunk */
+  size_t max_errors;         /**< Capacity of errors */
+  size_t count;              /**< Number of malformed lines */
+} lept_ndjson_chunk;
+
+/**
+ * @brief Parses the records of a chunk.
  * 
- * @param v JSON value
+ * @param arg Chunk
+ * @return void* NULL
  */
-void lept_shrink_array(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  if (v->u.a.capacity > v->u.a.size) {
-    v->u.a.capacity = v->u.a.size;
-    if (v->u.a.size == 0) {
-      free(v->u.a.e);
-      v->u.a.e = NULL;
-    } else {
-      v->u.a.e =
-          (lept_value *)realloc(v->u.a.e, v->u.a.capacity * sizeof(lept_value));
-    }
-  }
+static void *lept_ndjson_worker(void *arg) {
+  lept_ndjson_chunk *c = (lept_ndjson_chunk *)arg;
+  c->count = lept_ndjson_collect(&c->r, &c->docs, c->errors, c->max_errors);
+  return NULL;
 }
 
 /**
- * @brief Clears the array value of a JSON value.
+ * @brief Parses every record of NDJSON text into an array on several
+ * threads.
  * 
- * @param v JSON value
+ * The text is split into one chunk per thread at newlines, which never
+ * occur raw inside a JSON value on a line of its own, so every chunk holds
+ * whole records. Records and errors are returned in input order with line
+ * numbers and offsets relative to the whole text. The allocator of docs must
+ * be safe to call from several threads.
+ * 
+ * @param docs Initialized JSON value receiving the array of records
+ * @param json NDJSON text
+ * @param threads Number of threads to use
+ * @param errors Receives the first malformed lines, may be NULL
+ * @param max_errors Capacity of errors
+ * @return size_t Number of malformed lines
  */
-void lept_clear_array(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  lept_erase_array_element(v, 0, v->u.a.size);
+size_t lept_parse_ndjson_parallel(lept_value *docs, const char *json,
+                                  size_t threads, lept_ndjson_error *errors,
+                                  size_t max_errors) {
+  lept_ndjson_chunk *chunks;
+  size_t len, count = 0, lines = 0, size = 0, i, j;
+  const char *begin;
+  assert(docs != NULL && json != NULL);
+  assert(errors != NULL || max_errors == 0);
+  len = strlen(json);
+  /* Small inputs are not worth a thread each */
+  if (threads > len / LEPT_NDJSON_MIN_CHUNK) {
+    threads = len / LEPT_NDJSON_MIN_CHUNK;
+  }
+  if (threads <= 1) {
+    return lept_parse_ndjson(docs, json, errors, max_errors);
+  }
+  chunks = (lept_ndjson_chunk *)lept_malloc(
+      LEPT_DEFAULT_ALLOCATOR, threads * sizeof(lept_ndjson_chunk));
+  for (i = 0, begin = json; i < threads; i++) {
+    lept_ndjson_chunk *c = &chunks[i];
+    const char *end = json + len;
+    if (i + 1 < threads && begin < json + len * (i + 1) / threads) {
+      const char *target = json + len * (i + 1) / threads;
+      const char *p =
+          (const char *)memchr(target, '\n', (size_t)(json + len - target));
+      end = p != NULL ? p + 1 : json + len;
+    } else if (i + 1 < threads) {
+      end = begin;
+    }
+    lept_ndjson_init(&c->r, json);
+    c->r.json = begin;
+    c->r.end = end;
+    c->r.parser.allocator = (int)ALLOCATOR_ID(docs);
+    lept_init_with_allocator(&c->docs, c->r.parser.allocator);
+    lept_set_array(&c->docs, 0);
+    c->max_errors = max_errors;
+    c->errors = max_errors > 0
+                    ? (lept_ndjson_error *)lept_malloc(
+                          LEPT_DEFAULT_ALLOCATOR,
+                          max_errors * sizeof(lept_ndjson_error))
+                    : NULL;
+    /* The first chunk is parsed by the calling thread */
+    c->started = i > 0 && pthread_create(&c->thread, NULL, lept_ndjson_worker,
+                                         c) == 0;
+    begin = end;
+  }
+  for (i = 0; i < threads; i++) {
+    if (chunks[i].started) {
+      pthread_join(chunks[i].thread, NULL);
+    } else {
+      lept_ndjson_worker(&chunks[i]);
+    }
+    size += lept_get_array_size(&chunks[i].docs);
+  }
+  lept_set_array(docs, size);
+  for (i = 0; i < threads; i++) {
+    lept_ndjson_chunk *c = &chunks[i];
+    for (j = 0; j < lept_get_array_size(&c->docs); j++) {
+      lept_move(lept_pushback_array_element(docs),
+                lept_get_array_element(&c->docs, j));
+    }
+    for (j = 0; j < c->count && count + j < max_errors; j++) {
+      errors[count + j] = c->errors[j];
+      errors[count + j].line += lines;
+    }
+    count += c->count;
+    lines += c->r.line;
+    lept_free(&c->docs);
+    lept_ndjson_free(&c->r);
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, c->errors,
+                 max_errors * sizeof(lept_ndjson_error));
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, chunks,
+               threads * sizeof(lept_ndjson_chunk));
+  return count;
 }
 
 /**
- * @brief Gets an element of the array value of a JSON value.
+ * @brief Initializes a reader over concatenated JSON documents.
  * 
- * @param v JSON value
- * @param index Index of the element
- * @return lept_value* Pointer to the element
+ * @param r Reader
+ * @param json JSON text, which must outlive the reader
  */
-lept_value *lept_get_array_element(const lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  assert(index < v->u.a.size);
-  return &v->u.a.e[index];
+void lept_many_init(lept_many_reader *r, const char *json) {
+  assert(r != NULL && json != NULL);
+  lept_parser_init(&r->parser);
+  r->start = json;
+  r->json = json;
+  r->offset = 0;
+  r->length = 0;
 }
 
 /**
- * @brief Pushes back an element to the array value of a JSON value.
+ * @brief Parses the next document into an existing value, reusing its
+ * allocations.
  * 
- * @param v JSON value
- * @return lept_value* Pointer to the pushed element
+ * Documents may follow each other directly or be separated by whitespace.
+ * After a malformed document the reader cannot find the start of the next
+ * one, so every later call returns LEPT_MANY_END.
+ * 
+ * @param r Reader
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result of the document, or LEPT_MANY_END
  */
-lept_value *lept_pushback_array_element(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY);
-  if (v->u.a.size == v->u.a.capacity) {
-    lept_reserve_array(v, v->u.a.capacity == 0 ? 1 : v->u.a.capacity * 2);
+int lept_parse_many(lept_many_reader *r, lept_value *v) {
+  lept_context c;
+  const char *begin;
+  int ret;
+  assert(r != NULL && v != NULL);
+  lept_parser_begin(&r->parser, &c, r->json);
+  lept_parse_whitespace(&c);
+  if (*c.json == '\0') {
+    r->json = c.json;
+    return LEPT_MANY_END;
   }
-  lept_init(v->u.a.e + v->u.a.size);
-  return v->u.a.e + (v->u.a.size++);
+  begin = c.json;
+  ret = lept_reparse_value(&c, v);
+  assert(c.top == 0);
+  lept_parser_end(&r->parser, &c);
+  if (ret != LEPT_PARSE_OK) {
+    lept_free(v);
+    r->offset = (size_t)(c.json - r->start);
+    r->length = 0;
+    r->json = "";
+    return ret;
+  }
+  r->offset = (size_t)(begin - r->start);
+  r->length = (size_t)(c.json - begin);
+  r->json = c.json;
+  return ret;
 }
 
 /**
- * @brief Pops back an element from the array value of a JSON value.
+ * @brief Frees the scratch stack of a reader.
  * 
- * @param v JSON value
+ * @param r Reader
  */
-void lept_popback_array_element(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_ARRAY && v->u.a.size > 0);
-  lept_free(v->u.a.e + (--v->u.a.size));
+void lept_many_free(lept_many_reader *r) {
+  assert(r != NULL);
+  lept_parser_free(&r->parser);
 }
 
 /**
- * @brief Inserts an element to the array value of a JSON value.
+ * @brief Range of root array elements parsed by one thread.
+ */
+typedef struct {
+  pthread_t thread;   /**< Worker thread */
+  int started;        /**< Whether the worker thread was started */
+  lept_context c;     /**< Context holding the parsed elements on its stack */
+  const char *end;    /**< Comma ending the range, NULL for the last range */
+  size_t size;        /**< Number of parsed elements */
+  size_t numbers;     /**< Number of parsed numbers */
+  int ret;            /**< Parsing result */
+} lept_array_chunk;
+
+/**
+ * @brief Finds root array commas that split the text into even ranges.
  * 
- * @param v JSON value
- * @param index Index of the element
- * @return lept_value* Pointer to the inserted element
+ * The scan only tracks strings and nesting depth; strcspn() lets the C
+ * library skip the bytes in between with vector instructions. The commas
+ * are only candidates, as the text has not been validated yet.
+ * 
+ * @param json Text starting with the '[' of the root array
+ * @param len Length of the text
+ * @param ends Receives the commas
+ * @param n Number of commas wanted
+ * @return size_t Number of commas found
  */
-lept_value *lept_insert_array_element(lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_ARRAY && index <= v->u.a.size);
-  lept_reserve_array(v, v->u.a.size + 1);
-  for (size_t i = v->u.a.size; i > index; i--) {
-    v->u.a.e[i] = v->u.a.e[i - 1];
+static size_t lept_array_split(const char *json, size_t len,
+                               const char **ends, size_t n) {
+  const char *p = json + 1;
+  size_t depth = 0, k = 0;
+  while (k < n) {
+    p += strcspn(p, "\"[]{},");
+    switch (*p) {
+    case '\0':
+      return k;
+    case '"':
+      for (p++;; p += 2) {
+        p += strcspn(p, "\"\\");
+        if (*p != '\\' || p[1] == '\0') {
+          break;
+        }
+      }
+      if (*p != '"') {
+        return k;
+      }
+      break;
+    case '[':
+    case '{':
+      depth++;
+      break;
+    case ']':
+    case '}':
+      if (depth-- == 0) {
+        return k;
+      }
+      break;
+    default:
+      if (depth == 0 && p >= json + len / (n + 1) * (k + 1)) {
+        ends[k++] = p;
+      }
+      break;
+    }
+    p++;
   }
-  v->u.a.size++;
-  return v->u.a.e + index;
+  return k;
 }
 
 /**
- * @brief Erases elements from the array value of a JSON value.
+ * @brief Parses a range of root array elements onto the stack of its
+ * context.
  * 
- * @param v JSON value
- * @param index Index of the first element to be erased
- * @param count Number of elements to be erased
+ * @param arg Chunk
+ * @return void* NULL
  */
-void lept_erase_array_element(lept_value *v, size_t index, size_t count) {
-  assert(v != NULL && v->type == LEPT_ARRAY && index + count <= v->u.a.size);
-  for (size_t i = 0; i < count; i++) {
-    lept_free(v->u.a.e + (index + i));
-  }
-  for (size_t i = index + count; i < v->u.a.size; i++) {
-    v->u.a.e[i - count] = v->u.a.e[i];
+static void *lept_array_worker(void *arg) {
+  lept_array_chunk *ch = (lept_array_chunk *)arg;
+  lept_context *c = &ch->c;
+  lept_parse_whitespace(c);
+  for (;;) {
+    lept_value e;
+    lept_init(&e);
+    SET_ALLOCATOR_ID(&e, c->allocator);
+    if ((ch->ret = lept_parse_value(c, &e)) != LEPT_PARSE_OK) {
+      break;
+    }
+    memcpy(lept_context_push(c, sizeof(lept_value)), &e, sizeof(lept_value));
+    ch->size++;
+    ch->numbers += e.type == LEPT_NUMBER;
+    lept_parse_whitespace(c);
+    if (ch->end != NULL && c->json >= ch->end) {
+      ch->ret = c->json == ch->end ? LEPT_PARSE_OK
+                                   : LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+      break;
+    }
+    if (*c->json == ',') {
+      c->json++;
+      lept_parse_whitespace(c);
+    } else if (ch->end == NULL && *c->json == ']') {
+      c->json++;
+      lept_parse_whitespace(c);
+      ch->ret = *c->json == '\0' ? LEPT_PARSE_OK : LEPT_PARSE_ROOT_NOT_SINGULAR;
+      break;
+    } else {
+      ch->ret = LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET;
+      break;
+    }
   }
-  v->u.a.size -= count;
+  return NULL;
 }
 
 /**
- * @brief Sets the object value of a JSON value.
+ * @brief Parses a JSON string whose root is an array on several threads.
  * 
- * @param v JSON value
- * @param capacity Capacity of the object
+ * The root array is split at candidate commas into one range per thread and
+ * the ranges are parsed concurrently, then their elements are moved into the
+ * result in order. If any range fails, for example because a candidate comma
+ * was not a real element boundary, the text is parsed again sequentially so
+ * that errors are exactly those of lept_parse(). Roots that are not arrays
+ * and short inputs are parsed sequentially as well. Everything is allocated
+ * from the allocator of v, which the threads call concurrently.
+ * 
+ * @param v Initialized JSON value to be parsed, whose allocator is used
+ * @param json JSON string to be parsed
+ * @param threads Number of threads to use
+ * @return int Parsing result
  */
-void lept_set_object(lept_value *v, size_t capacity) {
-  assert(v != NULL);
-  lept_free(v);
-  v->type = LEPT_OBJECT;
-  v->u.o.size = 0;
-  v->u.o.capacity = capacity;
-  v->u.o.m = capacity > 0
-                 ? (lept_member *)malloc(capacity * sizeof(lept_member))
-                 : NULL;
+int lept_parse_parallel(lept_value *v, const char *json, size_t threads) {
+  lept_array_chunk *chunks;
+  const char **ends;
+  const char *p = json;
+  size_t len, n, size = 0, numbers = 0, i;
+  int ret = LEPT_PARSE_OK;
+  unsigned id;
+  assert(v != NULL && json != NULL);
+  id = ALLOCATOR_ID(v);
+  while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r') {
+    p++;
+  }
+  len = strlen(p);
+  if (threads > len / LEPT_ARRAY_MIN_CHUNK) {
+    threads = len / LEPT_ARRAY_MIN_CHUNK;
+  }
+  if (*p != '[' || threads <= 1) {
+    return lept_parse_with_allocator(v, json, (int)id);
+  }
+  ends = (const char **)lept_malloc(id, (threads - 1) * sizeof(const char *));
+  if ((n = lept_array_split(p, len, ends, threads - 1) + 1) == 1) {
+    lept_dealloc(id, ends, (threads - 1) * sizeof(const char *));
+    return lept_parse_with_allocator(v, json, (int)id);
+  }
+  chunks = (lept_array_chunk *)lept_malloc(id, n * sizeof(lept_array_chunk));
+  for (i = 0; i < n; i++) {
+    lept_array_chunk *ch = &chunks[i];
+    ch->c.json = i == 0 ? p + 1 : ends[i - 1] + 1;
+    ch->c.stack = NULL;
+    ch->c.size = 0;
+    ch->c.top = 0;
+    ch->c.allocator = id;
+    ch->c.flags = 0;
+    ch->end = i + 1 < n ? ends[i] : NULL;
+    ch->size = 0;
+    ch->numbers = 0;
+    /* The first range is parsed by the calling thread */
+    ch->started = i > 0 && pthread_create(&ch->thread, NULL, lept_array_worker,
+                                          ch) == 0;
+  }
+  for (i = 0; i < n; i++) {
+    if (chunks[i].started) {
+      pthread_join(chunks[i].thread, NULL);
+    } else {
+      lept_array_worker(&chunks[i]);
+    }
+    if (chunks[i].ret != LEPT_PARSE_OK) {
+      ret = chunks[i].ret;
+    }
+    size += chunks[i].size;
+    numbers += chunks[i].numbers;
+  }
+  lept_init_with_allocator(v, (int)id);
+  if (ret != LEPT_PARSE_OK) {
+    for (i = 0; i < n; i++) {
+      while (chunks[i].size-- > 0) {
+        lept_free((lept_value *)lept_context_pop(&chunks[i].c,
+                                                 sizeof(lept_value)));
+      }
+    }
+  } else if (numbers == size && size >= LEPT_PACKED_ARRAY_MIN_SIZE) {
+    lept_set_packed_array(v, size);
+    for (i = 0; i < n; i++) {
+      lept_value *head = (lept_value *)chunks[i].c.stack;
+      for (size_t j = 0; j < chunks[i].size; j++) {
+        v->u.p.n[v->u.p.size++] = head[j].u.n;
+      }
+    }
+  } else {
+    lept_set_array(v, size);
+    for (i = 0; i < n; i++) {
+      if (chunks[i].size > 0) {
+        memcpy(v->u.a.e + v->u.a.size, chunks[i].c.stack,
+               chunks[i].size * sizeof(lept_value));
+        v->u.a.size += chunks[i].size;
+      }
+    }
+  }
+  for (i = 0; i < n; i++) {
+    lept_dealloc(chunks[i].c.allocator, chunks[i].c.stack, chunks[i].c.size);
+  }
+  lept_dealloc(id, chunks, n * sizeof(lept_array_chunk));
+  lept_dealloc(id, ends, (threads - 1) * sizeof(const char *));
+  return ret == LEPT_PARSE_OK ? ret
+                              : lept_parse_with_allocator(v, json, (int)id);
 }
 
 /**
- * @brief Gets the capacity of the object value of a JSON value.
- * 
- * @param v JSON value
- * @return size_t Capacity of the object
+ * @brief Range of children of a container pair, copied or compared as one
+ * unit of work.
  */
-size_t lept_get_object_capacity(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  return v->u.o.capacity;
-}
+typedef struct {
+  const lept_value *a; /**< Source or left-hand side container */
+  lept_value *b;       /**< Destination or right-hand side container */
+  size_t begin;        /**< First child */
+  size_t end;          /**< One past the last child */
+} lept_tree_task;
 
 /**
- * @brief Gets the size of the object value of a JSON value.
- * 
- * @param v JSON value
- * @return size_t Size of the object
+ * @brief Work shared by the threads of a parallel copy or comparison.
  */
-size_t lept_get_object_size(const lept_value *v) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  return v->u.o.size;
-}
+typedef struct {
+  lept_context tasks;  /**< Stack of lept_tree_task */
+  size_t count;        /**< Number of tasks */
+  atomic_size_t next;  /**< Next task to be claimed */
+  atomic_int equal;    /**< Cleared once a difference is found */
+  int copy;            /**< 1 to copy, 0 to compare */
+} lept_tree_work;
 
 /**
- * @brief Reserves the capacity of the object value of a JSON value.
+ * @brief Worker thread of a parallel copy or comparison, claiming tasks
+ * until none are left.
+ */
+typedef struct {
+  pthread_t thread;     /**< Worker thread */
+  lept_tree_work *work; /**< Shared work */
+  int started;          /**< Whether the thread was created */
+} lept_tree_worker;
+
+/**
+ * @brief Checks whether an object has a key more than once.
  * 
- * @param v JSON value
- * @param capacity Capacity to be reserved
+ * @param v JSON object
+ * @return int 1 if a key repeats, 0 otherwise
  */
-void lept_reserve_object(lept_value *v, size_t capacity) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  if (v->u.o.capacity < capacity) {
-    v->u.o.capacity = capacity;
-    v->u.o.m =
-        (lept_member *)realloc(v->u.o.m, v->u.o.capacity * sizeof(lept_member));
+static int lept_has_duplicate_keys(const lept_value *v) {
+  size_t count = 1, h, i, *slots;
+  int ret = 0;
+  while (count < 2 * v->u.o.size) {
+    count <<= 1;
   }
+  slots = (size_t *)lept_malloc(LEPT_DEFAULT_ALLOCATOR, count * sizeof(size_t));
+  memset(slots, 0, count * sizeof(size_t));
+  for (i = 0; i < v->u.o.size && !ret; i++) {
+    const lept_member *m = &v->u.o.m[i];
+    for (h = lept_hash_bytes(m->k, m->klen, LEPT_HASH_SEED) & (count - 1);
+         slots[h] != 0; h = (h + 1) & (count - 1)) {
+      const lept_member *o = &v->u.o.m[slots[h] - 1];
+      if (o->klen == m->klen && memcmp(o->k, m->k, m->klen) == 0) {
+        ret = 1;
+        break;
+      }
+    }
+    slots[h] = i + 1;
+  }
+  lept_dealloc(LEPT_DEFAULT_ALLOCATOR, slots, count * sizeof(size_t));
+  return ret;
 }
 
 /**
- * @brief Shrinks the capacity of the object value of a JSON value.
+ * @brief Decides whether a pair of values is split into tasks.
  * 
- * @param v JSON value
+ * Lazy sources are copied in constant time and packed arrays in one
+ * memcpy(), so only plain containers are split. Comparisons materialize both
+ * sides first, as lept_is_equal() does, and clear the equal flag when the
+ * values already differ in type or size. Objects with repeated keys would
+ * let two tasks compare against the same member and are not split.
+ * 
+ * @param w Shared work
+ * @param a Source or left-hand side value
+ * @param b Right-hand side value, unused when copying
+ * @return int 1 to split, 0 to handle the pair as a whole
  */
-void lept_shrink_object(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  if (v->u.o.capacity > v->u.o.size) {
-    v->u.o.capacity = v->u.o.size;
-    if (v->u.o.size == 0) {
-      free(v->u.o.m);
-      v->u.o.m = NULL;
-    } else {
-      v->u.o.m = (lept_member *)realloc(v->u.o.m,
-                                        v->u.o.capacity * sizeof(lept_member));
-    }
+static int lept_tree_splittable(lept_tree_work *w, const lept_value *a,
+                                const lept_value *b) {
+  if (w->copy) {
+    return !IS_LAZY(a) && !IS_PACKED(a) &&
+           (a->type == LEPT_ARRAY || a->type == LEPT_OBJECT);
   }
+  if (a->type != b->type) {
+    atomic_store(&w->equal, 0);
+    return 0;
+  }
+  MATERIALIZE(a);
+  MATERIALIZE(b);
+  if (a->type != LEPT_ARRAY && a->type != LEPT_OBJECT) {
+    return 0;
+  }
+  /* Arrays and objects share the layout of their size field */
+  if (a->u.a.size != b->u.a.size) {
+    atomic_store(&w->equal, 0);
+    return 0;
+  }
+  if (a->type == LEPT_ARRAY) {
+    return !IS_PACKED(a) && !IS_PACKED(b);
+  }
+  return !lept_has_duplicate_keys(a);
 }
 
 /**
- * @brief Clears the object value of a JSON value.
+ * @brief Checks whether a child is a container large enough to be split on
+ * its own rather than as part of the range of its parent.
  * 
- * @param v JSON value
+ * @param w Shared work
+ * @param v Source or left-hand side child
+ * @return int 1 if large, 0 otherwise
  */
-void lept_clear_object(lept_value *v) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  for (size_t i = 0; i < v->u.o.size; i++) {
-    lept_free(&v->u.o.m[i].v);
-    free(v->u.o.m[i].k);
+static int lept_tree_large(lept_tree_work *w, const lept_value *v) {
+  if (w->copy && (IS_LAZY(v) || IS_PACKED(v))) {
+    return 0;
   }
-  v->u.o.size = 0;
+  MATERIALIZE(v);
+  return (v->type == LEPT_ARRAY || v->type == LEPT_OBJECT) &&
+         v->u.a.size >= LEPT_TREE_SPLIT_SIZE;
 }
 
 /**
- * @brief Gets the key of an object member.
- * 
- * @param v JSON value
- * @param index Index of the member
- * @return const char* Key of the member
+ * @brief Pushes a task for children [begin, end) if the range is not
+ * empty.
  */
-const char *lept_get_object_key(const lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  assert(index < v->u.o.size);
-  return v->u.o.m[index].k;
+static void lept_tree_push(lept_tree_work *w, const lept_value *a,
+                           lept_value *b, size_t begin, size_t end) {
+  lept_tree_task *t;
+  if (begin == end) {
+    return;
+  }
+  t = (lept_tree_task *)lept_context_push(&w->tasks, sizeof(lept_tree_task));
+  t->a = a;
+  t->b = b;
+  t->begin = begin;
+  t->end = end;
+  w->count++;
 }
 
 /**
- * @brief Gets the length of the key of an object member.
+ * @brief Copies the key of an object member.
  * 
- * @param v JSON value
- * @param index Index of the member
- * @return size_t Length of the key
+ * @param dst Destination object
+ * @param src Source object
+ * @param i Index of the member
  */
-size_t lept_get_object_key_length(const lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  assert(index < v->u.o.size);
-  return v->u.o.m[index].klen;
+static void lept_tree_copy_key(lept_value *dst, const lept_value *src,
+                               size_t i) {
+  lept_member *m = &dst->u.o.m[i];
+  m->klen = src->u.o.m[i].klen;
+  m->k = (char *)lept_malloc(ALLOCATOR_ID(dst), m->klen + 1);
+  memcpy(m->k, src->u.o.m[i].k, m->klen + 1);
 }
 
 /**
- * @brief Gets the value of an object member.
+ * @brief Splits a container pair into tasks, recursing into large
+ * children.
  * 
- * @param v JSON value
- * @param index Index of the member
- * @return lept_value* Value of the member
+ * When copying, the destination container is allocated here with the
+ * capacity lept_copy() would give it and null children, so tasks only fill
+ * in their own range. Runs on the calling thread before any worker starts.
+ * 
+ * @param w Shared work
+ * @param a Source or left-hand side container
+ * @param b Destination or right-hand side container
  */
-lept_value *lept_get_object_value(const lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_OBJECT);
-  assert(index < v->u.o.size);
-  return &v->u.o.m[index].v;
+static void lept_tree_split(lept_tree_work *w, const lept_value *a,
+                            lept_value *b) {
+  size_t i, size = a->u.a.size, begin = 0;
+  if (w->copy) {
+    if (a->type == LEPT_ARRAY) {
+      lept_set_array(b, a->u.a.capacity);
+    } else {
+      lept_set_object(b, a->u.o.capacity);
+    }
+    for (i = 0; i < size; i++) {
+      lept_value *e = a->type == LEPT_ARRAY ? &b->u.a.e[i] : &b->u.o.m[i].v;
+      lept_init(e);
+      SET_ALLOCATOR_ID(e, ALLOCATOR_ID(b));
+    }
+    b->u.a.size = size;
+  }
+  for (i = 0; i < size && atomic_load(&w->equal); i++) {
+    const lept_value *ca;
+    lept_value *cb = NULL;
+    if (a->type == LEPT_ARRAY) {
+      ca = &a->u.a.e[i];
+      cb = &b->u.a.e[i];
+    } else {
+      ca = &a->u.o.m[i].v;
+      if (w->copy) {
+        cb = &b->u.o.m[i].v;
+      }
+    }
+    if (lept_tree_large(w, ca)) {
+      if (!w->copy && a->type == LEPT_OBJECT) {
+        size_t index =
+            lept_find_object_index(b, a->u.o.m[i].k, a->u.o.m[i].klen);
+        if (index == LEPT_KEY_NOT_EXIST) {
+          atomic_store(&w->equal, 0);
+          return;
+        }
+        cb = &b->u.o.m[index].v;
+      }
+      if (w->copy || lept_tree_splittable(w, ca, cb)) {
+        lept_tree_push(w, a, b, begin, i);
+        if (w->copy && a->type == LEPT_OBJECT) {
+          lept_tree_copy_key(b, a, i);
+        }
+        lept_tree_split(w, ca, cb);
+        begin = i + 1;
+        continue;
+      }
+    }
+    if (i + 1 - begin == LEPT_TREE_CHUNK) {
+      lept_tree_push(w, a, b, begin, i + 1);
+      begin = i + 1;
+    }
+  }
+  lept_tree_push(w, a, b, begin, size);
 }
 
 /**
- * @brief Finds the index of an object member by key.
+ * @brief Copies or compares the children of one task.
  * 
- * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return size_t Index of the member, or LEPT_KEY_NOT_EXIST if not found
+ * @param w Shared work
+ * @param t Task
  */
-size_t lept_find_object_index(const lept_value *v, const char *key,
-                              size_t klen) {
-  assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-  for (size_t i = 0; i < v->u.o.size; ++i) {
-    if (v->u.o.m[i].klen == klen && memcmp(v->u.o.m[i].k, key, klen) == 0) {
-      return i;
+static void lept_tree_run(lept_tree_work *w, const lept_tree_task *t) {
+  const lept_value *a = t->a;
+  lept_value *b = t->b;
+  for (size_t i = t->begin; i < t->end; i++) {
+    if (w->copy) {
+      if (a->type == LEPT_ARRAY) {
+        lept_copy(&b->u.a.e[i], &a->u.a.e[i]);
+      } else {
+        lept_tree_copy_key(b, a, i);
+        lept_copy(&b->u.o.m[i].v, &a->u.o.m[i].v);
+      }
+    } else if (a->type == LEPT_ARRAY) {
+      if (!lept_is_equal(&a->u.a.e[i], &b->u.a.e[i])) {
+        atomic_store(&w->equal, 0);
+        return;
+      }
+    } else {
+      size_t index =
+          lept_find_object_index(b, a->u.o.m[i].k, a->u.o.m[i].klen);
+      if (index == LEPT_KEY_NOT_EXIST ||
+          !lept_is_equal(&a->u.o.m[i].v, &b->u.o.m[index].v)) {
+        atomic_store(&w->equal, 0);
+        return;
+      }
     }
   }
-  return LEPT_KEY_NOT_EXIST;
+}
+
+static void *lept_tree_worker_run(void *arg) {
+  lept_tree_work *w = ((lept_tree_worker *)arg)->work;
+  size_t i;
+  while (atomic_load(&w->equal) &&
+         (i = atomic_fetch_add(&w->next, 1)) < w->count) {
+    lept_tree_run(w, (const lept_tree_task *)w->tasks.stack + i);
+  }
+  return NULL;
 }
 
 /**
- * @brief Finds the value of an object member by key.
+ * @brief Splits a container pair into tasks and runs them on up to the
+ * given number of threads, the calling thread included.
  * 
- * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return lept_value* Value of the member, or NULL if not found
+ * @param w Shared work
+ * @param a Source or left-hand side container
+ * @param b Destination or right-hand side container
+ * @param threads Number of threads to use
  */
-lept_value *lept_find_object_value(lept_value *v, const char *key,
-                                   size_t klen) {
-  size_t index = lept_find_object_index(v, key, klen);
-  return index != LEPT_KEY_NOT_EXIST ? &v->u.o.m[index].v : NULL;
+static void lept_tree_parallel(lept_tree_work *w, const lept_value *a,
+                               lept_value *b, size_t threads) {
+  lept_tree_worker *workers;
+  size_t i;
+  w->tasks.allocator = LEPT_DEFAULT_ALLOCATOR;
+  w->tasks.flags = 0;
+  w->tasks.stack = NULL;
+  w->tasks.size = w->tasks.top = 0;
+  w->count = 0;
+  atomic_init(&w->next, 0);
+  lept_tree_split(w, a, b);
+  if (threads > w->count) {
+    threads = w->count;
+  }
+  if (threads > 0) {
+    workers = (lept_tree_worker *)lept_malloc(
+        LEPT_DEFAULT_ALLOCATOR, threads * sizeof(lept_tree_worker));
+    for (i = 0; i < threads; i++) {
+      workers[i].work = w;
+      /* The calling thread works as well */
+      workers[i].started =
+          i > 0 && pthread_create(&workers[i].thread, NULL,
+                                  lept_tree_worker_run, &workers[i]) == 0;
+    }
+    lept_tree_worker_run(&workers[0]);
+    for (i = 1; i < threads; i++) {
+      if (workers[i].started) {
+        pthread_join(workers[i].thread, NULL);
+      }
+    }
+    lept_dealloc(LEPT_DEFAULT_ALLOCATOR, workers,
+                 threads * sizeof(lept_tree_worker));
+  }
+  lept_dealloc(w->tasks.allocator, w->tasks.stack, w->tasks.size);
 }
 
 /**
- * @brief Sets the value of an object member by key.
+ * @brief Copies a JSON value on several threads.
  * 
- * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return lept_value* Value of the member
+ * Containers are split into ranges of LEPT_TREE_CHUNK children, and
+ * children with at least LEPT_TREE_SPLIT_SIZE children of their own are
+ * split in turn. Threads claim ranges from a shared counter, so the load
+ * balances itself. The result is identical to that of lept_copy(). The
+ * allocator of dst must be safe to call from several threads.
+ * 
+ * @param dst Destination JSON value
+ * @param src Source JSON value
+ * @param threads Number of threads to use
  */
-lept_value *lept_set_object_value(lept_value *v, const char *key, size_t klen) {
-  assert(v != NULL && v->type == LEPT_OBJECT && key != NULL);
-  lept_reserve_object(v, v->u.o.size + 1);
-  memcpy((v->u.o.m[v->u.o.size].k = (char *)malloc(klen)), key, klen);
-  v->u.o.m[v->u.o.size].klen = klen;
-  lept_init(&v->u.o.m[v->u.o.size].v);
-  return &v->u.o.m[v->u.o.size++].v;
+void lept_copy_parallel(lept_value *dst, const lept_value *src,
+                        size_t threads) {
+  lept_tree_work w;
+  assert(src != NULL && dst != NULL && src != dst);
+  w.copy = 1;
+  atomic_init(&w.equal, 1);
+  if (threads <= 1 || !lept_tree_splittable(&w, src, NULL)) {
+    lept_copy(dst, src);
+    return;
+  }
+  lept_tree_parallel(&w, src, dst, threads);
 }
 
 /**
- * @brief Removes an object member by index.
+ * @brief Checks if two JSON values are equal on several threads.
  * 
- * @param v JSON value
- * @param index Index of the member
+ * Work is split as in lept_copy_parallel(), and all threads stop once any
+ * difference is found. The result is identical to that of lept_is_equal().
+ * 
+ * @param lhs Left-hand side JSON value
+ * @param rhs Right-hand side JSON value
+ * @param threads Number of threads to use
+ * @return int 1 if equal, 0 otherwise
  */
-void lept_remove_object_value(lept_value *v, size_t index) {
-  assert(v != NULL && v->type == LEPT_OBJECT && index < v->u.o.size);
-  lept_free(&v->u.o.m[index].v);
-  free(v->u.o.m[index].k);
-  for (size_t i = index + 1; i < v->u.a.size; i++) {
-    v->u.o.m[i - 1] = v->u.o.m[i];
+int lept_is_equal_parallel(const lept_value *lhs, const lept_value *rhs,
+                           size_t threads) {
+  lept_tree_work w;
+  assert(lhs != NULL && rhs != NULL);
+  w.copy = 0;
+  atomic_init(&w.equal, 1);
+  if (threads <= 1 || lhs == rhs) {
+    return lept_is_equal(lhs, rhs);
   }
-  v->u.o.size -= 1;
+  if (!lept_tree_splittable(&w, lhs, rhs)) {
+    return atomic_load(&w.equal) && lept_is_equal(lhs, rhs);
+  }
+  lept_tree_parallel(&w, lhs, (lept_value *)rhs, threads);
+  return atomic_load(&w.equal);
 }
@@ -4,6 +4,17 @@
 #include <stddef.h> /* size_t */
 
 #define LEPT_KEY_NOT_EXIST ((size_t)-1)
+#define LEPT_DEFAULT_ALLOCATOR 0
+#define LEPT_POINTER_END ((size_t)-2) /* the "-" array token */
+#define LEPT_NDJSON_END (-1) /* lept_ndjson_next() reached the end */
+#define LEPT_MANY_END (-1) /* lept_parse_many() reached the end */
+#define LEPT_READER_END (-1) /* lept_reader_next() reached the end */
+#define LEPT_FILE_POPULATE 0x1 /* prefault the whole mapping up front */
+#define LEPT_POINTER_CACHE 0x1
+
+#ifndef LEPT_READER_MAX_DEPTH
+#define LEPT_READER_MAX_DEPTH 1024
+#endif
 
 /**
  * @brief JSON value types.
@@ -44,12 +55,18 @@ struct lept_value {
       size_t size;   /**< Number of elements */
       size_t capacity;/**< Capacity of elements */
     } a; /**< Array */
+    struct {
+      double *n;      /**< Packed array numbers */
+      size_t size;    /**< Number of elements */
+      size_t capacity;/**< Capacity of elements */
+    } p; /**< Packed numeric array */
     struct {
       char *s; /**< String value */
       size_t len; /**< Length of the string */
     } s; /**< String */
   } u; /**< Union of value types */
   lept_type type; /**< Type of the value */
+  unsigned flags; /**< Internal representation flags */
 };
 
 /**
@@ -61,6 +78,256 @@ struct lept_member {
   lept_value v; /**< Member value */
 };
 
+/**
+ * @brief Allocator interface used for every library allocation.
+ *
+ * Sizes passed to realloc_fn and free_fn are the sizes originally requested,
+ * so pool and arena allocators do not need to track them.
+ */
+typedef struct {
+  void *(*malloc_fn)(void *ctx, size_t size); /**< Allocates memory */
+  void *(*realloc_fn)(void *ctx, void *ptr, size_t old_size,
+                      size_t new_size); /**< Resizes memory */
+  void (*free_fn)(void *ctx, void *ptr, size_t size); /**< Releases memory */
+  void *ctx; /**< User data passed to every function */
+} lept_allocator;
+
+/**
+ * @brief Object builder accumulating members in a reusable scratch buffer.
+ */
+typedef struct {
+  lept_member *m;  /**< Scratch members */
+  size_t size;     /**< Number of pending members */
+  size_t capacity; /**< Capacity of the scratch buffer */
+} lept_object_builder;
+
+/**
+ * @brief Reusable parser keeping its scratch stack between parses.
+ */
+typedef struct {
+  char *stack;         /**< Scratch stack */
+  size_t size;         /**< Size of the scratch stack */
+  size_t max_retained; /**< Largest stack kept after a parse, in bytes */
+  int allocator;       /**< Allocator id for the stack and parsed values */
+} lept_parser;
+
+/**
+ * @brief Reusable writer keeping its output buffer between calls.
+ */
+typedef struct {
+  char *stack;         /**< Output buffer */
+  size_t size;         /**< Size of the output buffer */
+  char *keys;          /**< Member sort buffer of canonical output */
+  size_t keys_size;    /**< Size of the member sort buffer */
+  size_t max_retained; /**< Largest buffer kept between calls, in bytes */
+} lept_writer;
+
+/**
+ * @brief Reference token of a compiled JSON Pointer.
+ */
+typedef struct {
+  const char *key; /**< Unescaped token, NUL-terminated */
+  size_t klen;     /**< Length of the token */
+  size_t index;    /**< Array index, LEPT_POINTER_END or LEPT_KEY_NOT_EXIST */
+  size_t cache;    /**< Member index seen last, or LEPT_KEY_NOT_EXIST */
+} lept_pointer_token;
+
+/**
+ * @brief Compiled JSON Pointer (RFC 6901).
+ */
+typedef struct {
+  lept_pointer_token *tokens; /**< Reference tokens */
+  size_t count;               /**< Number of tokens */
+  int flags;                  /**< LEPT_POINTER_CACHE or 0 */
+  char *keys;                 /**< Buffer holding the unescaped tokens */
+  size_t size;                /**< Size of the key buffer */
+} lept_pointer;
+
+/**
+ * @brief Projection selecting the paths kept by lept_parse_projected().
+ * 
+ * Each node is one path token; the root node has no key.
+ */
+typedef struct lept_projection lept_projection;
+struct lept_projection {
+  char *key;                  /**< Token leading to this node */
+  size_t klen;                /**< Length of the token */
+  size_t index;               /**< Token as an array index, if it is one */
+  lept_projection *children;  /**< Selected paths below this node */
+  size_t size;                /**< Number of children */
+  size_t capacity;            /**< Capacity of children */
+  int keep;                   /**< The whole value at this path is kept */
+};
+
+/**
+ * @brief JSON Pointer compilation result codes.
+ */
+enum {
+  LEPT_POINTER_OK = 0,         /**< Compilation successful */
+  LEPT_POINTER_MISS_SLASH,     /**< Non-empty pointer not starting with '/' */
+  LEPT_POINTER_INVALID_ESCAPE  /**< '~' not followed by '0' or '1' */
+};
+
+/**
+ * @brief JSONPath step types.
+ */
+enum {
+  LEPT_PATH_KEY,      /**< .name or ['name'] */
+  LEPT_PATH_INDEX,    /**< [n] */
+  LEPT_PATH_WILDCARD, /**< .* or [*] */
+  LEPT_PATH_FILTER    /**< [?(@.field op literal)] */
+};
+
+/**
+ * @brief JSONPath filter comparisons.
+ */
+enum {
+  LEPT_PATH_EXISTS, /**< [?(@.field)] */
+  LEPT_PATH_EQ,     /**< == */
+  LEPT_PATH_NE,     /**< != */
+  LEPT_PATH_LT,     /**< < */
+  LEPT_PATH_LE,     /**< <= */
+  LEPT_PATH_GT,     /**< > */
+  LEPT_PATH_GE      /**< >= */
+};
+
+/**
+ * @brief Step of a compiled JSONPath expression.
+ */
+typedef struct {
+  int type;           /**< LEPT_PATH_KEY, _INDEX, _WILDCARD or _FILTER */
+  int descendant;     /**< The step follows ".." and applies at any depth */
+  char *key;          /**< Member name of a key step */
+  size_t klen;        /**< Length of the member name */
+  size_t index;       /**< Element index of an index step */
+  lept_pointer field; /**< Field tested by a filter, relative to @ */
+  int op;             /**< Comparison made by a filter */
+  lept_value operand; /**< Literal a filter compares against */
+} lept_path_step;
+
+/**
+ * @brief Compiled JSONPath expression.
+ */
+typedef struct {
+  lept_path_step *steps; /**< Steps applied after the root */
+  size_t count;          /**< Number of steps */
+} lept_path;
+
+/**
+ * @brief JSONPath compilation result codes.
+ */
+enum {
+  LEPT_PATH_OK = 0,        /**< Compilation successful */
+  LEPT_PATH_MISS_ROOT,     /**< Expression not starting with '$' */
+  LEPT_PATH_INVALID_STEP,  /**< Malformed name, index or bracket */
+  LEPT_PATH_INVALID_FILTER /**< Malformed filter expression */
+};
+
+/**
+ * @brief Callback receiving a JSONPath match in a parsed tree.
+ * 
+ * Returning non-zero stops the evaluation.
+ */
+typedef int (*lept_path_callback)(void *ctx, const lept_value *v);
+
+/**
+ * @brief Callback receiving a JSONPath match as a view into JSON text.
+ * 
+ * Returning non-zero stops the evaluation.
+ */
+typedef int (*lept_path_view_callback)(void *ctx, const char *json,
+                                       size_t len);
+
+/**
+ * @brief Cached compiled path of a lept_patcher.
+ */
+typedef struct {
+  char *path;          /**< JSON Pointer string, NULL for an empty slot */
+  size_t len;          /**< Length of the string */
+  lept_pointer pointer; /**< Compiled pointer caching member indices */
+} lept_patch_entry;
+
+/**
+ * @brief Applies many JSON Patches, sharing compiled paths between them.
+ */
+typedef struct {
+  lept_patch_entry *entries; /**< Open-addressed table of compiled paths */
+  size_t size;               /**< Number of cached paths */
+  size_t capacity;           /**< Number of slots, a power of two */
+} lept_patcher;
+
+/**
+ * @brief Iterator over the records of NDJSON (JSON Lines) text.
+ */
+typedef struct {
+  lept_parser parser; /**< Parser whose scratch stack all records share */
+  const char *start;  /**< Start of the input */
+  const char *json;   /**< Start of the next unread line */
+  const char *end;    /**< End of the text, NULL to read up to the NUL */
+  size_t line;        /**< Line of the last record, counting from 1 */
+  size_t offset;      /**< Byte offset of the last record or error */
+} lept_ndjson_reader;
+
+/**
+ * @brief Iterator over concatenated JSON documents.
+ */
+typedef struct {
+  lept_parser parser; /**< Parser whose scratch stack all documents share */
+  const char *start;  /**< Start of the input */
+  const char *json;   /**< End of the last document */
+  size_t offset;      /**< Byte offset of the last document or error */
+  size_t length;      /**< Length of the last document */
+} lept_many_reader;
+
+/**
+ * @brief Malformed NDJSON line.
+ */
+typedef struct {
+  size_t line;   /**< Line number, counting from 1 */
+  size_t offset; /**< Byte offset of the error in the input */
+  int code;      /**< Parsing result */
+} lept_ndjson_error;
+
+/**
+ * @brief Read-only memory mapping of a JSON file.
+ */
+typedef struct {
+  const char *json; /**< File contents followed by a NUL */
+  size_t size;      /**< Size of the file */
+  size_t mapped;    /**< Size of the mapping, 0 for an empty file */
+} lept_file;
+
+/**
+ * @brief JSON Patch result codes.
+ */
+enum {
+  LEPT_PATCH_OK = 0,            /**< Patch applied */
+  LEPT_PATCH_INVALID_OPERATION, /**< Malformed patch or operation */
+  LEPT_PATCH_INVALID_POINTER,   /**< Malformed "path" or "from" */
+  LEPT_PATCH_PATH_NOT_FOUND,    /**< Location does not exist */
+  LEPT_PATCH_TEST_FAILED        /**< "test" operation did not match */
+};
+
+/**
+ * @brief Binary encodings supported by lept_encode() and lept_decode().
+ */
+typedef enum {
+  LEPT_MSGPACK, /**< MessagePack */
+  LEPT_CBOR     /**< CBOR (RFC 8949) */
+} lept_format;
+
+/**
+ * @brief Binary decoding result codes.
+ */
+enum {
+  LEPT_DECODE_OK = 0,         /**< Decoding successful */
+  LEPT_DECODE_TRUNCATED,      /**< Input ends inside a value */
+  LEPT_DECODE_UNSUPPORTED,    /**< Item with no JSON equivalent */
+  LEPT_DECODE_INVALID_KEY,    /**< Map key that is not a string */
+  LEPT_DECODE_TRAILING_DATA,  /**< Bytes left after the root value */
+  LEPT_DECODE_TOO_DEEP        /**< Nesting deeper than LEPT_READER_MAX_DEPTH */
+};
+
 /**
  * @brief JSON parsing result codes.
  */
@@ -78,9 +345,69 @@ enum {
   LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, /**< Missing comma or square bracket */
   LEPT_PARSE_MISS_KEY, /**< Missing key */
   LEPT_PARSE_MISS_COLON, /**< Missing colon */
-  LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET /**< Missing comma or curly bracket */
+  LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, /**< Missing comma or curly bracket */
+  LEPT_PARSE_FILE_ERROR, /**< File could not be opened or mapped */
+  LEPT_PARSE_TOO_DEEP /**< Nesting deeper than LEPT_READER_MAX_DEPTH */
 };
 
+/**
+ * @brief Token types returned by lept_reader_next().
+ */
+typedef enum {
+  LEPT_TOKEN_NULL,         /**< null */
+  LEPT_TOKEN_FALSE,        /**< false */
+  LEPT_TOKEN_TRUE,         /**< true */
+  LEPT_TOKEN_NUMBER,       /**< Number */
+  LEPT_TOKEN_STRING,       /**< String value */
+  LEPT_TOKEN_KEY,          /**< Object member key, including its colon */
+  LEPT_TOKEN_BEGIN_ARRAY,  /**< '[' */
+  LEPT_TOKEN_END_ARRAY,    /**< ']' */
+  LEPT_TOKEN_BEGIN_OBJECT, /**< '{' */
+  LEPT_TOKEN_END_OBJECT    /**< '}' */
+} lept_token_type;
+
+/**
+ * @brief Token of a pull reader, a view into the source text.
+ */
+typedef struct {
+  lept_token_type type; /**< Type of the token */
+  const char *json;     /**< Source text; for strings and keys the escaped
+                             contents without quotes */
+  size_t len;           /**< Length of the source text */
+  double n;             /**< Value of a number */
+} lept_token;
+
+/**
+ * @brief Callback receiving a decoded string one chunk at a time.
+ * 
+ * Returning non-zero stops the decoding.
+ */
+typedef int (*lept_chunk_callback)(void *ctx, const char *s, size_t len);
+
+/**
+ * @brief Pull reader returning one token at a time without allocating.
+ */
+typedef struct {
+  const char *start; /**< Start of the input */
+  const char *json;  /**< Current position */
+  size_t depth;      /**< Number of open containers */
+  size_t offset;     /**< Byte offset of the error, if any */
+  int state;         /**< What the next token may be */
+  int error;         /**< Error that stopped the reader, or LEPT_PARSE_OK */
+  /** Open containers, one bit each, set for an object */
+  unsigned char nest[LEPT_READER_MAX_DEPTH / 8];
+} lept_reader;
+
+/**
+ * @brief Handle to a document that is replaced while threads read it.
+ */
+typedef struct lept_shared lept_shared;
+
+/**
+ * @brief Background thread freeing detached documents.
+ */
+typedef struct lept_reclaimer lept_reclaimer;
+
 /**
  * @brief Initializes a JSON value.
  * 
@@ -89,6 +416,7 @@ enum {
 #define lept_init(v)                                                           \
   do {                                                                         \
     (v)->type = LEPT_NULL;                                                     \
+    (v)->flags = 0;                                                            \
   } while (0)
 
 /**
@@ -100,6 +428,134 @@ enum {
  */
 int lept_parse(lept_value *v, const char *json);
 
+/**
+ * @brief Parses a JSON string with a registered allocator.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @param allocator Allocator id
+ * @return int Parsing result
+ */
+int lept_parse_with_allocator(lept_value *v, const char *json, int allocator);
+
+/**
+ * @brief Parses a JSON string into an existing value, reusing its allocations.
+ * 
+ * @param v Initialized JSON value to be parsed into
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_reparse(lept_value *v, const char *json);
+
+/**
+ * @brief Validates a JSON string and parses its values on demand.
+ * 
+ * Strings, numbers, arrays and objects are built the first time they are
+ * accessed; json must outlive the value.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_parse_lazy(lept_value *v, const char *json);
+
+/**
+ * @brief Parses a JSON string whose root is an array on several threads.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @param threads Number of threads to use
+ * @return int Parsing result
+ */
+int lept_parse_parallel(lept_value *v, const char *json, size_t threads);
+
+/**
+ * @brief Initializes a pull reader over a JSON string.
+ * 
+ * @param r Reader
+ * @param json JSON string, which must outlive the reader
+ */
+void lept_reader_init(lept_reader *r, const char *json);
+
+/**
+ * @brief Reads the next token.
+ * 
+ * @param r Reader
+ * @param t Receives the token
+ * @return int LEPT_PARSE_OK, a parse error, or LEPT_READER_END
+ */
+int lept_reader_next(lept_reader *r, lept_token *t);
+
+/**
+ * @brief Skips the next value, validating it without building it.
+ * 
+ * @param r Reader
+ * @return int LEPT_PARSE_OK, a parse error, or LEPT_READER_END
+ */
+int lept_reader_skip(lept_reader *r);
+
+/**
+ * @brief Decodes the escapes of a string or key token.
+ * 
+ * @param t String or key token
+ * @param buf Buffer of at least t->len + 1 bytes
+ * @return size_t Length of the decoded string, which is NUL-terminated
+ */
+size_t lept_token_string(const lept_token *t, char *buf);
+
+/**
+ * @brief Decodes a string or key token in bounded chunks.
+ * 
+ * @param t String or key token
+ * @param buf Scratch buffer for decoded escapes
+ * @param size Size of buf and largest chunk, at least 4
+ * @param cb Callback receiving each chunk
+ * @param ctx User data passed to the callback
+ * @return int 0, or the non-zero value that stopped the callback
+ */
+int lept_token_string_chunked(const lept_token *t, char *buf, size_t size,
+                              lept_chunk_callback cb, void *ctx);
+
+/**
+ * @brief Maps a file into memory for parsing in place.
+ * 
+ * @param f File mapping
+ * @param path Path of the file
+ * @param flags LEPT_FILE_* flags
+ * @return int 0 on success, -1 if the file could not be opened or mapped
+ */
+int lept_file_map(lept_file *f, const char *path, int flags);
+
+/**
+ * @brief Unmaps a file mapped by lept_file_map().
+ * 
+ * @param f File mapping
+ */
+void lept_file_unmap(lept_file *f);
+
+/**
+ * @brief Parses a JSON file directly from a memory mapping.
+ * 
+ * @param v JSON value to be parsed
+ * @param path Path of the file
+ * @param flags LEPT_FILE_* flags
+ * @return int Parsing result, or LEPT_PARSE_FILE_ERROR
+ */
+int lept_parse_file(lept_value *v, const char *path, int flags);
+
+/**
+ * @brief Parses only the parts of a JSON string selected by a projection.
+ * 
+ * Everything else is validated and skipped without being built.
+ * 
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @param p Projection
+ * @return int Parsing result
+ */
+int lept_parse_projected(lept_value *v, const char *json,
+                         const lept_projection *p);
+
 /**
  * @brief Stringifies a JSON value.
  * 
@@ -109,6 +565,18 @@ int lept_parse(lept_value *v, const char *json);
  */
 char *lept_stringify(const lept_value *v, size_t *length);
 
+/**
+ * @brief Stringifies a JSON value in canonical form.
+ * 
+ * Members are sorted bytewise by key and numbers use their shortest
+ * round-trip form, so equal values always produce the same bytes.
+ * 
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return char* Stringified JSON value
+ */
+char *lept_stringify_canonical(const lept_value *v, size_t *length);
+
 /**
  * @brief Copies a JSON value.
  * 
@@ -117,6 +585,16 @@ char *lept_stringify(const lept_value *v, size_t *length);
  */
 void lept_copy(lept_value *dst, const lept_value *src);
 
+/**
+ * @brief Copies a JSON value on several threads.
+ * 
+ * @param dst Destination JSON value
+ * @param src Source JSON value
+ * @param threads Number of threads to use
+ */
+void lept_copy_parallel(lept_value *dst, const lept_value *src,
+                        size_t threads);
+
 /**
  * @brief Moves a JSON value.
  * 
@@ -157,6 +635,17 @@ lept_type lept_get_type(const lept_value *v);
  */
 int lept_is_equal(const lept_value *lhs, const lept_value *rhs);
 
+/**
+ * @brief Checks if two JSON values are equal on several threads.
+ * 
+ * @param lhs Left-hand side JSON value
+ * @param rhs Right-hand side JSON value
+ * @param threads Number of threads to use
+ * @return int 1 if equal, 0 otherwise
+ */
+int lept_is_equal_parallel(const lept_value *lhs, const lept_value *rhs,
+                           size_t threads);
+
 /**
  * @brief Sets a JSON value to null.
  * 
@@ -276,6 +765,18 @@ void lept_clear_array(lept_value *v);
  */
 lept_value *lept_get_array_element(const lept_value *v, size_t index);
 
+/**
+ * @brief Gets an element of the array value of a JSON value without
+ * modifying the array.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @param view Receives the element of a packed array
+ * @return const lept_value* Pointer to the element or to the view
+ */
+const lept_value *lept_view_array_element(const lept_value *v, size_t index,
+                                          lept_value *view);
+
 /**
  * @brief Pushes back an element to the array value of a JSON value.
  * 
@@ -309,6 +810,39 @@ lept_value *lept_insert_array_element(lept_value *v, size_t index);
  */
 void lept_erase_array_element(lept_value *v, size_t index, size_t count);
 
+/**
+ * @brief Gets the packed numbers of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @return double* Numbers of the array, or NULL if the array is not packed
+ */
+double *lept_get_array_numbers(const lept_value *v);
+
+/**
+ * @brief Gets a number element of the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param index Index of the element
+ * @return double Number value of the element
+ */
+double lept_get_array_number(const lept_value *v, size_t index);
+
+/**
+ * @brief Pushes back a number to the array value of a JSON value.
+ * 
+ * @param v JSON value
+ * @param n Number value
+ */
+void lept_pushback_array_number(lept_value *v, double n);
+
+/**
+ * @brief Converts the array value of a JSON value to the packed representation.
+ * 
+ * @param v JSON value
+ * @return int 1 if the array is packed, 0 if it holds non-number elements
+ */
+int lept_pack_array(lept_value *v);
+
 /**
  * @brief Sets the object value of a JSON value.
  * 
@@ -383,42 +917,684 @@ size_t lept_get_object_key_length(const lept_value *v, size_t index);
 lept_value *lept_get_object_value(const lept_value *v, size_t index);
 
 /**
- * @brief Finds the index of an object member by key.
+ * @brief Finalizes a JSON value into a read-only form that any number of
+ * threads may read without locks.
  * 
  * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return size_t Index of the member, or LEPT_KEY_NOT_EXIST if not found
  */
-size_t lept_find_object_index(const lept_value *v, const char *key,
-                              size_t klen);
+void lept_freeze(lept_value *v);
 
 /**
- * @brief Finds the value of an object member by key.
+ * @brief Checks whether a JSON value has been frozen by lept_freeze().
  * 
  * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return lept_value* Value of the member, or NULL if not found
+ * @return int 1 if frozen, 0 otherwise
  */
-lept_value *lept_find_object_value(lept_value *v, const char *key, size_t klen);
+int lept_is_frozen(const lept_value *v);
 
 /**
- * @brief Sets the value of an object member by key.
+ * @brief Creates a shared document handle with no published version.
  * 
- * @param v JSON value
- * @param key Key of the member
- * @param klen Length of the key
- * @return lept_value* Value of the member
+ * @param readers Maximum number of readers registered at once
+ * @return lept_shared* Shared handle
  */
-lept_value *lept_set_object_value(lept_value *v, const char *key, size_t klen);
+lept_shared *lept_shared_new(int readers);
 
 /**
- * @brief Removes an object member by index.
+ * @brief Frees a shared handle and every version it holds. No reader may be
+ * active.
  * 
- * @param v JSON value
- * @param index Index of the member
+ * @param s Shared handle
  */
-void lept_remove_object_value(lept_value *v, size_t index);
+void lept_shared_free(lept_shared *s);
+
+/**
+ * @brief Registers a reader thread with a shared handle.
+ * 
+ * @param s Shared handle
+ * @return int Reader id, or -1 if all slots are taken
+ */
+int lept_shared_register(lept_shared *s);
+
+/**
+ * @brief Unregisters a reader, releasing any snapshot it still holds.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ */
+void lept_shared_unregister(lept_shared *s, int reader);
+
+/**
+ * @brief Acquires a snapshot of the latest version without locking.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ * @return const lept_value* Frozen document, valid until
+ * lept_shared_release(), or NULL if nothing has been published
+ */
+const lept_value *lept_shared_acquire(lept_shared *s, int reader);
+
+/**
+ * @brief Releases the snapshot of a reader.
+ * 
+ * @param s Shared handle
+ * @param reader Reader id
+ */
+void lept_shared_release(lept_shared *s, int reader);
+
+/**
+ * @brief Publishes a new version, taking ownership of the value.
+ * 
+ * @param s Shared handle
+ * @param v JSON value, moved into the handle and left null
+ */
+void lept_shared_publish(lept_shared *s, lept_value *v);
+
+/**
+ * @brief Frees the replaced versions that no reader holds any more.
+ * 
+ * @param s Shared handle
+ */
+void lept_shared_collect(lept_shared *s);
+
+/**
+ * @brief Starts a reclaimer thread.
+ * 
+ * @return lept_reclaimer* Reclaimer, or NULL if the thread could not be
+ * created
+ */
+lept_reclaimer *lept_reclaimer_new(void);
+
+/**
+ * @brief Frees every pending document, then stops the reclaimer thread and
+ * frees the reclaimer.
+ * 
+ * @param r Reclaimer
+ */
+void lept_reclaimer_free(lept_reclaimer *r);
+
+/**
+ * @brief Waits until every document handed to a reclaimer has been freed.
+ * 
+ * @param r Reclaimer
+ */
+void lept_reclaimer_drain(lept_reclaimer *r);
+
+/**
+ * @brief Detaches a JSON value and frees it on the reclaimer thread.
+ * 
+ * @param r Reclaimer, or NULL to free on the calling thread
+ * @param v JSON value, left null
+ */
+void lept_free_async(lept_reclaimer *r, lept_value *v);
+
+/**
+ * @brief Detaches several JSON values and frees them together on the
+ * reclaimer thread.
+ * 
+ * @param r Reclaimer, or NULL to free on the calling thread
+ * @param values JSON values, left null
+ * @param count Number of values
+ */
+void lept_free_batch(lept_reclaimer *r, lept_value *values, size_t count);
+
+/**
+ * @brief Finds the index of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return size_t Index of the member, or LEPT_KEY_NOT_EXIST if not found
+ */
+size_t lept_find_object_index(const lept_value *v, const char *key,
+                              size_t klen);
+
+/**
+ * @brief Finds the value of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member, or NULL if not found
+ */
+lept_value *lept_find_object_value(lept_value *v, const char *key, size_t klen);
+
+/**
+ * @brief Sets the value of an object member by key.
+ * 
+ * @param v JSON value
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member
+ */
+lept_value *lept_set_object_value(lept_value *v, const char *key, size_t klen);
+
+/**
+ * @brief Removes an object member by index.
+ * 
+ * @param v JSON value
+ * @param index Index of the member
+ */
+void lept_remove_object_value(lept_value *v, size_t index);
+
+/**
+ * @brief Initializes an object builder.
+ * 
+ * @param b Object builder
+ */
+void lept_object_builder_init(lept_object_builder *b);
+
+/**
+ * @brief Appends a member to an object builder.
+ * 
+ * @param b Object builder
+ * @param key Key of the member
+ * @param klen Length of the key
+ * @return lept_value* Value of the member
+ */
+lept_value *lept_object_builder_add(lept_object_builder *b, const char *key,
+                                    size_t klen);
+
+/**
+ * @brief Commits the pending members of an object builder into a JSON value.
+ * 
+ * @param b Object builder
+ * @param v JSON value to receive the object
+ */
+void lept_object_builder_commit(lept_object_builder *b, lept_value *v);
+
+/**
+ * @brief Frees an object builder.
+ * 
+ * @param b Object builder
+ */
+void lept_object_builder_free(lept_object_builder *b);
+
+/**
+ * @brief Initializes a reusable parser.
+ * 
+ * @param p Parser
+ */
+void lept_parser_init(lept_parser *p);
+
+/**
+ * @brief Parses a JSON string, reusing the scratch stack of the parser.
+ * 
+ * @param p Parser
+ * @param v JSON value to be parsed
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_parser_parse(lept_parser *p, lept_value *v, const char *json);
+
+/**
+ * @brief Parses a JSON string into an existing value with a parser.
+ * 
+ * @param p Parser
+ * @param v Initialized JSON value to be parsed into
+ * @param json JSON string to be parsed
+ * @return int Parsing result
+ */
+int lept_parser_reparse(lept_parser *p, lept_value *v, const char *json);
+
+/**
+ * @brief Frees the scratch stack of a parser.
+ * 
+ * @param p Parser
+ */
+void lept_parser_free(lept_parser *p);
+
+/**
+ * @brief Initializes a reusable writer.
+ * 
+ * @param w Writer
+ */
+void lept_writer_init(lept_writer *w);
+
+/**
+ * @brief Stringifies a JSON value into the buffer of a writer.
+ * 
+ * @param w Writer
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return const char* Stringified JSON value, valid until the next call
+ */
+const char *lept_writer_stringify(lept_writer *w, const lept_value *v,
+                                  size_t *length);
+
+/**
+ * @brief Stringifies a JSON value in canonical form into the buffer of a
+ * writer.
+ * 
+ * @param w Writer
+ * @param v JSON value to be stringified
+ * @param length Pointer to the length of the stringified value
+ * @return const char* Stringified JSON value, valid until the next call
+ */
+const char *lept_writer_stringify_canonical(lept_writer *w,
+                                            const lept_value *v,
+                                            size_t *length);
+
+/**
+ * @brief Frees the buffers of a writer.
+ * 
+ * @param w Writer
+ */
+void lept_writer_free(lept_writer *w);
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR.
+ * 
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param length Receives the length of the encoding
+ * @return char* Encoding, to be released with the default allocator
+ */
+char *lept_encode(const lept_value *v, lept_format format, size_t *length);
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR into the buffer of a
+ * writer.
+ * 
+ * @param w Writer
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param length Receives the length of the encoding
+ * @return const char* Encoding, valid until the next call
+ */
+const char *lept_writer_encode(lept_writer *w, const lept_value *v,
+                               lept_format format, size_t *length);
+
+/**
+ * @brief Encodes a JSON value as MessagePack or CBOR into a caller buffer.
+ * 
+ * @param v JSON value to be encoded
+ * @param format Binary encoding
+ * @param buf Buffer
+ * @param size Size of the buffer
+ * @return size_t Length of the encoding, which is in buf only if it is at
+ * most size
+ */
+size_t lept_encode_buffer(const lept_value *v, lept_format format, char *buf,
+                          size_t size);
+
+/**
+ * @brief Decodes MessagePack or CBOR into a JSON value.
+ * 
+ * @param v Initialized JSON value, whose allocator is used
+ * @param data Encoded data
+ * @param len Length of the data
+ * @param format Binary encoding
+ * @return int Decoding result
+ */
+int lept_decode(lept_value *v, const char *data, size_t len,
+                lept_format format);
+
+/**
+ * @brief Serializes a JSON value as a binary tape, which can be read in
+ * place with the lept_tape_* accessors.
+ * 
+ * @param v JSON value
+ * @param length Receives the length of the tape
+ * @return char* Tape, to be released with the default allocator
+ */
+char *lept_tape_encode(const lept_value *v, size_t *length);
+
+/**
+ * @brief Checks a tape and returns its root node.
+ * 
+ * @param tape Tape, e.g. mapped by lept_file_map()
+ * @param length Length of the tape
+ * @return const char* Root node, or NULL if the tape is invalid
+ */
+const char *lept_tape_root(const char *tape, size_t length);
+
+/**
+ * @brief Gets the type of a tape node.
+ * 
+ * @param node Node
+ * @return lept_type Type
+ */
+lept_type lept_tape_get_type(const char *node);
+
+/**
+ * @brief Gets the boolean value of a tape node.
+ * 
+ * @param node Boolean node
+ * @return int Boolean value (0 or 1)
+ */
+int lept_tape_get_boolean(const char *node);
+
+/**
+ * @brief Gets the number value of a tape node.
+ * 
+ * @param node Number node
+ * @return double Number
+ */
+double lept_tape_get_number(const char *node);
+
+/**
+ * @brief Gets the string of a tape node.
+ * 
+ * @param node String node
+ * @return const char* NUL-terminated string inside the tape
+ */
+const char *lept_tape_get_string(const char *node);
+
+/**
+ * @brief Gets the length of the string of a tape node.
+ * 
+ * @param node String node
+ * @return size_t Length
+ */
+size_t lept_tape_get_string_length(const char *node);
+
+/**
+ * @brief Gets the size of an array node.
+ * 
+ * @param node Array node
+ * @return size_t Number of elements
+ */
+size_t lept_tape_get_array_size(const char *node);
+
+/**
+ * @brief Gets an element of an array node.
+ * 
+ * @param node Array node
+ * @param index Index
+ * @return const char* Element node
+ */
+const char *lept_tape_get_array_element(const char *node, size_t index);
+
+/**
+ * @brief Gets the size of an object node.
+ * 
+ * @param node Object node
+ * @return size_t Number of members
+ */
+size_t lept_tape_get_object_size(const char *node);
+
+/**
+ * @brief Gets a key of an object node, in document order.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return const char* NUL-terminated key inside the tape
+ */
+const char *lept_tape_get_object_key(const char *node, size_t index);
+
+/**
+ * @brief Gets the length of a key of an object node.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return size_t Length
+ */
+size_t lept_tape_get_object_key_length(const char *node, size_t index);
+
+/**
+ * @brief Gets a value of an object node, in document order.
+ * 
+ * @param node Object node
+ * @param index Index
+ * @return const char* Value node
+ */
+const char *lept_tape_get_object_value(const char *node, size_t index);
+
+/**
+ * @brief Finds the value of a key in an object node by binary search.
+ * 
+ * @param node Object node
+ * @param key Key
+ * @param klen Length of the key
+ * @return const char* Value node, or NULL if the key is absent
+ */
+const char *lept_tape_find_object_value(const char *node, const char *key,
+                                        size_t klen);
+
+/**
+ * @brief Sets the global default allocator.
+ * 
+ * @param a Allocator, or NULL to restore the standard library functions
+ */
+void lept_set_allocator(const lept_allocator *a);
+
+/**
+ * @brief Registers an allocator for per-parse or per-document use.
+ * 
+ * @param a Allocator
+ * @return int Allocator id, or -1 if the registry is full
+ */
+int lept_register_allocator(const lept_allocator *a);
+
+/**
+ * @brief Initializes a JSON value whose buffers come from an allocator.
+ * 
+ * @param v JSON value to be initialized
+ * @param allocator Allocator id
+ */
+void lept_init_with_allocator(lept_value *v, int allocator);
+
+/**
+ * @brief Compiles a JSON Pointer (RFC 6901).
+ * 
+ * @param p Pointer to be compiled
+ * @param path JSON Pointer string
+ * @param len Length of the string
+ * @param flags LEPT_POINTER_CACHE or 0
+ * @return int LEPT_POINTER_OK or an error code
+ */
+int lept_pointer_compile(lept_pointer *p, const char *path, size_t len,
+                         int flags);
+
+/**
+ * @brief Evaluates a compiled JSON Pointer against a JSON value.
+ * 
+ * @param p Compiled pointer
+ * @param v JSON value
+ * @return lept_value* Referenced value, or NULL if it does not exist
+ */
+lept_value *lept_pointer_get(lept_pointer *p, const lept_value *v);
+
+/**
+ * @brief Frees a compiled JSON Pointer.
+ * 
+ * @param p Compiled pointer
+ */
+void lept_pointer_free(lept_pointer *p);
+
+/**
+ * @brief Initializes an empty projection, which selects nothing.
+ * 
+ * @param p Projection
+ */
+void lept_projection_init(lept_projection *p);
+
+/**
+ * @brief Adds a path to keep to a projection.
+ * 
+ * @param p Projection
+ * @param path JSON Pointer of the value to keep, "*" matching any token
+ * @param len Length of the path
+ * @return int LEPT_POINTER_OK or an error code
+ */
+int lept_projection_add(lept_projection *p, const char *path, size_t len);
+
+/**
+ * @brief Frees a projection.
+ * 
+ * @param p Projection
+ */
+void lept_projection_free(lept_projection *p);
+
+/**
+ * @brief Compiles a JSONPath expression into a reusable plan.
+ * 
+ * @param p Plan to be compiled
+ * @param expr JSONPath expression
+ * @return int LEPT_PATH_OK or an error code
+ */
+int lept_path_compile(lept_path *p, const char *expr);
+
+/**
+ * @brief Evaluates a compiled JSONPath plan over a parsed tree.
+ * 
+ * @param p Compiled plan
+ * @param v Root JSON value
+ * @param cb Callback receiving each match
+ * @param ctx User data passed to the callback
+ * @return size_t Number of matches reported
+ */
+size_t lept_path_eval(const lept_path *p, const lept_value *v,
+                      lept_path_callback cb, void *ctx);
+
+/**
+ * @brief Evaluates a compiled JSONPath plan directly over JSON text.
+ * 
+ * @param p Compiled plan
+ * @param json JSON string
+ * @param cb Callback receiving each match as a view into json
+ * @param ctx User data passed to the callback
+ * @param count Receives the number of matches reported, may be NULL
+ * @return int Parsing result
+ */
+int lept_path_eval_text(const lept_path *p, const char *json,
+                        lept_path_view_callback cb, void *ctx,
+                        size_t *count);
+
+/**
+ * @brief Frees a compiled JSONPath plan.
+ * 
+ * @param p Compiled plan
+ */
+void lept_path_free(lept_path *p);
+
+/**
+ * @brief Applies a JSON Patch (RFC 6902) in place.
+ * 
+ * @param doc Document to be patched in place
+ * @param patch JSON Patch, an array of operations
+ * @return int LEPT_PATCH_OK or the error of the first failing operation
+ */
+int lept_patch(lept_value *doc, const lept_value *patch);
+
+/**
+ * @brief Initializes a patcher with an empty path cache.
+ * 
+ * @param p Patcher
+ */
+void lept_patcher_init(lept_patcher *p);
+
+/**
+ * @brief Applies a JSON Patch with a patcher, reusing its compiled paths.
+ * 
+ * @param p Patcher
+ * @param doc Document to be patched in place
+ * @param patch JSON Patch, an array of operations
+ * @return int LEPT_PATCH_OK or the error of the first failing operation
+ */
+int lept_patcher_apply(lept_patcher *p, lept_value *doc,
+                       const lept_value *patch);
+
+/**
+ * @brief Frees a patcher and its compiled paths.
+ * 
+ * @param p Patcher
+ */
+void lept_patcher_free(lept_patcher *p);
+
+/**
+ * @brief Applies a JSON Merge Patch (RFC 7386) in place.
+ * 
+ * @param target Document to be patched in place
+ * @param patch Merge patch
+ */
+void lept_merge_patch(lept_value *target, const lept_value *patch);
+
+/**
+ * @brief Computes a JSON Patch that turns one document into another.
+ * 
+ * @param patch Receives the JSON Patch, an array of operations
+ * @param a Source document
+ * @param b Target document
+ */
+void lept_diff(lept_value *patch, const lept_value *a, const lept_value *b);
+
+/**
+ * @brief Initializes a reader over NDJSON text.
+ * 
+ * @param r Reader
+ * @param json NDJSON text, which must outlive the reader
+ */
+void lept_ndjson_init(lept_ndjson_reader *r, const char *json);
+
+/**
+ * @brief Parses the next record into an existing value, reusing its
+ * allocations.
+ * 
+ * @param r Reader
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result of the record, or LEPT_NDJSON_END
+ */
+int lept_ndjson_next(lept_ndjson_reader *r, lept_value *v);
+
+/**
+ * @brief Frees the scratch stack of a reader.
+ * 
+ * @param r Reader
+ */
+void lept_ndjson_free(lept_ndjson_reader *r);
+
+/**
+ * @brief Parses every record of NDJSON text into an array.
+ * 
+ * @param docs Initialized JSON value receiving the array of records
+ * @param json NDJSON text
+ * @param errors Receives the first malformed lines, may be NULL
+ * @param max_errors Capacity of errors
+ * @return size_t Number of malformed lines
+ */
+size_t lept_parse_ndjson(lept_value *docs, const char *json,
+                         lept_ndjson_error *errors, size_t max_errors);
+
+/**
+ * @brief Parses every record of NDJSON text into an array on several
+ * threads.
+ * 
+ * @param docs Initialized JSON value receiving the array of records
+ * @param json NDJSON text
+ * @param threads Number of threads to use
+ * @param errors Receives the first malformed lines, may be NULL
+ * @param max_errors Capacity of errors
+ * @return size_t Number of malformed lines
+ */
+size_t lept_parse_ndjson_parallel(lept_value *docs, const char *json,
+                                  size_t threads, lept_ndjson_error *errors,
+                                  size_t max_errors);
+
+/**
+ * @brief Initializes a reader over concatenated JSON documents.
+ * 
+ * @param r Reader
+ * @param json JSON text, which must outlive the reader
+ */
+void lept_many_init(lept_many_reader *r, const char *json);
+
+/**
+ * @brief Parses the next document into an existing value, reusing its
+ * allocations.
+ * 
+ * @param r Reader
+ * @param v Initialized JSON value to be parsed into
+ * @return int Parsing result of the document, or LEPT_MANY_END
+ */
+int lept_parse_many(lept_many_reader *r, lept_value *v);
+
+/**
+ * @brief Frees the scratch stack of a reader.
+ * 
+ * @param r Reader
+ */
+void lept_many_free(lept_many_reader *r);
 
 #endif
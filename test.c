@@ -1,5 +1,6 @@
 #include "leptjson.h"
 #include <float.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -229,6 +230,88 @@ static void test_parse_array() {
   lept_free(&v);
 }
 
+static int test_packed_sum(void *ctx, const lept_value *v) {
+  *(double *)ctx += lept_get_number(v);
+  return 0;
+}
+
+static void test_parse_packed_array() {
+  printf("test_parse_packed_array:\n");
+  static const char json[] =
+      "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19.5]";
+  lept_value v, v2;
+  double *n;
+  size_t i;
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+  EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&v));
+  EXPECT_EQ_SIZE_T(20, lept_get_array_size(&v));
+  n = lept_get_array_numbers(&v);
+  EXPECT_TRUE(n != NULL);
+  for (i = 0; i < 19; i++) {
+    EXPECT_EQ_DOUBLE((double)i, n[i]);
+    EXPECT_EQ_DOUBLE((double)i, lept_get_array_number(&v, i));
+  }
+  EXPECT_EQ_DOUBLE(19.5, n[19]);
+
+  lept_init(&v2);
+  lept_copy(&v2, &v);
+  EXPECT_TRUE(lept_get_array_numbers(&v2) != NULL);
+  EXPECT_TRUE(lept_is_equal(&v, &v2));
+
+  lept_pushback_array_number(&v, 20.0);
+  EXPECT_TRUE(lept_get_array_numbers(&v) != NULL);
+  EXPECT_EQ_SIZE_T(21, lept_get_array_size(&v));
+  EXPECT_FALSE(lept_is_equal(&v, &v2));
+  lept_popback_array_element(&v);
+  lept_erase_array_element(&v, 0, 1);
+  lept_set_number(lept_insert_array_element(&v, 0), 0.0);
+  EXPECT_TRUE(lept_get_array_numbers(&v) == NULL); /* unpacked on insert */
+  EXPECT_TRUE(lept_is_equal(&v, &v2));
+  EXPECT_TRUE(lept_is_equal(&v2, &v));
+
+  lept_set_string(lept_pushback_array_element(&v2), "x", 1);
+  EXPECT_TRUE(lept_get_array_numbers(&v2) == NULL);
+  EXPECT_EQ_INT(LEPT_STRING, lept_get_type(lept_get_array_element(&v2, 20)));
+  EXPECT_EQ_DOUBLE(19.5, lept_get_number(lept_get_array_element(&v2, 19)));
+  EXPECT_FALSE(lept_pack_array(&v2));
+  lept_popback_array_element(&v2);
+  EXPECT_TRUE(lept_pack_array(&v2));
+  EXPECT_TRUE(lept_get_array_numbers(&v2) != NULL);
+  EXPECT_TRUE(lept_is_equal(&v, &v2));
+
+  /* Read-only access leaves the array packed */
+  {
+    lept_value view, patch;
+    lept_path p;
+    double sum = 0;
+    size_t count;
+    EXPECT_EQ_DOUBLE(19.5,
+                     lept_get_number(lept_view_array_element(&v2, 19, &view)));
+    EXPECT_EQ_INT(LEPT_PATH_OK, lept_path_compile(&p, "$[?(@ >= 18)]"));
+    count = lept_path_eval(&p, &v2, test_packed_sum, &sum);
+    EXPECT_EQ_SIZE_T(2, count);
+    EXPECT_EQ_DOUBLE(37.5, sum);
+    lept_path_free(&p);
+    lept_pushback_array_number(&v, 21.0);
+    lept_init(&patch);
+    lept_diff(&patch, &v2, &v);
+    EXPECT_EQ_SIZE_T(1, lept_get_array_size(&patch));
+    lept_free(&patch);
+    EXPECT_TRUE(lept_get_array_numbers(&v2) != NULL);
+  }
+
+  lept_free(&v);
+  lept_free(&v2);
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,null]"));
+  EXPECT_TRUE(lept_get_array_numbers(&v) == NULL);
+  lept_free(&v);
+}
+
 static void test_parse_object() {
   printf("test_parse_object:\n");
   lept_value v;
@@ -628,6 +711,65 @@ static void test_access_object() {
   lept_free(&o);
 }
 
+static void test_access_object_builder() {
+  printf("test_access_object_builder:\n");
+  lept_object_builder b;
+  lept_value o, *pv;
+  size_t i, j;
+
+  lept_init(&o);
+  lept_object_builder_init(&b);
+  for (j = 0; j < 2; j++) {
+    for (i = 0; i < 100; i++) {
+      char key[4];
+      sprintf(key, "k%zu", i);
+      lept_set_number(lept_object_builder_add(&b, key, strlen(key)), i);
+    }
+    lept_object_builder_commit(&b, &o);
+    EXPECT_EQ_SIZE_T(100, lept_get_object_size(&o));
+    EXPECT_EQ_SIZE_T(100, lept_get_object_capacity(&o));
+    EXPECT_EQ_STRING("k42", lept_get_object_key(&o, 42),
+                     strlen(lept_get_object_key(&o, 42)));
+    pv = lept_find_object_value(&o, "k99", 3);
+    EXPECT_TRUE(pv != NULL);
+    EXPECT_EQ_DOUBLE(99.0, lept_get_number(pv));
+  }
+
+  lept_set_string(lept_object_builder_add(&b, "pending", 7), "x", 1);
+  lept_object_builder_free(&b); /* Test if pending members are freed */
+  lept_free(&o);
+}
+
+static void test_access_growth() {
+  printf("test_access_growth:\n");
+  lept_value a, o;
+  size_t i;
+
+  lept_init(&a);
+  lept_set_array(&a, 0);
+  for (i = 0; i < 1000; i++) {
+    lept_set_number(lept_insert_array_element(&a, 0), i);
+  }
+  EXPECT_EQ_SIZE_T(1000, lept_get_array_size(&a));
+  EXPECT_EQ_SIZE_T(1024, lept_get_array_capacity(&a));
+  EXPECT_EQ_DOUBLE(999.0, lept_get_number(lept_get_array_element(&a, 0)));
+  EXPECT_EQ_DOUBLE(0.0, lept_get_number(lept_get_array_element(&a, 999)));
+  lept_free(&a);
+
+  lept_init(&o);
+  lept_set_object(&o, 0);
+  for (i = 0; i < 1000; i++) {
+    char key[8];
+    sprintf(key, "%zu", i);
+    lept_set_number(lept_set_object_value(&o, key, strlen(key)), i);
+  }
+  EXPECT_EQ_SIZE_T(1000, lept_get_object_size(&o));
+  EXPECT_EQ_SIZE_T(1024, lept_get_object_capacity(&o));
+  EXPECT_EQ_STRING("999", lept_get_object_key(&o, 999),
+                   strlen(lept_get_object_key(&o, 999)));
+  lept_free(&o);
+}
+
 static void test_access() {
   test_access_null();
   test_access_boolean();
@@ -635,6 +777,8 @@ static void test_access() {
   test_access_string();
   test_access_array();
   test_access_object();
+  test_access_object_builder();
+  test_access_growth();
 }
 
 static void test_stringify_number() {
@@ -674,6 +818,8 @@ static void test_stringify_array() {
   printf("test_stringify_array:\n");
   TEST_ROUNDTRIP("[]");
   TEST_ROUNDTRIP("[null,false,true,123,\"abc\",[1,2,3]]");
+  TEST_ROUNDTRIP("[0,-1,2.5,1e+20,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,"
+                 "-1.7976931348623157e+308,4.9406564584124654e-324]");
 }
 
 static void test_stringify_object() {
@@ -683,6 +829,47 @@ static void test_stringify_object() {
                  "\"a\":[1,2,3],\"o\":{\"1\":1,\"2\":2,\"3\":3}}");
 }
 
+static void test_parser() {
+  printf("test_parser:\n");
+  lept_parser p;
+  lept_writer w;
+  lept_value v;
+  const char *json, *first;
+  size_t length, size;
+
+  lept_parser_init(&p);
+  lept_writer_init(&w);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parser_parse(&p, &v, "{\"a\":[1,2,\"x\"],\"b\":null}"));
+  EXPECT_TRUE(p.stack != NULL);
+  size = p.size;
+  first = json = lept_writer_stringify(&w, &v, &length);
+  EXPECT_EQ_STRING("{\"a\":[1,2,\"x\"],\"b\":null}", json, length);
+  lept_free(&v);
+
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(&p, &v, "[\"abc\", {}]"));
+  EXPECT_EQ_SIZE_T(size, p.size); /* stack is reused */
+  json = lept_writer_stringify(&w, &v, &length);
+  EXPECT_TRUE(json == first);
+  EXPECT_EQ_STRING("[\"abc\",{}]", json, length);
+  lept_free(&v);
+
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_KEY, lept_parser_parse(&p, &v, "{1:1}"));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+
+  p.max_retained = 0;
+  w.max_retained = 0;
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parser_parse(&p, &v, "[\"abc\"]"));
+  EXPECT_TRUE(p.stack == NULL);
+  json = lept_writer_stringify(&w, &v, &length);
+  EXPECT_EQ_STRING("[\"abc\"]", json, length);
+  lept_free(&v);
+
+  lept_parser_free(&p);
+  lept_writer_free(&w);
+}
+
 static void test_equal() {
   printf("test_equal:\n");
   TEST_EQUAL("true", "true", 1);
@@ -750,6 +937,1120 @@ static void test_swap() {
   lept_free(&v2);
 }
 
+typedef struct {
+  size_t blocks;     /* live blocks */
+  size_t calls;      /* total malloc and realloc calls */
+  size_t mismatches; /* frees or reallocs with a wrong size */
+} test_allocator_stats;
+
+static void *test_malloc(void *ctx, size_t size) {
+  test_allocator_stats *stats = (test_allocator_stats *)ctx;
+  size_t *p = (size_t *)malloc(sizeof(size_t) * 2 + size);
+  stats->blocks++;
+  stats->calls++;
+  p[0] = size;
+  return p + 2;
+}
+
+static void *test_realloc(void *ctx, void *ptr, size_t old_size,
+                          size_t new_size) {
+  test_allocator_stats *stats = (test_allocator_stats *)ctx;
+  size_t *p = (size_t *)ptr - 2;
+  stats->calls++;
+  stats->mismatches += p[0] != old_size;
+  p = (size_t *)realloc(p, sizeof(size_t) * 2 + new_size);
+  p[0] = new_size;
+  return p + 2;
+}
+
+static void test_free(void *ctx, void *ptr, size_t size) {
+  test_allocator_stats *stats = (test_allocator_stats *)ctx;
+  size_t *p = (size_t *)ptr - 2;
+  stats->blocks--;
+  stats->mismatches += p[0] != size;
+  free(p);
+}
+
+static pthread_mutex_t test_allocator_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The same allocator, safe to call from several threads */
+static void *test_locked_malloc(void *ctx, size_t size) {
+  void *p;
+  pthread_mutex_lock(&test_allocator_lock);
+  p = test_malloc(ctx, size);
+  pthread_mutex_unlock(&test_allocator_lock);
+  return p;
+}
+
+static void *test_locked_realloc(void *ctx, void *ptr, size_t old_size,
+                                 size_t new_size) {
+  void *p;
+  pthread_mutex_lock(&test_allocator_lock);
+  p = test_realloc(ctx, ptr, old_size, new_size);
+  pthread_mutex_unlock(&test_allocator_lock);
+  return p;
+}
+
+static void test_locked_free(void *ctx, void *ptr, size_t size) {
+  pthread_mutex_lock(&test_allocator_lock);
+  test_free(ctx, ptr, size);
+  pthread_mutex_unlock(&test_allocator_lock);
+}
+
+static void test_allocator() {
+  printf("test_allocator:\n");
+  test_allocator_stats stats = {0, 0, 0};
+  static lept_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  lept_object_builder b;
+  lept_value v, v2, *pv;
+  char *json;
+  size_t length;
+  int id;
+
+  a.ctx = &stats;
+  id = lept_register_allocator(&a);
+  EXPECT_TRUE(id > 0);
+  EXPECT_EQ_INT(id, lept_register_allocator(&a));
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse_with_allocator(
+                    &v,
+                    "{\"a\":[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16],"
+                    "\"s\":\"abc\",\"o\":{\"x\":[null,true]}}",
+                    id));
+  EXPECT_TRUE(stats.blocks > 0);
+  pv = lept_find_object_value(&v, "a", 1);
+  lept_set_string(lept_pushback_array_element(pv), "str", 3);
+  lept_set_string(lept_set_object_value(&v, "t", 1), "Hello", 5);
+  lept_shrink_object(&v);
+  lept_init_with_allocator(&v2, id);
+  lept_copy(&v2, &v);
+  EXPECT_TRUE(lept_is_equal(&v, &v2));
+  lept_free(&v);
+  lept_free(&v2);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_SIZE_T(0, stats.mismatches);
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+                lept_parse_with_allocator(&v, "{\"a\":[\"b\"]", id));
+  EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR,
+                lept_parse_with_allocator(&v, "{\"a\":[\"b\"]} x", id));
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+
+  /* Committed objects keep the allocator of the target */
+  lept_init_with_allocator(&v, id);
+  lept_object_builder_init(&b);
+  lept_set_number(lept_object_builder_add(&b, "x", 1), 1.0);
+  lept_set_string(lept_object_builder_add(&b, "y", 1), "s", 1);
+  lept_object_builder_commit(&b, &v);
+  EXPECT_EQ_SIZE_T(3, stats.blocks); /* Member array and two keys */
+  EXPECT_EQ_STRING("y", lept_get_object_key(&v, 1), 1);
+  lept_free(&v);
+  lept_object_builder_free(&b);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+
+  lept_set_allocator(&a);
+  stats.calls = 0;
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[\"a\",{\"b\":1.5}]"));
+  json = lept_stringify(&v, &length);
+  EXPECT_EQ_STRING("[\"a\",{\"b\":1.5}]", json, length);
+  EXPECT_TRUE(stats.calls > 0);
+  test_free(&stats, json, length + 1);
+  /* Binary encodings and tapes come from the default allocator as well */
+  json = lept_encode(&v, LEPT_CBOR, &length);
+  test_free(&stats, json, length);
+  json = lept_tape_encode(&v, &length);
+  test_free(&stats, json, length);
+  lept_free(&v);
+  lept_set_allocator(NULL);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_SIZE_T(0, stats.mismatches);
+}
+
+#define TEST_REPARSE(v, json)                                                  \
+  do {                                                                         \
+    lept_value expect;                                                         \
+    lept_init(&expect);                                                        \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reparse(v, json));                       \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&expect, json));                   \
+    EXPECT_TRUE(lept_is_equal(v, &expect));                                    \
+    lept_free(&expect);                                                        \
+  } while (0)
+
+static void test_reparse() {
+  printf("test_reparse:\n");
+  test_allocator_stats stats = {0, 0, 0};
+  static lept_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  lept_parser p;
+  lept_value v;
+  size_t calls;
+
+  a.ctx = &stats;
+  lept_parser_init(&p);
+  p.allocator = lept_register_allocator(&a);
+  lept_init_with_allocator(&v, p.allocator);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parser_reparse(&p, &v,
+                                    "{\"id\":\"abc\",\"tags\":[\"x\",\"y\"],"
+                                    "\"vals\":[0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5]}"));
+  calls = stats.calls;
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parser_reparse(&p, &v,
+                                    "{\"id\":\"abd\",\"tags\":[\"p\",\"q\"],"
+                                    "\"vals\":[9,8,7,6,5,4,3,2,1,0,9,8,7,6,5,4]}"));
+  EXPECT_EQ_SIZE_T(calls, stats.calls); /* steady state allocates nothing */
+  EXPECT_EQ_STRING("abd",
+                   lept_get_string(lept_find_object_value(&v, "id", 2)), 3);
+  EXPECT_EQ_DOUBLE(4.0,
+                   lept_get_array_number(lept_find_object_value(&v, "vals", 4),
+                                         15));
+  EXPECT_TRUE(lept_get_array_numbers(lept_find_object_value(&v, "vals", 4)) !=
+              NULL);
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
+                lept_parser_reparse(&p, &v, "{\"id\":[1,2"));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  lept_parser_free(&p);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_SIZE_T(0, stats.mismatches);
+
+  lept_init(&v);
+  TEST_REPARSE(&v, "{\"a\":1,\"b\":[1,2,3],\"c\":\"xyz\"}");
+  TEST_REPARSE(&v, "{\"a\":\"long string\",\"bb\":[1,\"2\"],\"c\":\"x\","
+                   "\"d\":{}}");
+  TEST_REPARSE(&v, "{\"a\":null,\"bb\":[]}");
+  TEST_REPARSE(&v, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]");
+  TEST_REPARSE(&v, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,\"x\",true]");
+  TEST_REPARSE(&v, "[{\"k\":true}]");
+  TEST_REPARSE(&v, "\"abc\"");
+  TEST_REPARSE(&v, "\"abcdef\"");
+  TEST_REPARSE(&v, "false");
+  EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_reparse(&v, "[1] x"));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  lept_free(&v);
+}
+
+static void test_pointer() {
+  printf("test_pointer:\n");
+  lept_pointer p;
+  lept_value v, w;
+
+  EXPECT_EQ_INT(LEPT_POINTER_MISS_SLASH, lept_pointer_compile(&p, "a", 1, 0));
+  EXPECT_EQ_INT(LEPT_POINTER_INVALID_ESCAPE,
+                lept_pointer_compile(&p, "/a~2", 4, 0));
+  EXPECT_EQ_INT(LEPT_POINTER_INVALID_ESCAPE,
+                lept_pointer_compile(&p, "/a~", 3, 0));
+
+  EXPECT_EQ_INT(LEPT_POINTER_OK,
+                lept_pointer_compile(&p, "/a~1b/~0/3/-/03/", 16, 0));
+  EXPECT_EQ_SIZE_T(6, p.count);
+  EXPECT_EQ_STRING("a/b", p.tokens[0].key, p.tokens[0].klen);
+  EXPECT_EQ_STRING("~", p.tokens[1].key, p.tokens[1].klen);
+  EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, p.tokens[1].index);
+  EXPECT_EQ_SIZE_T(3, p.tokens[2].index);
+  EXPECT_EQ_SIZE_T(LEPT_POINTER_END, p.tokens[3].index);
+  EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, p.tokens[4].index);
+  EXPECT_EQ_SIZE_T(0, p.tokens[5].klen);
+  lept_pointer_free(&p);
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "{\"a\":{\"b\":[0,1,2,{\"c\":\"x\"}]},"
+                               "\"\":1,\"m~n\":true}"));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_pointer_compile(&p, "", 0, 0));
+  EXPECT_TRUE(lept_pointer_get(&p, &v) == &v);
+  lept_pointer_free(&p);
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_pointer_compile(&p, "/", 1, 0));
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_pointer_get(&p, &v)));
+  lept_pointer_free(&p);
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_pointer_compile(&p, "/m~0n", 5, 0));
+  EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(lept_pointer_get(&p, &v)));
+  lept_pointer_free(&p);
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_pointer_compile(&p, "/a/b/4", 6, 0));
+  EXPECT_TRUE(lept_pointer_get(&p, &v) == NULL);
+  lept_pointer_free(&p);
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_pointer_compile(&p, "/a/b/0/x", 8, 0));
+  EXPECT_TRUE(lept_pointer_get(&p, &v) == NULL);
+  lept_pointer_free(&p);
+
+  EXPECT_EQ_INT(LEPT_POINTER_OK,
+                lept_pointer_compile(&p, "/a/b/3/c", 8, LEPT_POINTER_CACHE));
+  EXPECT_EQ_STRING("x", lept_get_string(lept_pointer_get(&p, &v)), 1);
+  EXPECT_EQ_SIZE_T(0, p.tokens[0].cache);
+  lept_init(&w);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&w, "{\"z\":0,\"a\":{\"b\":[0,1,2,"
+                               "{\"d\":0,\"c\":\"y\"}]}}"));
+  EXPECT_EQ_STRING("y", lept_get_string(lept_pointer_get(&p, &w)), 1);
+  EXPECT_EQ_SIZE_T(1, p.tokens[0].cache);
+  EXPECT_EQ_SIZE_T(1, p.tokens[3].cache);
+  EXPECT_EQ_STRING("x", lept_get_string(lept_pointer_get(&p, &v)), 1);
+  lept_pointer_free(&p);
+  lept_free(&w);
+  lept_free(&v);
+
+  /* Duplicate keys resolve to the first member whatever the cache holds */
+  EXPECT_EQ_INT(LEPT_POINTER_OK,
+                lept_pointer_compile(&p, "/a", 2, LEPT_POINTER_CACHE));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"x\":0,\"a\":1}"));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&w, "{\"a\":2,\"a\":3}"));
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_pointer_get(&p, &v)));
+  EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_pointer_get(&p, &w)));
+  lept_freeze(&w);
+  lept_pointer_get(&p, &v);
+  EXPECT_EQ_DOUBLE(2.0, lept_get_number(lept_pointer_get(&p, &w)));
+  lept_freeze(&v);
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_pointer_get(&p, &v)));
+  EXPECT_EQ_SIZE_T(1, p.tokens[0].cache);
+  lept_pointer_free(&p);
+  lept_free(&w);
+  lept_free(&v);
+}
+
+#define TEST_LAZY_ERROR(error, json)                                           \
+  do {                                                                         \
+    lept_value v;                                                              \
+    lept_init(&v);                                                             \
+    EXPECT_EQ_INT(error, lept_parse_lazy(&v, json));                           \
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));                               \
+  } while (0)
+
+static void test_parse_lazy() {
+  printf("test_parse_lazy:\n");
+  const char *json = "{\"id\":7,\"name\":\"a\\u00e9\","
+                     "\"skip\":{\"x\":[1,2,{}]},"
+                     "\"list\":[true,1.5,\"s\",null,[]]}";
+  lept_value v, copy, full;
+  char *s, *t;
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, json));
+  EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+  EXPECT_EQ_SIZE_T(4, lept_get_object_size(&v));
+  EXPECT_EQ_DOUBLE(7.0, lept_get_number(lept_find_object_value(&v, "id", 2)));
+  EXPECT_EQ_STRING("a\xC3\xA9",
+                   lept_get_string(lept_find_object_value(&v, "name", 4)), 3);
+  EXPECT_EQ_INT(LEPT_OBJECT,
+                lept_get_type(lept_find_object_value(&v, "skip", 4)));
+  EXPECT_EQ_DOUBLE(1.5, lept_get_array_number(
+                            lept_find_object_value(&v, "list", 4), 1));
+
+  lept_init(&copy);
+  lept_copy(&copy, &v);
+  lept_init(&full);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&full, json));
+  EXPECT_TRUE(lept_is_equal(&copy, &full));
+  s = lept_stringify(&v, NULL);
+  t = lept_stringify(&full, NULL);
+  EXPECT_TRUE(strcmp(s, t) == 0);
+  free(s);
+  free(t);
+  lept_free(&full);
+  lept_free(&copy);
+
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reparse(&v, "[\"x\"]"));
+  EXPECT_EQ_STRING("x", lept_get_string(lept_get_array_element(&v, 0)), 1);
+  lept_free(&v);
+
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, "\"abc\""));
+  lept_set_number(&v, 1.0);
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, " -1e10 "));
+  EXPECT_EQ_DOUBLE(-1e10, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse_lazy(&v, "[0,1,2,3,4,5,6,7,8,9,0,1,2,3,4,5]"));
+  EXPECT_TRUE(lept_pack_array(&v));
+  EXPECT_EQ_DOUBLE(5.0, lept_get_array_numbers(&v)[15]);
+  lept_free(&v);
+
+  TEST_LAZY_ERROR(LEPT_PARSE_EXPECT_VALUE, " ");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_VALUE, "[1,nul]");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_VALUE, "{\"a\":+1}");
+  TEST_LAZY_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "{} x");
+  TEST_LAZY_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "[1e309]");
+  TEST_LAZY_ERROR(LEPT_PARSE_MISS_QUOTATION_MARK, "[\"abc]");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_STRING_ESCAPE, "[\"\\v\"]");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_STRING_CHAR, "[\"\x01\"]");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_UNICODE_HEX, "[\"\\u00G0\"]");
+  TEST_LAZY_ERROR(LEPT_PARSE_INVALID_UNICODE_SURROGATE, "[\"\\uD800\\uE000\"]");
+  TEST_LAZY_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[[1}");
+  TEST_LAZY_ERROR(LEPT_PARSE_MISS_KEY, "{\"a\":{1:2}}");
+  TEST_LAZY_ERROR(LEPT_PARSE_MISS_COLON, "{\"a\":{\"b\"}}");
+  TEST_LAZY_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "[{\"a\":1]");
+}
+
+#define TEST_PROJECTED(expect, json, p)                                        \
+  do {                                                                         \
+    lept_value v, e;                                                           \
+    lept_init(&e);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_projected(&v, json, p));           \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));                      \
+    EXPECT_TRUE(lept_is_equal(&v, &e));                                        \
+    lept_free(&v);                                                             \
+    lept_free(&e);                                                             \
+  } while (0)
+
+static void test_parse_projected() {
+  printf("test_parse_projected:\n");
+  const char *json = "{\"id\":1,\"drop\":{\"x\":[1,\"\\u0041\"]},"
+                     "\"us\\u0065r\":{\"name\":\"n\",\"age\":3,\"geo\":[1,2]},"
+                     "\"tags\":[\"a\",\"b\",\"c\"],"
+                     "\"items\":[{\"k\":1,\"z\":0},{\"k\":2},5]}";
+  lept_projection p;
+  lept_value v;
+
+  lept_projection_init(&p);
+  TEST_PROJECTED("{}", json, &p);
+  EXPECT_EQ_INT(LEPT_POINTER_MISS_SLASH, lept_projection_add(&p, "id", 2));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/id", 3));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/user/name", 10));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/user/geo", 9));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/user/geo/0", 11));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/tags/1", 7));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/items/*/k", 10));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "/id/x", 5));
+  TEST_PROJECTED("{\"id\":1,\"user\":{\"name\":\"n\",\"geo\":[1,2]},"
+                 "\"tags\":[null,\"b\"],\"items\":[{\"k\":1},{\"k\":2}]}",
+                 json, &p);
+  TEST_PROJECTED("[]", "[1,2]", &p);
+  TEST_PROJECTED("{}", "{\"user\":1}", &p);
+
+  EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE,
+                lept_parse_projected(&v, "{\"drop\":[tru]}", &p));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
+                lept_parse_projected(&v, "{\"tags\":[1,2 3]}", &p));
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COLON,
+                lept_parse_projected(&v, "{\"id\":1,\"x\" 2}", &p));
+  EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR,
+                lept_parse_projected(&v, "{\"id\":1} 2", &p));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_POINTER_OK, lept_projection_add(&p, "", 0));
+  TEST_PROJECTED(json, json, &p);
+  lept_projection_free(&p);
+}
+
+static int test_path_collect(void *ctx, const lept_value *v) {
+  char *json = lept_stringify(v, NULL);
+  strcat(strcat((char *)ctx, json), ";");
+  free(json);
+  return 0;
+}
+
+static int test_path_collect_view(void *ctx, const char *json, size_t len) {
+  strcat(strncat((char *)ctx, json, len), ";");
+  return 0;
+}
+
+static int test_path_first(void *ctx, const lept_value *v) {
+  *(const lept_value **)ctx = v;
+  return 1;
+}
+
+#define TEST_PATH(expect, expr, json)                                          \
+  do {                                                                         \
+    lept_path p;                                                               \
+    lept_value v;                                                              \
+    char tree[256] = "", text[256] = "";                                       \
+    EXPECT_EQ_INT(LEPT_PATH_OK, lept_path_compile(&p, expr));                  \
+    lept_init(&v);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));                        \
+    lept_path_eval(&p, &v, test_path_collect, tree);                           \
+    EXPECT_EQ_STRING(expect, tree, strlen(tree));                              \
+    EXPECT_EQ_INT(LEPT_PARSE_OK,                                               \
+                  lept_path_eval_text(&p, json, test_path_collect_view, text,  \
+                                      NULL));                                  \
+    EXPECT_EQ_STRING(expect, text, strlen(text));                              \
+    lept_free(&v);                                                             \
+    lept_path_free(&p);                                                        \
+  } while (0)
+
+static void test_path() {
+  printf("test_path:\n");
+  const char *json = "{\"store\":{\"book\":[{\"t\":\"a\",\"p\":8.5},"
+                     "{\"t\":\"b\",\"p\":12},"
+                     "{\"t\":\"c\",\"p\":9,\"isbn\":\"x\"}],"
+                     "\"bike\":{\"p\":19.5}}}";
+  const lept_value *first = NULL;
+  lept_path p;
+  lept_value v;
+  size_t count;
+
+  TEST_PATH("\"a\";\"b\";\"c\";", "$.store.book[*].t", json);
+  TEST_PATH("8.5;12;9;19.5;", "$..p", json);
+  TEST_PATH("{\"t\":\"b\",\"p\":12};", "$.store.book[1]", json);
+  TEST_PATH("\"a\";\"c\";", "$.store.book[?(@.p < 10)].t", json);
+  TEST_PATH("\"c\";", "$['store'][\"book\"][?(@.isbn)].t", json);
+  TEST_PATH("19.5;", "$.store.bike.*", json);
+  TEST_PATH("12;", "$..book[?(@.t == 'b')].p", json);
+  TEST_PATH("\"a\";\"b\";", "$..book[?(@.t <= \"b\")].t", json);
+  TEST_PATH("[1,[2]];[2];", "$..[1]", "[0,[1,[2]]]");
+  TEST_PATH("[1,2];", "$", "[1,2]");
+  TEST_PATH("", "$.x", "[1,2]");
+
+  EXPECT_EQ_INT(LEPT_PATH_MISS_ROOT, lept_path_compile(&p, "store"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_STEP, lept_path_compile(&p, "$."));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_STEP, lept_path_compile(&p, "$.a[1"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_STEP, lept_path_compile(&p, "$.a['b]"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_STEP,
+                lept_path_compile(&p, "$[184467440737095516160]"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_STEP,
+                lept_path_compile(&p, "$[99999999999999999999999]"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_FILTER,
+                lept_path_compile(&p, "$[?(@.a ~ 1)]"));
+  EXPECT_EQ_INT(LEPT_PATH_INVALID_FILTER,
+                lept_path_compile(&p, "$[?(@.a == 1]"));
+
+  EXPECT_EQ_INT(LEPT_PATH_OK, lept_path_compile(&p, "$..t"));
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, json));
+  EXPECT_EQ_SIZE_T(1, lept_path_eval(&p, &v, test_path_first, &first));
+  EXPECT_EQ_STRING("a", lept_get_string(first), 1);
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET,
+                lept_path_eval_text(&p, "{\"a\":[1]]", test_path_collect_view,
+                                    NULL, &count));
+  EXPECT_EQ_SIZE_T(0, count);
+  lept_free(&v);
+  lept_path_free(&p);
+}
+
+#define TEST_PATCH(error, expect, doc, patch)                                  \
+  do {                                                                         \
+    lept_value d, p, e;                                                        \
+    lept_init(&d);                                                             \
+    lept_init(&p);                                                             \
+    lept_init(&e);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&d, doc));                         \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&p, patch));                       \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));                      \
+    EXPECT_EQ_INT(error, lept_patch(&d, &p));                                  \
+    EXPECT_TRUE(lept_is_equal(&d, &e));                                        \
+    lept_free(&d);                                                             \
+    lept_free(&p);                                                             \
+    lept_free(&e);                                                             \
+  } while (0)
+
+#define TEST_MERGE_PATCH(expect, doc, patch)                                   \
+  do {                                                                         \
+    lept_value d, p, e;                                                        \
+    lept_init(&d);                                                             \
+    lept_init(&p);                                                             \
+    lept_init(&e);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&d, doc));                         \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&p, patch));                       \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&e, expect));                      \
+    lept_merge_patch(&d, &p);                                                  \
+    EXPECT_TRUE(lept_is_equal(&d, &e));                                        \
+    lept_free(&d);                                                             \
+    lept_free(&p);                                                             \
+    lept_free(&e);                                                             \
+  } while (0)
+
+static void test_patch() {
+  printf("test_patch:\n");
+  lept_patcher patcher;
+  lept_value d, p;
+
+  TEST_PATCH(LEPT_PATCH_OK, "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+             "{\"foo\":\"bar\"}",
+             "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":[\"bar\",\"qux\",\"baz\"]}",
+             "{\"foo\":[\"bar\",\"baz\"]}",
+             "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "[1,2,3]", "[1,2]",
+             "[{\"op\":\"add\",\"path\":\"/-\",\"value\":3}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"foo\":\"bar\"}",
+             "{\"baz\":\"qux\",\"foo\":\"bar\"}",
+             "[{\"op\":\"remove\",\"path\":\"/baz\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"a\":[1,3]}", "{\"a\":[1,2,3]}",
+             "[{\"op\":\"remove\",\"path\":\"/a/1\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"a\":{\"b\":[0]}}", "{\"a\":1}",
+             "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":{\"b\":[0]}}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"x\":{\"c\":1},\"y\":{}}",
+             "{\"x\":{},\"y\":{\"b\":1}}",
+             "[{\"op\":\"move\",\"from\":\"/y/b\",\"path\":\"/x/c\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "[1,3,2]", "[1,2,3]",
+             "[{\"op\":\"move\",\"from\":\"/1\",\"path\":\"/2\"}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"a\":[1],\"b\":[1]}", "{\"a\":[1]}",
+             "[{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/b\"},"
+             "{\"op\":\"test\",\"path\":\"/b\",\"value\":[1]}]");
+  TEST_PATCH(LEPT_PATCH_OK, "7", "{\"a\":1}",
+             "[{\"op\":\"replace\",\"path\":\"\",\"value\":7}]");
+  TEST_PATCH(LEPT_PATCH_OK, "{\"a/b\":2,\"m~n\":1}", "{\"a/b\":1,\"m~n\":1}",
+             "[{\"op\":\"replace\",\"path\":\"/a~1b\",\"value\":2}]");
+
+  TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"a\":2}", "{\"a\":1}",
+             "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":2},"
+             "{\"op\":\"test\",\"path\":\"/a\",\"value\":3}]");
+  /* Same number of members, different keys */
+  TEST_PATCH(LEPT_PATCH_TEST_FAILED, "{\"b\":1}", "{\"b\":1}",
+             "[{\"op\":\"test\",\"path\":\"\",\"value\":{\"a\":1}}]");
+  TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{\"a\":1}", "{\"a\":1}",
+             "[{\"op\":\"add\",\"path\":\"/x/y\",\"value\":2}]");
+  TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "[1]", "[1]",
+             "[{\"op\":\"add\",\"path\":\"/2\",\"value\":2}]");
+  TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{}", "{}",
+             "[{\"op\":\"remove\",\"path\":\"/a\"}]");
+  TEST_PATCH(LEPT_PATCH_PATH_NOT_FOUND, "{}", "{}",
+             "[{\"op\":\"replace\",\"path\":\"/a\",\"value\":1}]");
+  TEST_PATCH(LEPT_PATCH_INVALID_POINTER, "{}", "{}",
+             "[{\"op\":\"add\",\"path\":\"a\",\"value\":1}]");
+  TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "{}",
+             "[{\"op\":\"add\",\"path\":\"/a\"}]");
+  TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "{}",
+             "[{\"op\":\"frob\",\"path\":\"/a\",\"value\":1}]");
+  TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{\"a\":{}}", "{\"a\":{}}",
+             "[{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/a/b\"}]");
+  TEST_PATCH(LEPT_PATCH_INVALID_OPERATION, "{}", "{}", "{}");
+
+  lept_patcher_init(&patcher);
+  lept_init(&d);
+  lept_init(&p);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&d, "{\"n\":{\"c\":0}}"));
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&p, "[{\"op\":\"replace\",\"path\":\"/n/c\","
+                               "\"value\":1}]"));
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patcher_apply(&patcher, &d, &p));
+  }
+  EXPECT_EQ_SIZE_T(1, patcher.size);
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(lept_find_object_value(
+                            lept_find_object_value(&d, "n", 1), "c", 1)));
+  lept_patcher_free(&patcher);
+  lept_free(&p);
+  lept_free(&d);
+
+  /* The destination path is compiled after the source and grows the table */
+  lept_patcher_init(&patcher);
+  lept_init(&d);
+  lept_init(&p);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&d, "{}"));
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&p, "["
+                               "{\"op\":\"add\",\"path\":\"/a\",\"value\":1},"
+                               "{\"op\":\"add\",\"path\":\"/b\",\"value\":2},"
+                               "{\"op\":\"add\",\"path\":\"/c\",\"value\":3},"
+                               "{\"op\":\"add\",\"path\":\"/d\",\"value\":4},"
+                               "{\"op\":\"add\",\"path\":\"/e\",\"value\":5},"
+                               "{\"op\":\"add\",\"path\":\"/f\",\"value\":6},"
+                               "{\"op\":\"add\",\"path\":\"/g\",\"value\":0},"
+                               "{\"op\":\"add\",\"path\":\"/src\",\"value\":7},"
+                               "{\"op\":\"copy\",\"from\":\"/src\","
+                               "\"path\":\"/dst\"}]"));
+  EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patcher_apply(&patcher, &d, &p));
+  EXPECT_EQ_SIZE_T(9, patcher.size);
+  EXPECT_EQ_DOUBLE(7.0,
+                   lept_get_number(lept_find_object_value(&d, "dst", 3)));
+  lept_patcher_free(&patcher);
+  lept_free(&p);
+  lept_free(&d);
+
+  TEST_MERGE_PATCH("{\"a\":\"z\",\"c\":{\"d\":\"e\"}}",
+                   "{\"a\":\"b\",\"c\":{\"d\":\"e\",\"f\":\"g\"}}",
+                   "{\"a\":\"z\",\"c\":{\"f\":null}}");
+  TEST_MERGE_PATCH("{\"a\":\"c\"}", "{\"a\":\"b\"}", "{\"a\":\"c\"}");
+  TEST_MERGE_PATCH("{\"a\":\"b\",\"b\":\"c\"}", "{\"a\":\"b\"}",
+                   "{\"b\":\"c\"}");
+  TEST_MERGE_PATCH("{}", "{\"a\":\"b\"}", "{\"a\":null}");
+  TEST_MERGE_PATCH("{\"a\":[1]}", "{\"a\":[{\"b\":\"c\"}]}", "{\"a\":[1]}");
+  TEST_MERGE_PATCH("[\"c\",\"d\"]", "[\"a\",\"b\"]", "[\"c\",\"d\"]");
+  TEST_MERGE_PATCH("{\"a\":\"foo\"}", "[1,2]", "{\"a\":\"foo\"}");
+  TEST_MERGE_PATCH("{\"a\":{\"bb\":{}}}", "{}",
+                   "{\"a\":{\"bb\":{\"ccc\":null}}}");
+  TEST_MERGE_PATCH("null", "{\"e\":null}", "null");
+}
+
+#define TEST_DIFF(expect, from, to)                                            \
+  do {                                                                         \
+    lept_value a, b, d;                                                        \
+    char *json;                                                                \
+    lept_init(&a);                                                             \
+    lept_init(&b);                                                             \
+    lept_init(&d);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&a, from));                        \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&b, to));                          \
+    lept_diff(&d, &a, &b);                                                     \
+    json = lept_stringify(&d, NULL);                                           \
+    EXPECT_EQ_STRING(expect, json, strlen(json));                              \
+    free(json);                                                                \
+    EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch(&a, &d));                          \
+    EXPECT_TRUE(lept_is_equal(&a, &b));                                        \
+    lept_free(&a);                                                             \
+    lept_free(&b);                                                             \
+    lept_free(&d);                                                             \
+  } while (0)
+
+static void test_diff() {
+  printf("test_diff:\n");
+  lept_value a, b, d, *pv;
+  char *json;
+  size_t length;
+
+  TEST_DIFF("[]", "{\"a\":[1,{\"b\":null}]}", "{\"a\":[1,{\"b\":null}]}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"\",\"value\":{}}]", "[]", "{}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/b\",\"value\":3}]",
+            "{\"a\":1,\"b\":2}", "{\"a\":1,\"b\":3}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/a/x\",\"value\":\"y\"}]",
+            "{\"a\":{\"x\":\"z\"}}", "{\"a\":{\"x\":\"y\"}}");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/a\"},"
+            "{\"op\":\"add\",\"path\":\"/c\",\"value\":[true]}]",
+            "{\"a\":1,\"b\":2}", "{\"b\":2,\"c\":[true]}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/b\",\"value\":false}]",
+            "{\"a\":1,\"b\":true}", "{\"b\":false,\"a\":1}");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/a~1b/m~0n\",\"value\":2}]",
+            "{\"a/b\":{\"m~n\":1}}", "{\"a/b\":{\"m~n\":2}}");
+  TEST_DIFF("[{\"op\":\"add\",\"path\":\"/2\",\"value\":9}]", "[1,2,3,4]",
+            "[1,2,9,3,4]");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/2\"},"
+            "{\"op\":\"remove\",\"path\":\"/1\"}]",
+            "[1,2,3,4]", "[1,4]");
+  TEST_DIFF("[{\"op\":\"add\",\"path\":\"/3\",\"value\":4}]", "[1,2,3]",
+            "[1,2,3,4]");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/1\",\"value\":\"x\"},"
+            "{\"op\":\"remove\",\"path\":\"/2\"}]",
+            "[0,1,2,3]", "[0,\"x\",3]");
+  TEST_DIFF("[{\"op\":\"replace\",\"path\":\"/1/k\",\"value\":2}]",
+            "[0,{\"k\":1}]", "[0,{\"k\":2}]");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/1\"}]",
+            "[{\"a\":1,\"b\":[2]},-0]", "[{\"b\":[2],\"a\":1}]");
+  TEST_DIFF("[{\"op\":\"remove\",\"path\":\"/1\"}]", "[-0,1]", "[0]");
+  TEST_DIFF("[{\"op\":\"add\",\"path\":\"/1/1\",\"value\":0},"
+            "{\"op\":\"add\",\"path\":\"/3\",\"value\":[5]}]",
+            "[[1,2],[3],[4]]", "[[1,2],[3,0],[4],[5]]");
+
+  lept_init(&a);
+  lept_init(&b);
+  lept_init(&d);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse_lazy(&a, "{\"s\":[1,2,{\"x\":0}],\"t\":1}"));
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse_lazy(&b, "{\"s\":[1,2,{\"x\":0}],\"t\":2}"));
+  lept_diff(&d, &a, &b);
+  EXPECT_EQ_SIZE_T(1, lept_get_array_size(&d));
+  EXPECT_EQ_INT(LEPT_PATCH_OK, lept_patch(&a, &d));
+  EXPECT_TRUE(lept_is_equal(&a, &b));
+  lept_free(&a);
+  lept_free(&b);
+  lept_free(&d);
+
+  /* A packed array trims against an equal unpacked one */
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&a, "[0,[1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16]]"));
+  EXPECT_TRUE(lept_get_array_numbers(lept_get_array_element(&a, 1)) != NULL);
+  lept_set_array(&b, 1);
+  pv = lept_pushback_array_element(&b);
+  lept_set_array(pv, 16);
+  for (size_t i = 1; i <= 16; i++) {
+    lept_set_number(lept_pushback_array_element(pv), (double)i);
+  }
+  lept_diff(&d, &a, &b);
+  json = lept_stringify(&d, &length);
+  EXPECT_EQ_STRING("[{\"op\":\"remove\",\"path\":\"/0\"}]", json, length);
+  free(json);
+  lept_free(&a);
+  lept_free(&b);
+  lept_free(&d);
+}
+
+static void test_ndjson() {
+  printf("test_ndjson:\n");
+  const char *json = "{\"a\":1}\n"
+                     "\n"
+                     "  [1,2]\r\n"
+                     "{\"a\":}\n"
+                     "[1,\n"
+                     "2]\n"
+                     "3 4\n"
+                     "\"x\"";
+  lept_ndjson_error errors[2];
+  lept_ndjson_reader r;
+  lept_value docs, v;
+
+  lept_init(&docs);
+  EXPECT_EQ_SIZE_T(4, lept_parse_ndjson(&docs, json, errors, 2));
+  EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(&docs));
+  EXPECT_EQ_SIZE_T(3, lept_get_array_size(&docs));
+  EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(lept_get_array_element(&docs, 0)));
+  EXPECT_EQ_INT(LEPT_ARRAY, lept_get_type(lept_get_array_element(&docs, 1)));
+  EXPECT_EQ_STRING("x", lept_get_string(lept_get_array_element(&docs, 2)),
+                   lept_get_string_length(lept_get_array_element(&docs, 2)));
+  EXPECT_EQ_SIZE_T(4, errors[0].line);
+  EXPECT_EQ_SIZE_T(23, errors[0].offset);
+  EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, errors[0].code);
+  EXPECT_EQ_SIZE_T(5, errors[1].line);
+  EXPECT_EQ_SIZE_T(28, errors[1].offset);
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, errors[1].code);
+  lept_free(&docs);
+
+  lept_ndjson_init(&r, json);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(1, r.line);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(3, r.line);
+  EXPECT_EQ_SIZE_T(11, r.offset);
+  EXPECT_EQ_SIZE_T(2, lept_get_array_size(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET,
+                lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(5, r.line);
+  EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(6, r.line);
+  EXPECT_EQ_INT(LEPT_PARSE_ROOT_NOT_SINGULAR, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(7, r.line);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_INT(LEPT_STRING, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_NDJSON_END, lept_ndjson_next(&r, &v));
+  EXPECT_EQ_SIZE_T(8, r.line);
+  lept_free(&v);
+  lept_ndjson_free(&r);
+
+  lept_init(&docs);
+  EXPECT_EQ_SIZE_T(0, lept_parse_ndjson(&docs, " \n\n", NULL, 0));
+  EXPECT_EQ_SIZE_T(0, lept_get_array_size(&docs));
+  lept_free(&docs);
+}
+
+static void test_ndjson_parallel() {
+  printf("test_ndjson_parallel:\n");
+  size_t lines = 20000, size = 0;
+  char *json = (char *)malloc(lines * 64);
+  lept_ndjson_error expect[4], actual[4];
+  lept_value docs, seq;
+
+  for (size_t i = 0; i < lines; i++) {
+    if (i % 5000 == 4999) {
+      size += sprintf(json + size, "{\"id\":%lu,}\n", (unsigned long)i);
+    } else if (i % 7 == 0) {
+      size += sprintf(json + size, "  \n");
+    } else {
+      size += sprintf(json + size, "{\"id\":%lu,\"tags\":[\"a b\",\"c\"]}\n",
+                      (unsigned long)i);
+    }
+  }
+  lept_init(&docs);
+  lept_init(&seq);
+  EXPECT_EQ_SIZE_T(4, lept_parse_ndjson(&seq, json, expect, 4));
+  EXPECT_EQ_SIZE_T(4, lept_parse_ndjson_parallel(&docs, json, 8, actual, 3));
+  EXPECT_TRUE(lept_is_equal(&docs, &seq));
+  for (size_t i = 0; i < 3; i++) {
+    EXPECT_EQ_SIZE_T(expect[i].line, actual[i].line);
+    EXPECT_EQ_SIZE_T(expect[i].offset, actual[i].offset);
+    EXPECT_EQ_INT(expect[i].code, actual[i].code);
+  }
+  EXPECT_EQ_SIZE_T(5000, expect[0].line);
+  EXPECT_EQ_SIZE_T(4, lept_parse_ndjson_parallel(&docs, json, 64, NULL, 0));
+  EXPECT_TRUE(lept_is_equal(&docs, &seq));
+  lept_free(&docs);
+  lept_free(&seq);
+
+  lept_init(&docs);
+  EXPECT_EQ_SIZE_T(0, lept_parse_ndjson_parallel(&docs, "1\n2", 4, NULL, 0));
+  EXPECT_EQ_SIZE_T(2, lept_get_array_size(&docs));
+  lept_free(&docs);
+  free(json);
+}
+
+#define TEST_READER_ERROR(error, json)                                         \
+  do {                                                                         \
+    lept_reader r;                                                             \
+    lept_token t;                                                              \
+    int ret;                                                                   \
+    lept_reader_init(&r, json);                                                \
+    while ((ret = lept_reader_next(&r, &t)) == LEPT_PARSE_OK) {                \
+    }                                                                          \
+    EXPECT_EQ_INT(error, ret);                                                 \
+    EXPECT_EQ_INT(error, lept_reader_next(&r, &t));                            \
+  } while (0)
+
+static void test_reader() {
+  printf("test_reader:\n");
+  static const lept_token_type types[] = {
+      LEPT_TOKEN_BEGIN_OBJECT, LEPT_TOKEN_KEY,       LEPT_TOKEN_NUMBER,
+      LEPT_TOKEN_KEY,          LEPT_TOKEN_BEGIN_ARRAY, LEPT_TOKEN_NULL,
+      LEPT_TOKEN_TRUE,         LEPT_TOKEN_FALSE,     LEPT_TOKEN_STRING,
+      LEPT_TOKEN_BEGIN_ARRAY,  LEPT_TOKEN_END_ARRAY, LEPT_TOKEN_END_ARRAY,
+      LEPT_TOKEN_KEY,          LEPT_TOKEN_BEGIN_OBJECT, LEPT_TOKEN_END_OBJECT,
+      LEPT_TOKEN_END_OBJECT};
+  const char *json = " { \"n\" : -1.5e2, \"a\":[null,true,false,\"x\\\"y\",[]],"
+                     "\"o\":{} } ";
+  lept_reader r;
+  lept_token t;
+  char buf[8];
+
+  lept_reader_init(&r, json);
+  for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+    EXPECT_EQ_INT(types[i], t.type);
+    if (i == 1) {
+      EXPECT_EQ_STRING("n", t.json, t.len);
+    } else if (i == 2) {
+      EXPECT_EQ_DOUBLE(-150.0, t.n);
+      EXPECT_EQ_STRING("-1.5e2", t.json, t.len);
+    } else if (i == 8) {
+      EXPECT_EQ_STRING("x\\\"y", t.json, t.len);
+      EXPECT_EQ_SIZE_T(3, lept_token_string(&t, buf));
+      EXPECT_EQ_STRING("x\"y", buf, 3);
+    }
+  }
+  EXPECT_EQ_INT(LEPT_READER_END, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_READER_END, lept_reader_next(&r, &t));
+
+  /* Skip the subtrees of members other than "id" */
+  lept_reader_init(&r, "{\"a\":{\"b\":[1,{\"c\":2}]},\"id\":7,\"z\":[[]]}");
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_STRING("a", t.json, t.len);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_skip(&r));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_STRING("id", t.json, t.len);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_DOUBLE(7.0, t.n);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_skip(&r));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_TOKEN_END_OBJECT, t.type);
+  EXPECT_EQ_INT(LEPT_READER_END, lept_reader_skip(&r));
+
+  lept_reader_init(&r, "[\"\\u20AC\\uD834\\uDD1E\"]");
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  {
+    char wide[32];
+    EXPECT_EQ_SIZE_T(7, lept_token_string(&t, wide));
+    EXPECT_EQ_STRING("\xE2\x82\xAC\xF0\x9D\x84\x9E", wide, 7);
+  }
+
+  TEST_READER_ERROR(LEPT_PARSE_EXPECT_VALUE, " ");
+  TEST_READER_ERROR(LEPT_PARSE_INVALID_VALUE, "[nul]");
+  TEST_READER_ERROR(LEPT_PARSE_ROOT_NOT_SINGULAR, "1 2");
+  TEST_READER_ERROR(LEPT_PARSE_MISS_COMMA_OR_SQUARE_BRACKET, "[1}");
+  TEST_READER_ERROR(LEPT_PARSE_MISS_COMMA_OR_CURLY_BRACKET, "{\"a\":1]");
+  TEST_READER_ERROR(LEPT_PARSE_MISS_KEY, "{1:1}");
+  TEST_READER_ERROR(LEPT_PARSE_MISS_KEY, "{\"a\":1,}");
+  TEST_READER_ERROR(LEPT_PARSE_MISS_COLON, "{\"a\" 1}");
+  TEST_READER_ERROR(LEPT_PARSE_INVALID_STRING_ESCAPE, "[\"\\x\"]");
+  TEST_READER_ERROR(LEPT_PARSE_NUMBER_TOO_BIG, "[1e309]");
+  TEST_READER_ERROR(LEPT_PARSE_EXPECT_VALUE, "[1,");
+
+  lept_reader_init(&r, "[1,[2,}]");
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_reader_skip(&r));
+  EXPECT_EQ_SIZE_T(6, r.offset);
+}
+
+typedef struct {
+  char s[256];
+  size_t len, max, calls, stop;
+} test_chunks;
+
+static int test_chunk(void *ctx, const char *s, size_t len) {
+  test_chunks *c = (test_chunks *)ctx;
+  memcpy(c->s + c->len, s, len);
+  c->len += len;
+  c->max = len > c->max ? len : c->max;
+  return ++c->calls == c->stop ? 7 : 0;
+}
+
+static void test_reader_chunked() {
+  printf("test_reader_chunked:\n");
+  const char *json = "\"0123456789\\n\\u20AC\\t\\uD834\\uDD1Eabcdefghijklmn"
+                     "opqrstuvwxyz\\\\\\/\"";
+  char expect[256], buf[16];
+  size_t len, sizes[] = {4, 5, 16};
+  lept_reader r;
+  lept_token t;
+  test_chunks c;
+
+  lept_reader_init(&r, json);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reader_next(&r, &t));
+  len = lept_token_string(&t, expect);
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    memset(&c, 0, sizeof(c));
+    EXPECT_EQ_INT(0,
+                  lept_token_string_chunked(&t, buf, sizes[i], test_chunk, &c));
+    EXPECT_EQ_SIZE_T(len, c.len);
+    EXPECT_TRUE(memcmp(expect, c.s, len) == 0);
+    EXPECT_TRUE(c.max <= sizes[i]);
+  }
+  memset(&c, 0, sizeof(c));
+  c.stop = 2;
+  EXPECT_EQ_INT(7, lept_token_string_chunked(&t, buf, 4, test_chunk, &c));
+  EXPECT_EQ_SIZE_T(2, c.calls);
+}
+
+static void test_parse_parallel_expect(const char *json, size_t threads) {
+  lept_value v, expect;
+  int ret;
+  lept_init(&expect);
+  ret = lept_parse(&expect, json);
+  lept_init(&v);
+  EXPECT_EQ_INT(ret, lept_parse_parallel(&v, json, threads));
+  EXPECT_TRUE(lept_is_equal(&v, &expect));
+  lept_free(&v);
+  lept_free(&expect);
+}
+
+static void test_parse_parallel() {
+  printf("test_parse_parallel:\n");
+  size_t count = 20000, size = 1;
+  char *json = (char *)malloc(count * 64 + 16);
+  test_allocator_stats stats = {0, 0, 0};
+  static lept_allocator a = {test_locked_malloc, test_locked_realloc,
+                             test_locked_free, NULL};
+  lept_value v;
+  int id;
+
+  json[0] = '[';
+  for (size_t i = 0; i < count; i++) {
+    size += sprintf(json + size, "%s{\"id\":%lu,\"s\":\"\\\",[{\",\"a\":[%lu]}",
+                    i > 0 ? ", " : "", (unsigned long)i, (unsigned long)i);
+  }
+  strcpy(json + size, " ] ");
+  test_parse_parallel_expect(json, 8);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_parallel(&v, json, 8));
+  EXPECT_EQ_SIZE_T(count, lept_get_array_size(&v));
+  EXPECT_EQ_DOUBLE(12345.0,
+                   lept_get_number(lept_find_object_value(
+                       lept_get_array_element(&v, 12345), "id", 2)));
+  lept_free(&v);
+
+  /* Everything comes from the allocator of the value */
+  a.ctx = &stats;
+  id = lept_register_allocator(&a);
+  lept_init_with_allocator(&v, id);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_parallel(&v, json, 8));
+  EXPECT_TRUE(stats.blocks > count);
+  lept_free(&v);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_SIZE_T(0, stats.mismatches);
+
+  /* Errors match the sequential parser wherever they occur */
+  strcpy(json + size, ",]");
+  test_parse_parallel_expect(json, 8);
+  strcpy(json + size, "] x");
+  test_parse_parallel_expect(json, 8);
+  json[size / 2] = '}';
+  test_parse_parallel_expect(json, 8);
+
+  size = 1;
+  for (size_t i = 0; i < count; i++) {
+    size += sprintf(json + size, "%s%lu.5", i > 0 ? "," : "", (unsigned long)i);
+  }
+  strcpy(json + size, "]");
+  test_parse_parallel_expect(json, 4);
+  test_parse_parallel_expect("{\"a\":[1,2]}", 4);
+  test_parse_parallel_expect("[1,2]", 4);
+  free(json);
+}
+
+static void test_parse_many() {
+  printf("test_parse_many:\n");
+  const char *json = "{\"a\":1}[1,2] \n 3\"x\"truefalse-1.5e1null ";
+  lept_many_reader r;
+  lept_value v;
+
+  lept_many_init(&r, json);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_OBJECT, lept_get_type(&v));
+  EXPECT_EQ_SIZE_T(0, r.offset);
+  EXPECT_EQ_SIZE_T(7, r.length);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_SIZE_T(2, lept_get_array_size(&v));
+  EXPECT_EQ_SIZE_T(7, r.offset);
+  EXPECT_EQ_SIZE_T(5, r.length);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_DOUBLE(3.0, lept_get_number(&v));
+  EXPECT_EQ_SIZE_T(15, r.offset);
+  EXPECT_EQ_SIZE_T(1, r.length);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_STRING("x", lept_get_string(&v), lept_get_string_length(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_TRUE, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_FALSE, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_DOUBLE(-15.0, lept_get_number(&v));
+  EXPECT_EQ_SIZE_T(6, r.length);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_MANY_END, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_MANY_END, lept_parse_many(&r, &v));
+  lept_free(&v);
+  lept_many_free(&r);
+
+  lept_many_init(&r, "[1] [2,] [3]");
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_many(&r, &v));
+  EXPECT_EQ_INT(LEPT_PARSE_INVALID_VALUE, lept_parse_many(&r, &v));
+  EXPECT_EQ_SIZE_T(7, r.offset);
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(LEPT_MANY_END, lept_parse_many(&r, &v));
+  lept_free(&v);
+  lept_many_free(&r);
+
+  lept_many_init(&r, "  ");
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_MANY_END, lept_parse_many(&r, &v));
+  lept_many_free(&r);
+}
+
+static void test_write_file(const char *path, const char *json, size_t len) {
+  FILE *fp = fopen(path, "wb");
+  EXPECT_TRUE(fp != NULL);
+  if (fp != NULL) {
+    fwrite(json, 1, len, fp);
+    fclose(fp);
+  }
+}
+
+static void test_parse_file() {
+  printf("test_parse_file:\n");
+  const char *path = "leptjson_test_file.json";
+  char json[4096];
+  lept_file f;
+  lept_value v;
+
+  lept_init(&v);
+  test_write_file(path, "{\"a\":[1,\"x\"]}", 13);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file(&v, path, 0));
+  EXPECT_EQ_SIZE_T(2, lept_get_array_size(lept_find_object_value(&v, "a", 1)));
+  lept_free(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file(&v, path, LEPT_FILE_POPULATE));
+  lept_free(&v);
+
+  /* A page-sized file has no slack after it for the terminating NUL */
+  memset(json, ' ', sizeof(json));
+  json[0] = '[';
+  json[sizeof(json) - 1] = ']';
+  test_write_file(path, json, sizeof(json));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_file(&v, path, 0));
+  EXPECT_EQ_SIZE_T(0, lept_get_array_size(&v));
+  lept_free(&v);
+
+  test_write_file(path, "", 0);
+  EXPECT_EQ_INT(LEPT_PARSE_EXPECT_VALUE, lept_parse_file(&v, path, 0));
+  lept_free(&v);
+
+  test_write_file(path, "[\"lazy\",2]", 10);
+  EXPECT_EQ_INT(0, lept_file_map(&f, path, 0));
+  EXPECT_EQ_SIZE_T(10, f.size);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, f.json));
+  EXPECT_EQ_STRING("lazy", lept_get_string(lept_get_array_element(&v, 0)), 4);
+  lept_free(&v);
+  lept_file_unmap(&f);
+
+  remove(path);
+  EXPECT_EQ_INT(LEPT_PARSE_FILE_ERROR, lept_parse_file(&v, path, 0));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  EXPECT_EQ_INT(-1, lept_file_map(&f, path, 0));
+}
+
 static void test_stringify() {
   TEST_ROUNDTRIP("null");
   TEST_ROUNDTRIP("false");
@@ -767,6 +2068,7 @@ static void test_parse() {
   test_parse_number();
   test_parse_string();
   test_parse_array();
+  test_parse_packed_array();
   test_parse_object();
 
   test_parse_expect_value();
@@ -784,11 +2086,739 @@ static void test_parse() {
   test_parse_invalid_surrogate();
 }
 
+#define TEST_ENCODE(format, expect, json)                                      \
+  do {                                                                         \
+    lept_value v;                                                              \
+    size_t length;                                                             \
+    char *data;                                                                \
+    lept_init(&v);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));                        \
+    data = lept_encode(&v, format, &length);                                   \
+    EXPECT_EQ_SIZE_T(sizeof(expect) - 1, length);                              \
+    EXPECT_TRUE(memcmp(expect, data, length) == 0);                            \
+    free(data);                                                                \
+    lept_free(&v);                                                             \
+  } while (0)
+
+#define TEST_DECODE_ERROR(error, format, data)                                 \
+  do {                                                                         \
+    lept_value v;                                                              \
+    lept_init(&v);                                                             \
+    EXPECT_EQ_INT(error, lept_decode(&v, data, sizeof(data) - 1, format));     \
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));                               \
+    lept_free(&v);                                                             \
+  } while (0)
+
+static void test_binary_roundtrip(const char *json) {
+  lept_format formats[] = {LEPT_MSGPACK, LEPT_CBOR};
+  lept_value v, decoded;
+  size_t length;
+  char *data;
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+  for (size_t i = 0; i < 2; i++) {
+    data = lept_encode(&v, formats[i], &length);
+    lept_init(&decoded);
+    EXPECT_EQ_INT(LEPT_DECODE_OK,
+                  lept_decode(&decoded, data, length, formats[i]));
+    EXPECT_TRUE(lept_is_equal(&v, &decoded));
+    lept_free(&decoded);
+    free(data);
+  }
+  lept_free(&v);
+}
+
+static void test_binary() {
+  printf("test_binary:\n");
+  lept_writer w;
+  lept_value v;
+  const char *data;
+  char *buf;
+  char out[64];
+  size_t length;
+
+  TEST_ENCODE(LEPT_MSGPACK, "\xc0", "null");
+  TEST_ENCODE(LEPT_MSGPACK, "\x93\xc2\xc3\x7f", "[false,true,127]");
+  TEST_ENCODE(LEPT_MSGPACK, "\x94\xcc\x80\xe0\xd0\xdf\xcd\x01\x00",
+              "[128,-32,-33,256]");
+  TEST_ENCODE(LEPT_MSGPACK, "\xcb\x3f\xf8\x00\x00\x00\x00\x00\x00", "1.5");
+  TEST_ENCODE(LEPT_MSGPACK, "\x81\xa1\x61\xa2\x62\x63", "{\"a\":\"bc\"}");
+  TEST_ENCODE(LEPT_CBOR, "\xf6", "null");
+  TEST_ENCODE(LEPT_CBOR, "\x84\xf4\xf5\x17\x18\x18", "[false,true,23,24]");
+  TEST_ENCODE(LEPT_CBOR, "\x82\x20\x39\x01\x00", "[-1,-257]");
+  TEST_ENCODE(LEPT_CBOR, "\xfb\x80\x00\x00\x00\x00\x00\x00\x00", "-0.0");
+  TEST_ENCODE(LEPT_CBOR, "\xa1\x61\x61\x62\x62\x63", "{\"a\":\"bc\"}");
+
+  test_binary_roundtrip("null");
+  test_binary_roundtrip("[1,2,3,4.5,-6]");
+  test_binary_roundtrip("[4294967296,-4294967297,1e300,-1e-300]");
+  test_binary_roundtrip("{\"n\":null,\"f\":false,\"t\":true,\"i\":123,"
+                        "\"s\":\"abc\\u0000\\u20AC\",\"a\":[1,[],{}],"
+                        "\"o\":{\"\":\"01234567890123456789012345678901\"}}");
+
+  /* Encodings this library never produces still decode */
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_DECODE_OK,
+                lept_decode(&v, "\xca\x3f\xc0\x00\x00", 5, LEPT_MSGPACK));
+  EXPECT_EQ_DOUBLE(1.5, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK,
+                lept_decode(&v, "\xd3\xff\xff\xff\xff\xff\xff\xff\xfe", 9,
+                            LEPT_MSGPACK));
+  EXPECT_EQ_DOUBLE(-2.0, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK, lept_decode(&v, "\xf9\x3e\x00", 3, LEPT_CBOR));
+  EXPECT_EQ_DOUBLE(1.5, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK, lept_decode(&v, "\xf9\x00\x01", 3, LEPT_CBOR));
+  EXPECT_EQ_DOUBLE(1.0 / 16777216.0, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK,
+                lept_decode(&v, "\xfa\xc0\x20\x00\x00", 5, LEPT_CBOR));
+  EXPECT_EQ_DOUBLE(-2.5, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK, lept_decode(&v, "\xc1\x1a\x00\x01\x00\x00", 6,
+                                            LEPT_CBOR));
+  EXPECT_EQ_DOUBLE(65536.0, lept_get_number(&v));
+  EXPECT_EQ_INT(LEPT_DECODE_OK, lept_decode(&v, "\xf7", 1, LEPT_CBOR));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  lept_free(&v);
+
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_MSGPACK, "");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_MSGPACK, "\x92\x01");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_MSGPACK, "\xdd\xff\xff\xff\xff");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_MSGPACK, "\xa3\x61\x62");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_MSGPACK, "\x91\x81\xa1\x61");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_MSGPACK, "\x91\xc4\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_MSGPACK,
+                    "\xca\x7f\xc0\x00\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_MSGPACK,
+                    "\x91\xcb\xff\xf0\x00\x00\x00\x00\x00\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_INVALID_KEY, LEPT_MSGPACK, "\x81\x01\x01");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRAILING_DATA, LEPT_MSGPACK, "\xc0\xc0");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_CBOR, "\x19\x01");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRUNCATED, LEPT_CBOR, "\xc1");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR, "\x9f\xff");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR, "\x81\x41\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR, "\xf9\x7c\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR, "\x81\xf9\x7e\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR,
+                    "\xfa\xff\x80\x00\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_UNSUPPORTED, LEPT_CBOR,
+                    "\xfb\x7f\xf8\x00\x00\x00\x00\x00\x00");
+  TEST_DECODE_ERROR(LEPT_DECODE_INVALID_KEY, LEPT_CBOR, "\xa1\x01\x01");
+  TEST_DECODE_ERROR(LEPT_DECODE_TRAILING_DATA, LEPT_CBOR, "\xf6\x00");
+
+  /* Tags are skipped iteratively and nesting is bounded */
+  buf = (char *)malloc(100001);
+  memset(buf, 0xc1, 100000);
+  buf[100000] = 0x01;
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_DECODE_OK, lept_decode(&v, buf, 100001, LEPT_CBOR));
+  EXPECT_EQ_DOUBLE(1.0, lept_get_number(&v));
+  memset(buf, 0x81, LEPT_READER_MAX_DEPTH);
+  buf[LEPT_READER_MAX_DEPTH] = 0x01;
+  EXPECT_EQ_INT(LEPT_DECODE_OK,
+                lept_decode(&v, buf, LEPT_READER_MAX_DEPTH + 1, LEPT_CBOR));
+  memset(buf, 0x91, LEPT_READER_MAX_DEPTH + 1);
+  buf[LEPT_READER_MAX_DEPTH + 1] = 0x01;
+  EXPECT_EQ_INT(LEPT_DECODE_TOO_DEEP,
+                lept_decode(&v, buf, LEPT_READER_MAX_DEPTH + 2, LEPT_MSGPACK));
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  free(buf);
+
+  lept_writer_init(&w);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[\"abc\",1]"));
+  data = lept_writer_encode(&w, &v, LEPT_CBOR, &length);
+  EXPECT_EQ_SIZE_T(6, length);
+  EXPECT_TRUE(memcmp("\x82\x63\x61\x62\x63\x01", data, length) == 0);
+  EXPECT_TRUE(lept_writer_encode(&w, &v, LEPT_MSGPACK, &length) == data);
+  EXPECT_TRUE(memcmp("\x92\xa3\x61\x62\x63\x01", data, length) == 0);
+
+  length = lept_encode_buffer(&v, LEPT_CBOR, out, sizeof(out));
+  EXPECT_EQ_SIZE_T(6, length);
+  EXPECT_TRUE(memcmp("\x82\x63\x61\x62\x63\x01", out, length) == 0);
+  memset(out, 0, sizeof(out));
+  length = lept_encode_buffer(&v, LEPT_MSGPACK, out, 6);
+  EXPECT_EQ_SIZE_T(6, length);
+  EXPECT_TRUE(memcmp("\x92\xa3\x61\x62\x63\x01", out, length) == 0);
+  length = lept_encode_buffer(&v, LEPT_MSGPACK, out, 3);
+  EXPECT_EQ_SIZE_T(6, length);
+  length = lept_encode_buffer(&v, LEPT_MSGPACK, NULL, 0);
+  EXPECT_EQ_SIZE_T(6, length);
+  lept_free(&v);
+  lept_writer_free(&w);
+}
+
+static void test_tape() {
+  printf("test_tape:\n");
+  const char *path = "leptjson_test_file.tape";
+  const char *root, *a, *o;
+  char *tape, keys[32];
+  size_t length;
+  lept_file f;
+  lept_value v;
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "{\"n\":null,\"t\":true,\"f\":false,"
+                               "\"s\":\"a\\u0000b\",\"a\":[1.5,[],{}],"
+                               "\"ab\":-0.0,\"\":\"empty\"}"));
+  tape = lept_tape_encode(&v, &length);
+  lept_free(&v);
+  EXPECT_TRUE(lept_tape_root(tape, length) != NULL);
+  EXPECT_TRUE(lept_tape_root(tape + 1, length - 1) == NULL);
+  EXPECT_TRUE(lept_tape_root(tape, 8) == NULL);
+
+  /* Lengths and offsets are checked against the size of the tape */
+  EXPECT_TRUE(lept_tape_root(tape, length - 1) == NULL);
+  tape[16] = 0x7f; /* member count */
+  EXPECT_TRUE(lept_tape_root(tape, length) == NULL);
+  tape[16] = 0;
+  tape[17]++; /* offset of the first key */
+  EXPECT_TRUE(lept_tape_root(tape, length) == NULL);
+  tape[17]--;
+  tape[8] = 9; /* node type */
+  EXPECT_TRUE(lept_tape_root(tape, length) == NULL);
+  tape[8] = LEPT_OBJECT;
+  tape[length - 1] = 'x'; /* NUL after the last string */
+  EXPECT_TRUE(lept_tape_root(tape, length) == NULL);
+  tape[length - 1] = '\0';
+  EXPECT_TRUE(lept_tape_root(tape, length) != NULL);
+
+  /* A mapped tape is read in place */
+  test_write_file(path, tape, length);
+  free(tape);
+  EXPECT_EQ_INT(0, lept_file_map(&f, path, 0));
+  root = lept_tape_root(f.json, f.size);
+  EXPECT_TRUE(root != NULL);
+  EXPECT_EQ_INT(LEPT_OBJECT, lept_tape_get_type(root));
+  EXPECT_EQ_SIZE_T(7, lept_tape_get_object_size(root));
+  for (size_t i = 0; i < 7; i++) {
+    keys[i] = *lept_tape_get_object_key(root, i);
+  }
+  EXPECT_TRUE(memcmp("ntfsaa\0", keys, 7) == 0);
+  EXPECT_EQ_SIZE_T(2, lept_tape_get_object_key_length(root, 5));
+  EXPECT_EQ_INT(LEPT_NULL,
+                lept_tape_get_type(lept_tape_get_object_value(root, 0)));
+  EXPECT_TRUE(lept_tape_get_boolean(lept_tape_find_object_value(root, "t", 1)));
+  EXPECT_FALSE(lept_tape_get_boolean(lept_tape_find_object_value(root, "f", 1)));
+  o = lept_tape_find_object_value(root, "s", 1);
+  EXPECT_EQ_SIZE_T(3, lept_tape_get_string_length(o));
+  EXPECT_TRUE(memcmp("a\0b", lept_tape_get_string(o), 4) == 0);
+  o = lept_tape_find_object_value(root, "", 0);
+  EXPECT_EQ_STRING("empty", lept_tape_get_string(o),
+                   lept_tape_get_string_length(o));
+  o = lept_tape_find_object_value(root, "ab", 2);
+  EXPECT_EQ_DOUBLE(-0.0, lept_tape_get_number(o));
+  EXPECT_TRUE(lept_tape_find_object_value(root, "b", 1) == NULL);
+  EXPECT_TRUE(lept_tape_find_object_value(root, "abc", 3) == NULL);
+  a = lept_tape_find_object_value(root, "a", 1);
+  EXPECT_EQ_SIZE_T(3, lept_tape_get_array_size(a));
+  EXPECT_EQ_DOUBLE(1.5, lept_tape_get_number(lept_tape_get_array_element(a, 0)));
+  EXPECT_EQ_SIZE_T(0,
+                   lept_tape_get_array_size(lept_tape_get_array_element(a, 1)));
+  EXPECT_EQ_SIZE_T(
+      0, lept_tape_get_object_size(lept_tape_get_array_element(a, 2)));
+  lept_file_unmap(&f);
+  remove(path);
+
+  /* Packed arrays and large objects */
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17]"));
+  tape = lept_tape_encode(&v, &length);
+  root = lept_tape_root(tape, length);
+  EXPECT_EQ_SIZE_T(18, lept_tape_get_array_size(root));
+  EXPECT_EQ_DOUBLE(17.0,
+                   lept_tape_get_number(lept_tape_get_array_element(root, 17)));
+  free(tape);
+  lept_free(&v);
+  lept_set_object(&v, 0);
+  for (size_t i = 0; i < 1000; i++) {
+    size_t klen = (size_t)sprintf(keys, "k%lu", (unsigned long)(i * 7919 % 1000));
+    lept_set_number(lept_set_object_value(&v, keys, klen), (double)i);
+  }
+  tape = lept_tape_encode(&v, &length);
+  root = lept_tape_root(tape, length);
+  for (size_t i = 0; i < 1000; i++) {
+    size_t klen = (size_t)sprintf(keys, "k%lu", (unsigned long)(i * 7919 % 1000));
+    EXPECT_EQ_DOUBLE((double)i, lept_tape_get_number(lept_tape_find_object_value(
+                                    root, keys, klen)));
+  }
+  free(tape);
+  lept_free(&v);
+
+  /* Duplicate keys resolve to the first member, as in the tree */
+  lept_set_object(&v, 0);
+  for (size_t i = 0; i < 64; i++) {
+    lept_set_number(lept_set_object_value(&v, i % 2 ? "d" : "e", 1), (double)i);
+  }
+  tape = lept_tape_encode(&v, &length);
+  root = lept_tape_root(tape, length);
+  EXPECT_EQ_DOUBLE(
+      1.0, lept_tape_get_number(lept_tape_find_object_value(root, "d", 1)));
+  EXPECT_EQ_DOUBLE(
+      0.0, lept_tape_get_number(lept_tape_find_object_value(root, "e", 1)));
+  EXPECT_TRUE(lept_tape_find_object_value(root, "f", 1) == NULL);
+  EXPECT_TRUE(lept_tape_find_object_value(root, "", 0) == NULL);
+  free(tape);
+  lept_free(&v);
+}
+
+#define TEST_CANONICAL(expect, json)                                           \
+  do {                                                                         \
+    lept_value v;                                                              \
+    char *json2;                                                               \
+    size_t length;                                                             \
+    lept_init(&v);                                                             \
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));                        \
+    json2 = lept_stringify_canonical(&v, &length);                             \
+    EXPECT_EQ_STRING(expect, json2, length);                                   \
+    lept_free(&v);                                                             \
+    free(json2);                                                               \
+  } while (0)
+
+static void test_canonical() {
+  printf("test_canonical:\n");
+  lept_writer w;
+  lept_value v, u;
+  const char *json;
+  char *expect, key[16];
+  size_t length, elength;
+
+  TEST_CANONICAL("null", "null");
+  TEST_CANONICAL("{}", " { } ");
+  TEST_CANONICAL("[0,0.1,1.5,100,1e21,5e-324,1.7976931348623157e308]",
+                 "[-0.0,0.1,1.5,1e2,1E21,4.9406564584124654e-324,"
+                 "1.7976931348623157e308]");
+  TEST_CANONICAL("[1e-7,1.5e-7,1e16,-2.5e16,1e100,1e-100,123456,0.0001]",
+                 "[1e-07,0.00000015,1E+16,-25e15,1e100,1e-100,123456,1e-4]");
+  TEST_CANONICAL("[0.1,0.2,0.30000000000000004,1,2,3,4,5,6,7,8,9,10,11,12,13]",
+                 "[0.1,0.2,0.30000000000000004,1,2,3,4,5,6,7,8,9,10,11,12,13]");
+  TEST_CANONICAL("\"\\u0001/\\n\xC3\xA9\"", "\"\\u0001\\/\\n\\u00E9\"");
+  TEST_CANONICAL("{\"a\":{\"x\":1,\"y\":[{\"m\":0,\"n\":0}]},\"b\":null}",
+                 "{\"b\":null,\"a\":{\"y\":[{\"n\":0,\"m\":0}],\"x\":1}}");
+  /* Keys sharing their first 8 bytes, an embedded NUL and non-ASCII keys */
+  TEST_CANONICAL("{\"abcdefgh\":1,\"abcdefgh\\u0000\":2,\"abcdefghA\":3,"
+                 "\"abcdefghZ\":4,\"b\":5,\"\xC3\xA9\":6}",
+                 "{\"\\u00E9\":6,\"abcdefghZ\":4,\"b\":5,\"abcdefghA\":3,"
+                 "\"abcdefgh\\u0000\":2,\"abcdefgh\":1}");
+  TEST_CANONICAL("{\"a\":1,\"a\":2}", "{\"a\":1,\"a\":2}");
+
+  /* Large objects in any insertion order give the same bytes */
+  lept_init(&v);
+  lept_init(&u);
+  lept_set_object(&v, 0);
+  lept_set_object(&u, 0);
+  for (size_t i = 0; i < 100; i++) {
+    length = (size_t)sprintf(key, "k%lu", (unsigned long)(i * 37 % 100));
+    lept_set_number(lept_set_object_value(&v, key, length), (double)(i * 37 % 100));
+    length = (size_t)sprintf(key, "k%lu", (unsigned long)(99 - i));
+    lept_set_number(lept_set_object_value(&u, key, length), (double)(99 - i));
+  }
+  expect = lept_stringify_canonical(&u, &elength);
+  EXPECT_TRUE(strncmp(expect, "{\"k0\":0,\"k1\":1,\"k10\":10,", 24) == 0);
+  lept_writer_init(&w);
+  json = lept_writer_stringify_canonical(&w, &v, &length);
+  EXPECT_EQ_SIZE_T(elength, length);
+  EXPECT_TRUE(memcmp(expect, json, length + 1) == 0);
+  EXPECT_TRUE(w.keys != NULL);
+  EXPECT_TRUE(lept_writer_stringify_canonical(&w, &u, &length) == json);
+  EXPECT_TRUE(memcmp(expect, json, length + 1) == 0);
+  lept_writer_free(&w);
+  free(expect);
+  lept_free(&v);
+  lept_free(&u);
+}
+
+static void *test_freeze_reader(void *arg) {
+  lept_value *v = (lept_value *)arg;
+  size_t errors = 0;
+  char key[16];
+  for (size_t round = 0; round < 20; round++) {
+    for (size_t i = 0; i < 100; i++) {
+      size_t klen = (size_t)sprintf(key, "k%lu", (unsigned long)i);
+      lept_value *e = lept_find_object_value(v, key, klen);
+      lept_pointer p;
+      errors += e == NULL || lept_get_number(lept_get_array_element(e, 1)) !=
+                                 (double)i + 1;
+      errors += lept_get_array_size(e) != 20;
+      klen = (size_t)sprintf(key, "/k%lu/3", (unsigned long)i);
+      lept_pointer_compile(&p, key, klen, 0);
+      e = lept_pointer_get(&p, v);
+      errors += e == NULL || lept_get_number(e) != (double)i + 3;
+      lept_pointer_free(&p);
+    }
+    errors += lept_find_object_value(v, "missing", 7) != NULL;
+  }
+  return (void *)errors;
+}
+
+static void test_freeze() {
+  printf("test_freeze:\n");
+  pthread_t threads[4];
+  lept_value v, copy;
+  char *json, *frozen;
+  size_t size = 1, length;
+  void *errors;
+
+  json = (char *)malloc(100 * 128);
+  json[0] = '{';
+  for (size_t i = 0; i < 100; i++) {
+    size += sprintf(json + size, "%s\"k%lu\":[", i > 0 ? "," : "",
+                    (unsigned long)i);
+    for (size_t j = 0; j < 20; j++) {
+      size += sprintf(json + size, "%s%lu", j > 0 ? "," : "",
+                      (unsigned long)(i + j));
+    }
+    json[size++] = ']';
+  }
+  strcpy(json + size, "}");
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&v, json));
+  lept_freeze(&v);
+  EXPECT_TRUE(lept_is_frozen(&v));
+  EXPECT_EQ_SIZE_T(100, lept_get_object_capacity(&v));
+  EXPECT_TRUE(lept_is_frozen(lept_get_object_value(&v, 99)));
+  frozen = lept_stringify(&v, &length);
+  EXPECT_EQ_SIZE_T(strlen(json), length);
+  EXPECT_TRUE(memcmp(json, frozen, length) == 0);
+  free(frozen);
+
+  for (size_t i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, test_freeze_reader, &v);
+  }
+  for (size_t i = 0; i < 4; i++) {
+    pthread_join(threads[i], &errors);
+    EXPECT_EQ_SIZE_T(0, (size_t)errors);
+  }
+
+  lept_init(&copy);
+  lept_copy(&copy, &v);
+  EXPECT_FALSE(lept_is_frozen(&copy));
+  EXPECT_TRUE(lept_is_equal(&copy, &v));
+  lept_set_number(lept_set_object_value(&copy, "new", 3), 1.0);
+  lept_free(&copy);
+  lept_free(&v);
+
+  /* Parsed eagerly, the numeric arrays are packed before freezing */
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+  EXPECT_TRUE(lept_get_array_numbers(lept_get_object_value(&v, 0)) != NULL);
+  lept_freeze(&v);
+  for (size_t i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, test_freeze_reader, &v);
+  }
+  for (size_t i = 0; i < 4; i++) {
+    pthread_join(threads[i], &errors);
+    EXPECT_EQ_SIZE_T(0, (size_t)errors);
+  }
+  lept_free(&v);
+  free(json);
+
+  /* Duplicate keys resolve to the first member, as without an index */
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,"
+                               "\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"j\":10,"
+                               "\"k\":11,\"l\":12,\"m\":13,\"n\":14,\"o\":15,"
+                               "\"a\":16}"));
+  lept_freeze(&v);
+  EXPECT_EQ_SIZE_T(0, lept_find_object_index(&v, "a", 1));
+  EXPECT_EQ_SIZE_T(14, lept_find_object_index(&v, "o", 1));
+  EXPECT_EQ_SIZE_T(LEPT_KEY_NOT_EXIST, lept_find_object_index(&v, "p", 1));
+  lept_free(&v);
+
+  /* Packed arrays are unpacked, so element pointers can be handed out */
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse(&v, "[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15]"));
+  lept_freeze(&v);
+  EXPECT_TRUE(lept_get_array_numbers(&v) == NULL);
+  EXPECT_EQ_DOUBLE(15.0, lept_get_array_number(&v, 15));
+  EXPECT_EQ_DOUBLE(3.0, lept_get_number(lept_get_array_element(&v, 3)));
+  EXPECT_EQ_DOUBLE(3.0,
+                   lept_get_number(lept_view_array_element(&v, 3, &copy)));
+
+  /* Reparsing replaces the frozen tree instead of writing into it */
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_reparse(&v, "{\"a\":[1,2],\"b\":\"x\"}"));
+  EXPECT_FALSE(lept_is_frozen(&v));
+  EXPECT_EQ_SIZE_T(2, lept_get_object_size(&v));
+  lept_set_number(lept_set_object_value(&v, "c", 1), 3.0);
+  lept_free(&v);
+}
+
+typedef struct {
+  lept_shared *s;
+  size_t errors;
+} test_shared_arg;
+
+static void *test_shared_reader(void *arg) {
+  test_shared_arg *a = (test_shared_arg *)arg;
+  int reader = lept_shared_register(a->s);
+  double last = 0;
+  for (size_t i = 0; i < 20000; i++) {
+    const lept_value *v = lept_shared_acquire(a->s, reader);
+    size_t index = lept_find_object_index(v, "version", 7);
+    double version = lept_get_number(lept_get_object_value(v, index));
+    /* Both members come from the same version, which only moves forward */
+    a->errors += version < last;
+    a->errors += lept_get_array_size(lept_get_object_value(v, 1 - index)) !=
+                 (size_t)version % 8;
+    last = version;
+    lept_shared_release(a->s, reader);
+  }
+  lept_shared_unregister(a->s, reader);
+  return NULL;
+}
+
+static void test_shared() {
+  printf("test_shared:\n");
+  test_shared_arg args[4];
+  pthread_t threads[4];
+  test_allocator_stats stats = {0, 0, 0};
+  static lept_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  lept_shared *s;
+  lept_value v;
+  size_t blocks;
+  const lept_value *snapshot;
+  char json[64];
+  int reader;
+
+  a.ctx = &stats;
+  s = lept_shared_new(8);
+  reader = lept_shared_register(s);
+  EXPECT_TRUE(reader >= 0);
+  EXPECT_TRUE(lept_shared_acquire(s, reader) == NULL);
+  lept_shared_release(s, reader);
+
+  /* A replaced version lives until its last reader leaves */
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK,
+                lept_parse_with_allocator(&v, "[\"a\",\"b\"]",
+                                          lept_register_allocator(&a)));
+  lept_shared_publish(s, &v);
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  snapshot = lept_shared_acquire(s, reader);
+  EXPECT_TRUE(lept_is_frozen(snapshot));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "[3]"));
+  blocks = stats.blocks;
+  lept_shared_publish(s, &v);
+  EXPECT_EQ_SIZE_T(blocks, stats.blocks);
+  EXPECT_EQ_SIZE_T(2, lept_get_array_size(snapshot));
+  lept_shared_release(s, reader);
+  EXPECT_EQ_SIZE_T(blocks, stats.blocks); /* readers never free */
+  lept_shared_collect(s);
+  EXPECT_TRUE(stats.blocks < blocks);
+  snapshot = lept_shared_acquire(s, reader);
+  EXPECT_EQ_SIZE_T(1, lept_get_array_size(snapshot));
+  lept_shared_unregister(s, reader);
+  EXPECT_EQ_INT(reader, lept_shared_register(s));
+  lept_shared_unregister(s, reader);
+
+  /* The slot table has the size given at init */
+  for (int i = 0; i < 8; i++) {
+    EXPECT_EQ_INT(i, lept_shared_register(s));
+  }
+  EXPECT_EQ_INT(-1, lept_shared_register(s));
+  for (int i = 0; i < 8; i++) {
+    lept_shared_unregister(s, i);
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    args[i].s = s;
+    args[i].errors = 0;
+  }
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, "{\"version\":0,\"a\":[]}"));
+  lept_shared_publish(s, &v);
+  for (size_t i = 0; i < 4; i++) {
+    pthread_create(&threads[i], NULL, test_shared_reader, &args[i]);
+  }
+  for (size_t i = 1; i <= 200; i++) {
+    sprintf(json, "{\"a\":[%.*s],\"version\":%lu}", (int)(i % 8 * 2 - (i % 8 > 0)),
+            "1,1,1,1,1,1,1,1", (unsigned long)i);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+    lept_shared_publish(s, &v);
+  }
+  for (size_t i = 0; i < 4; i++) {
+    pthread_join(threads[i], NULL);
+    EXPECT_EQ_SIZE_T(0, args[i].errors);
+  }
+  lept_shared_free(s);
+}
+
+static void test_free_async() {
+  printf("test_free_async:\n");
+  test_allocator_stats stats = {0, 0, 0};
+  static lept_allocator a = {test_malloc, test_realloc, test_free, NULL};
+  const char *json = "{\"a\":[1,2,3,{\"b\":\"x\"}],\"s\":\"abc\",\"n\":null}";
+  lept_value v, batch[8];
+  lept_reclaimer *r;
+  int id;
+
+  a.ctx = &stats;
+  id = lept_register_allocator(&a);
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_with_allocator(&v, json, id));
+  for (size_t i = 0; i < 8; i++) {
+    lept_init(&batch[i]);
+    EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_with_allocator(&batch[i], json, id));
+  }
+  EXPECT_TRUE(stats.blocks > 0);
+
+  /* Values are detached at once and keep their allocator */
+  r = lept_reclaimer_new();
+  EXPECT_TRUE(r != NULL);
+  lept_free_async(r, &v);
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+  lept_free_batch(r, batch, 8);
+  for (size_t i = 0; i < 8; i++) {
+    EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&batch[i]));
+  }
+  lept_free_batch(r, batch, 0);
+  lept_reclaimer_drain(r);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_SIZE_T(0, stats.mismatches);
+
+  /* Pending documents are freed when the reclaimer stops */
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_with_allocator(&v, json, id));
+  lept_free_async(r, &v);
+  lept_reclaimer_free(r);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_with_allocator(&v, json, id));
+  lept_free_async(NULL, &v);
+  EXPECT_EQ_SIZE_T(0, stats.blocks);
+  EXPECT_EQ_INT(LEPT_NULL, lept_get_type(&v));
+}
+
+static void test_tree_parallel_expect(lept_value *v) {
+  lept_value copy, expect;
+  char *json, *expect_json;
+  size_t length, expect_length;
+  lept_init(&copy);
+  lept_init(&expect);
+  lept_copy(&expect, v);
+  lept_copy_parallel(&copy, v, 4);
+  json = lept_stringify(&copy, &length);
+  expect_json = lept_stringify(&expect, &expect_length);
+  EXPECT_EQ_SIZE_T(expect_length, length);
+  EXPECT_TRUE(memcmp(expect_json, json, length) == 0);
+  EXPECT_EQ_INT(lept_is_equal(&copy, v), lept_is_equal_parallel(&copy, v, 4));
+  EXPECT_TRUE(lept_is_equal_parallel(&copy, &expect, 4));
+  free(json);
+  free(expect_json);
+  lept_free(&copy);
+  lept_free(&expect);
+}
+
+static void test_tree_parallel() {
+  printf("test_tree_parallel:\n");
+  size_t size = 0, n = 3000;
+  char *json = (char *)malloc(n * 200);
+  lept_value v, u, w;
+
+  size += sprintf(json + size, "{\"a\":[");
+  for (size_t i = 0; i < n; i++) {
+    size += sprintf(json + size, "%s{\"i\":%lu,\"s\":\"x\",\"o\":{\"t\":[true]}}",
+                    i > 0 ? "," : "", (unsigned long)i);
+  }
+  size += sprintf(json + size, "],\"b\":[");
+  for (size_t i = 0; i < n; i++) {
+    size += sprintf(json + size, "%s%lu.5", i > 0 ? "," : "", (unsigned long)i);
+  }
+  size += sprintf(json + size, "],\"c\":{");
+  for (size_t i = 0; i < n; i++) {
+    size += sprintf(json + size, "%s\"k%lu\":[%lu]", i > 0 ? "," : "",
+                    (unsigned long)i, (unsigned long)i);
+  }
+  strcpy(json + size, "},\"d\":{\"k\":1,\"k\":1}}");
+
+  lept_init(&v);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&v, json));
+  test_tree_parallel_expect(&v);
+  lept_init(&u);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&u, json));
+  EXPECT_TRUE(lept_is_equal_parallel(&u, &v, 4));
+  test_tree_parallel_expect(&u);
+  lept_free(&u);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse_lazy(&u, json));
+  test_tree_parallel_expect(&u);
+  lept_free(&u);
+
+  /* Differences deep inside split containers are found */
+  lept_init(&u);
+  lept_copy_parallel(&u, &v, 4);
+  lept_set_number(lept_find_object_value(
+                      lept_get_array_element(lept_find_object_value(&u, "a", 1),
+                                             n - 1),
+                      "i", 1),
+                  -1.0);
+  EXPECT_FALSE(lept_is_equal_parallel(&u, &v, 4));
+  lept_free(&u);
+  lept_copy_parallel(&u, &v, 4);
+  lept_set_number(lept_get_array_element(lept_find_object_value(
+                                             lept_find_object_value(&u, "c", 1),
+                                             "k2999", 5),
+                                         0),
+                  -1.0);
+  EXPECT_FALSE(lept_is_equal_parallel(&u, &v, 4));
+  lept_free(&u);
+  lept_copy_parallel(&u, &v, 4);
+  lept_popback_array_element(lept_find_object_value(&u, "a", 1));
+  EXPECT_FALSE(lept_is_equal_parallel(&u, &v, 4));
+  lept_free(&u);
+  lept_copy_parallel(&u, &v, 4);
+  lept_remove_object_value(lept_find_object_value(&u, "c", 1), 7);
+  lept_set_null(lept_set_object_value(lept_find_object_value(&u, "c", 1),
+                                      "other", 5));
+  EXPECT_FALSE(lept_is_equal_parallel(&u, &v, 4));
+  EXPECT_FALSE(lept_is_equal_parallel(&v, &u, 4));
+  EXPECT_EQ_INT(lept_is_equal(&u, &v), lept_is_equal_parallel(&u, &v, 4));
+  EXPECT_EQ_INT(lept_is_equal(&v, &u), lept_is_equal_parallel(&v, &u, 4));
+  lept_free(&u);
+  lept_init(&w);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&u, "{\"a\":1}"));
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&w, "{\"b\":1}"));
+  EXPECT_EQ_INT(0, lept_is_equal(&u, &w));
+  EXPECT_EQ_INT(lept_is_equal(&u, &w), lept_is_equal_parallel(&u, &w, 4));
+  lept_free(&u);
+  lept_free(&w);
+
+  /* Small and scalar values take the sequential path */
+  lept_set_number(&u, 1.0);
+  test_tree_parallel_expect(&u);
+  EXPECT_EQ_INT(LEPT_PARSE_OK, lept_parse(&u, "[]"));
+  test_tree_parallel_expect(&u);
+  lept_free(&u);
+  lept_free(&v);
+  free(json);
+}
+
 int main() {
   test_parse();
   test_stringify();
   test_equal();
   test_access();
+  test_allocator();
+  test_parser();
+  test_reparse();
+  test_pointer();
+  test_parse_lazy();
+  test_parse_projected();
+  test_path();
+  test_patch();
+  test_diff();
+  test_ndjson();
+  test_ndjson_parallel();
+  test_parse_parallel();
+  test_reader();
+  test_reader_chunked();
+  test_parse_many();
+  test_parse_file();
+  test_binary();
+  test_tape();
+  test_canonical();
+  test_freeze();
+  test_shared();
+  test_free_async();
+  test_tree_parallel();
   printf("%d/%d (%3.2f%%) passed\n", test_pass, test_count,
          test_pass * 100.0 / test_count);
   return main_ret;